@@ -0,0 +1,744 @@
+#include "ansi.h"
+#include "term.h"
+#include "screen.h"
+
+/*
+ * A byte-at-a-time state machine in the style of the DEC parser diagrams
+ * (vt100.net/emu/dec_ansi_parser): printable runs in the ground state go
+ * straight to term_write_some(), and CSI sequences are dispatched on their
+ * final byte through _csi_handlers.  Nothing is buffered beyond the
+ * parameters of the sequence being parsed, so work per byte is constant
+ * apart from the handful of commands the PT has no equivalent for (insert
+ * and delete character), which are redrawn from the screen model, a line
+ * at most.  What doesn't fit in the transmit ring is left to the caller.
+ *
+ * Cursor motion goes through term_move(), which knows where the cursor is
+ * from screen_shown and picks the cheapest way there.
+ *
+ * The PT has no working video attributes or scrolling regions, so SGR and
+ * DECSTBM are dropped.  Controls that mean something else to the PT (CTRL N
+ * and CTRL O change its flow control, CTRL Z clears the screen) never reach
+ * it; SO and SI select the alternate character set like they do on a VT100.
+ */
+
+#define ANSI_MAX_PARAMS         8
+#define ANSI_MAX_PARAM          999
+
+// Room left in the transmit ring before a control byte is stepped.  Most
+// commands need far less; inserting or deleting many lines at once can
+// need more, and waits for the rest in term_write().
+#define ANSI_STEP_ROOM          128
+
+#define CTRL_BEL                0x07
+#define CTRL_SO                 0x0E
+#define CTRL_SI                 0x0F
+#define CTRL_CAN                0x18
+#define CTRL_SUB                0x1A
+#define CTRL_DEL                0x7F
+
+// The PT's width, which 40-column mode halves
+#define COLS                    screen_cols(&screen_shown)
+
+// 0-based; writing the bottom-right cell would scroll the screen
+#define LAST_ROW                (SCREEN_ROWS - 1)
+#define LAST_COL                (COLS - 1)
+
+enum ansi_state {
+    AS_GROUND,
+    AS_ESC,
+    // ESC followed by an intermediate such as ( or #
+    AS_ESC_INTERMEDIATE,
+    AS_CSI,
+    // Skipping an OSC, DCS, PM or APC string up to BEL or ST
+    AS_STRING,
+    AS_STRING_ESC,
+};
+
+typedef void (*csi_handler)(uint16_t n);
+
+static struct busybox_sink _reply = {NULL, NULL};
+static byte _state = AS_GROUND;
+static uint16_t _params[ANSI_MAX_PARAMS];
+static byte _nparams = 0;
+// The first parameter byte when it was a private marker (? > < =)
+static char _private = 0;
+static char _intermediate = 0;
+
+// Character sets: true for DEC special graphics
+static bool _g0_graphics = false;
+static bool _g1_graphics = false;
+// SO selects G1
+static bool _shifted = false;
+
+// ESC 7 / ESC 8, 0-based
+static byte _saved_row = 0;
+static byte _saved_col = 0;
+
+// Set after a character went in the last column of _wrap_row.  The VT100
+// keeps its cursor there and wraps with the next character; the PT has
+// already wrapped (except on the last row, where the last cell is never
+// written and its cursor stays put).
+static bool _wrap_pending = false;
+static byte _wrap_row = 0;
+
+static struct ansi_stats _stats;
+
+//////////////////////////////////////////////////////////////////////////////
+// Output
+//////////////////////////////////////////////////////////////////////////////
+
+static void emit_escape(char c) {
+    char seq[] = {TERM_ESCAPE, c};
+    term_write(seq, sizeof(seq));
+}
+
+// 0-based, unlike term_move()
+static void move_to(int row, int col) {
+    term_move((byte) (constrain(row, 0, LAST_ROW) + 1), (byte) (constrain(col, 0, LAST_COL) + 1));
+}
+
+static void update_charset() {
+    bool graphics = _shifted ? _g1_graphics : _g0_graphics;
+    if (graphics != screen_shown.alt) {
+        emit_escape(graphics ? TERM_ENABLE_ALT_CHAR : TERM_DISABLE_ALT_CHAR);
+    }
+}
+
+// Writes cells (which may have SCREEN_ALT set) from the cursor, leaving the
+// bottom-right cell alone, then puts the cursor back.
+static void write_cells(const char *cells, int count) {
+    byte row = screen_shown.row;
+    byte col = screen_shown.col;
+    bool alt = screen_shown.alt;
+
+    if (row == LAST_ROW && col + count > LAST_COL) {
+        count = LAST_COL - col;
+    }
+    for (int i = 0; i < count; i++) {
+        bool cell_alt = (cells[i] & SCREEN_ALT) != 0;
+        if (cell_alt != screen_shown.alt) {
+            emit_escape(cell_alt ? TERM_ENABLE_ALT_CHAR : TERM_DISABLE_ALT_CHAR);
+        }
+        term_write((char) (cells[i] & ~SCREEN_ALT));
+    }
+    if (alt != screen_shown.alt) {
+        emit_escape(alt ? TERM_ENABLE_ALT_CHAR : TERM_DISABLE_ALT_CHAR);
+    }
+    move_to(row, col);
+}
+
+// Writes as many of len printable characters as there's room for and
+// returns how many that was, wrapping like a VT100
+static size_t write_chars(const uint8_t *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        if (_wrap_pending) {
+            if (term_writable() < 2) {
+                break;
+            }
+            _wrap_pending = false;
+            if (_wrap_row == LAST_ROW) {
+                // The VT100 scrolls now
+                term_write((char) TERM_RETURN);
+                term_write((char) TERM_CURSOR_DOWN);
+            }
+        }
+        byte row = screen_shown.row;
+        size_t left = (size_t) (COLS - screen_shown.col);
+        size_t n = min(len - done, left);
+        // Leaving the bottom-right cell alone, which would scroll the PT
+        size_t send = row == LAST_ROW && n == left ? n - 1 : n;
+        size_t sent = term_write_some(buf + done, send);
+        done += sent;
+        if (sent < send) {
+            break;
+        }
+        if (n == left) {
+            done += n - send;
+            _wrap_pending = true;
+            _wrap_row = row;
+        }
+    }
+    return done;
+}
+
+// Puts the PT's cursor where the VT100's is, for anything but a character
+static void settle() {
+    if (_wrap_pending) {
+        _wrap_pending = false;
+        move_to(_wrap_row, LAST_COL);
+    }
+}
+
+static void write_blanks(int count) {
+    char blanks[SCREEN_COLS];
+    memset(blanks, ' ', sizeof(blanks));
+    write_cells(blanks, min(count, COLS - screen_shown.col));
+}
+
+static void reply(const char *val) {
+    if (_reply.write != NULL) {
+        _reply.write(_reply.ctx, (const uint8_t *) val, strlen(val));
+    }
+}
+
+static void reply_number(uint16_t val) {
+    char buf[8];
+    reply(utoa(val, buf, 10));
+}
+
+static void unsupported() {
+    _stats.unsupported++;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Controls and Escape Sequences
+//////////////////////////////////////////////////////////////////////////////
+
+static void line_feed() {
+    term_write((char) TERM_CURSOR_DOWN);
+}
+
+static void reverse_line_feed() {
+    if (screen_shown.row > 0) {
+        term_write((char) TERM_CURSOR_UP);
+        return;
+    }
+    // Scroll down by inserting a line at the top
+    byte col = screen_shown.col;
+    emit_escape('E');
+    move_to(0, col);
+}
+
+static void execute(uint8_t c) {
+    _stats.sequences++;
+
+    switch (c) {
+        case TERM_RETURN:
+            if (_wrap_pending) {
+                // Usually CR LF, which puts the cursor where the PT has it
+                _wrap_pending = false;
+                move_to(_wrap_row, 0);
+                break;
+            }
+            term_write((char) c);
+            break;
+        case CTRL_BEL:
+        case TERM_CURSOR_LEFT:
+        case '\t':
+            settle();
+            term_write((char) c);
+            break;
+        case TERM_CURSOR_DOWN:
+        case TERM_CURSOR_UP:
+        case TERM_CURSOR_RIGHT:
+            // VT and FF are line feeds on a VT100
+            settle();
+            line_feed();
+            break;
+        case CTRL_SO:
+            _shifted = true;
+            update_charset();
+            break;
+        case CTRL_SI:
+            _shifted = false;
+            update_charset();
+            break;
+        default:
+            // Everything else is either meaningless or dangerous to the PT
+            break;
+    }
+}
+
+static void save_cursor() {
+    _saved_row = screen_shown.row;
+    _saved_col = screen_shown.col;
+}
+
+static void restore_cursor() {
+    move_to(_saved_row, _saved_col);
+}
+
+static void esc_dispatch(uint8_t c) {
+    _stats.sequences++;
+    _state = AS_GROUND;
+    settle();
+
+    switch (c) {
+        case '7':
+            save_cursor();
+            break;
+        case '8':
+            restore_cursor();
+            break;
+        case 'D':
+            line_feed();
+            break;
+        case 'E':
+            term_write((char) TERM_NEW_LINE);
+            break;
+        case 'M':
+            reverse_line_feed();
+            break;
+        case 'H':
+            // Set tab stop
+            emit_escape('1');
+            break;
+        case 'c':
+            _g0_graphics = false;
+            _g1_graphics = false;
+            _shifted = false;
+            update_charset();
+            term_clear();
+            break;
+        case '=':
+        case '>':
+            // Keypad modes; the PT keypad only sends digits
+            break;
+        default:
+            unsupported();
+            break;
+    }
+}
+
+static void esc_intermediate_dispatch(uint8_t c) {
+    _stats.sequences++;
+    _state = AS_GROUND;
+
+    switch (_intermediate) {
+        case '(':
+            _g0_graphics = c == '0';
+            update_charset();
+            break;
+        case ')':
+            _g1_graphics = c == '0';
+            update_charset();
+            break;
+        default:
+            unsupported();
+            break;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CSI Sequences
+//////////////////////////////////////////////////////////////////////////////
+
+// Parameter i, or def when it's missing or 0
+static uint16_t param(byte i, uint16_t def) {
+    return i < _nparams && _params[i] != 0 ? _params[i] : def;
+}
+
+static void csi_cursor_up(uint16_t n) {
+    move_to(screen_shown.row - n, screen_shown.col);
+}
+
+static void csi_cursor_down(uint16_t n) {
+    move_to(screen_shown.row + n, screen_shown.col);
+}
+
+static void csi_cursor_forward(uint16_t n) {
+    move_to(screen_shown.row, screen_shown.col + n);
+}
+
+static void csi_cursor_back(uint16_t n) {
+    move_to(screen_shown.row, screen_shown.col - n);
+}
+
+static void csi_next_line(uint16_t n) {
+    move_to(screen_shown.row + n, 0);
+}
+
+static void csi_previous_line(uint16_t n) {
+    move_to(screen_shown.row - n, 0);
+}
+
+static void csi_column(uint16_t n) {
+    move_to(screen_shown.row, n - 1);
+}
+
+static void csi_row(uint16_t n) {
+    move_to(n - 1, screen_shown.col);
+}
+
+static void csi_position(uint16_t n) {
+    move_to(n - 1, param(1, 1) - 1);
+}
+
+static void csi_erase_line(uint16_t) {
+    byte row = screen_shown.row;
+    byte col = screen_shown.col;
+
+    switch (param(0, 0)) {
+        case 0:
+            emit_escape(TERM_ERASE_TO_EOL);
+            break;
+        case 1:
+            move_to(row, 0);
+            write_blanks(col + 1);
+            move_to(row, col);
+            break;
+        case 2:
+            move_to(row, 0);
+            emit_escape(TERM_ERASE_TO_EOL);
+            move_to(row, col);
+            break;
+        default:
+            unsupported();
+            break;
+    }
+}
+
+static void csi_erase_display(uint16_t) {
+    byte row = screen_shown.row;
+    byte col = screen_shown.col;
+
+    switch (param(0, 0)) {
+        case 0:
+            emit_escape(TERM_ERASE_TO_EOP);
+            break;
+        case 1:
+            for (byte r = 0; r < row; r++) {
+                move_to(r, 0);
+                emit_escape(TERM_ERASE_TO_EOL);
+            }
+            move_to(row, 0);
+            write_blanks(col + 1);
+            move_to(row, col);
+            break;
+        case 2:
+            term_write((char) TERM_CLEAR);
+            move_to(row, col);
+            break;
+        default:
+            // 3 clears xterm's scrollback, which we don't have
+            break;
+    }
+}
+
+static void csi_insert_lines(uint16_t n) {
+    byte col = screen_shown.col;
+    for (uint16_t i = 0; i < n && i < SCREEN_ROWS; i++) {
+        emit_escape('E');
+    }
+    move_to(screen_shown.row, col);
+}
+
+static void csi_delete_lines(uint16_t n) {
+    byte col = screen_shown.col;
+    for (uint16_t i = 0; i < n && i < SCREEN_ROWS; i++) {
+        emit_escape('R');
+    }
+    move_to(screen_shown.row, col);
+}
+
+// The PT can't insert or delete characters, so the rest of the line is
+// redrawn from the screen model.
+static void csi_insert_chars(uint16_t n) {
+    const char *cells = screen_shown.cells[screen_shown.row];
+    int col = screen_shown.col;
+    int count = min((int) n, COLS - col);
+
+    char line[SCREEN_COLS];
+    memset(line, ' ', count);
+    memcpy(line + count, cells + col, COLS - col - count);
+    write_cells(line, COLS - col);
+}
+
+static void csi_delete_chars(uint16_t n) {
+    const char *cells = screen_shown.cells[screen_shown.row];
+    int col = screen_shown.col;
+    int count = min((int) n, COLS - col);
+
+    char line[SCREEN_COLS];
+    memcpy(line, cells + col + count, COLS - col - count);
+    memset(line + COLS - col - count, ' ', count);
+    write_cells(line, COLS - col);
+}
+
+static void csi_erase_chars(uint16_t n) {
+    write_blanks(n);
+}
+
+static void csi_tab_forward(uint16_t n) {
+    for (uint16_t i = 0; i < n && i < COLS; i++) {
+        term_write('\t');
+    }
+}
+
+static void csi_tab_back(uint16_t n) {
+    for (uint16_t i = 0; i < n && i < COLS; i++) {
+        emit_escape('I');
+    }
+}
+
+static void csi_tab_clear(uint16_t) {
+    switch (param(0, 0)) {
+        case 0:
+            emit_escape('2');
+            break;
+        case 3:
+            emit_escape('3');
+            break;
+        default:
+            break;
+    }
+}
+
+static void csi_save_cursor(uint16_t) {
+    save_cursor();
+}
+
+static void csi_restore_cursor(uint16_t) {
+    restore_cursor();
+}
+
+static void csi_scroll_region(uint16_t) {
+    if (param(0, 1) != 1 || param(1, SCREEN_ROWS) != SCREEN_ROWS) {
+        unsupported();
+    }
+    move_to(0, 0);
+}
+
+static void csi_device_attributes(uint16_t) {
+    if (_private == 0 && param(0, 0) == 0) {
+        // VT100 with no options
+        reply("\x1b[?1;0c");
+    }
+}
+
+static void csi_device_status(uint16_t) {
+    switch (param(0, 0)) {
+        case 5:
+            reply("\x1b[0n");
+            break;
+        case 6:
+            reply("\x1b[");
+            reply_number(screen_shown.row + 1);
+            reply(";");
+            reply_number(screen_shown.col + 1);
+            reply("R");
+            break;
+        default:
+            break;
+    }
+}
+
+static void csi_ignore(uint16_t) {
+}
+
+struct csi_command {
+    char final;
+    csi_handler handler;
+};
+
+// Commands by final byte.  n is the first parameter, defaulting to 1.
+static const struct csi_command _csi_commands[] = {
+        {'@', csi_insert_chars},
+        {'A', csi_cursor_up},
+        {'B', csi_cursor_down},
+        {'C', csi_cursor_forward},
+        {'D', csi_cursor_back},
+        {'E', csi_next_line},
+        {'F', csi_previous_line},
+        {'G', csi_column},
+        {'H', csi_position},
+        {'I', csi_tab_forward},
+        {'J', csi_erase_display},
+        {'K', csi_erase_line},
+        {'L', csi_insert_lines},
+        {'M', csi_delete_lines},
+        {'P', csi_delete_chars},
+        {'X', csi_erase_chars},
+        {'Z', csi_tab_back},
+        {'`', csi_column},
+        {'c', csi_device_attributes},
+        {'d', csi_row},
+        {'f', csi_position},
+        {'g', csi_tab_clear},
+        // Modes and attributes the PT doesn't have
+        {'h', csi_ignore},
+        {'l', csi_ignore},
+        {'m', csi_ignore},
+        {'n', csi_device_status},
+        {'r', csi_scroll_region},
+        {'s', csi_save_cursor},
+        {'u', csi_restore_cursor},
+};
+
+// _csi_commands indexed by final byte - '@', built by ansi_init()
+static csi_handler _csi_handlers[0x40];
+
+static void csi_dispatch(uint8_t c) {
+    _stats.sequences++;
+    _state = AS_GROUND;
+
+    csi_handler handler = _csi_handlers[c - '@'];
+    if (handler == NULL || _intermediate != 0 || (_private != 0 && handler != csi_ignore)) {
+        unsupported();
+        return;
+    }
+    if (handler != csi_ignore) {
+        settle();
+    }
+    handler(param(0, 1));
+}
+
+static void csi_param(uint8_t c) {
+    if (c >= '<' && c <= '?') {
+        if (_nparams == 0 && _params[0] == 0) {
+            _private = c;
+        }
+    } else if (c == ';') {
+        if (_nparams < ANSI_MAX_PARAMS - 1) {
+            _params[++_nparams] = 0;
+        }
+    } else if (c >= '0' && c <= '9') {
+        uint16_t *p = &_params[_nparams];
+        *p = (uint16_t) min(*p * 10 + (c - '0'), ANSI_MAX_PARAM);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Parser
+//////////////////////////////////////////////////////////////////////////////
+
+static void enter(byte state) {
+    _state = state;
+    _intermediate = 0;
+    if (state == AS_CSI) {
+        _params[0] = 0;
+        // Counts separators until the final byte, then parameters
+        _nparams = 0;
+        _private = 0;
+    }
+}
+
+static void step(uint8_t c) {
+    // These work from any state
+    if (c == CTRL_CAN || c == CTRL_SUB) {
+        _state = AS_GROUND;
+        return;
+    }
+    if (c == TERM_ESCAPE && _state != AS_STRING) {
+        enter(AS_ESC);
+        return;
+    }
+
+    switch (_state) {
+        case AS_GROUND:
+            if (c < 0x20) {
+                execute(c);
+            } else if (c >= 0xC0) {
+                // One substitute per UTF-8 character; continuation bytes vanish
+                write_chars((const uint8_t *) "?", 1);
+            }
+            break;
+
+        case AS_ESC:
+            if (c == '[') {
+                enter(AS_CSI);
+            } else if (c == ']' || c == 'P' || c == '^' || c == '_') {
+                enter(AS_STRING);
+            } else if (c >= 0x20 && c <= 0x2F) {
+                enter(AS_ESC_INTERMEDIATE);
+                _intermediate = c;
+            } else if (c < 0x20) {
+                execute(c);
+            } else {
+                esc_dispatch(c);
+            }
+            break;
+
+        case AS_ESC_INTERMEDIATE:
+            if (c < 0x20) {
+                execute(c);
+            } else if (c > 0x2F) {
+                esc_intermediate_dispatch(c);
+            }
+            break;
+
+        case AS_CSI:
+            if (c < 0x20) {
+                execute(c);
+            } else if (c <= 0x2F) {
+                _intermediate = c;
+            } else if (c <= 0x3F) {
+                csi_param(c);
+            } else if (c < CTRL_DEL) {
+                _nparams++;
+                csi_dispatch(c);
+            }
+            break;
+
+        case AS_STRING:
+            if (c == CTRL_BEL) {
+                _state = AS_GROUND;
+            } else if (c == TERM_ESCAPE) {
+                _state = AS_STRING_ESC;
+            }
+            break;
+
+        case AS_STRING_ESC:
+            // ESC \ ends the string; anything else is part of it
+            _state = c == '\\' ? AS_GROUND : AS_STRING;
+            break;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Translator
+//////////////////////////////////////////////////////////////////////////////
+
+void ansi_init(struct busybox_sink reply) {
+    _reply = reply;
+    _state = AS_GROUND;
+    _g0_graphics = false;
+    _g1_graphics = false;
+    _shifted = false;
+    _saved_row = 0;
+    _saved_col = 0;
+    _wrap_pending = false;
+
+    memset(_csi_handlers, 0, sizeof(_csi_handlers));
+    for (size_t i = 0; i < sizeof(_csi_commands) / sizeof(_csi_commands[0]); i++) {
+        _csi_handlers[_csi_commands[i].final - '@'] = _csi_commands[i].handler;
+    }
+}
+
+// Writes the printable run buf[run..end) and returns where it got to
+static size_t write_run(const uint8_t *buf, size_t run, size_t end) {
+    return end > run ? run + write_chars(buf + run, end - run) : run;
+}
+
+size_t ansi_write(const uint8_t *buf, size_t len) {
+    // Start of the run of printable characters not yet written
+    size_t run = 0;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        uint8_t c = buf[i];
+        if (_state == AS_GROUND && c >= 0x20 && c < CTRL_DEL) {
+            continue;
+        }
+        size_t done = write_run(buf, run, i);
+        if (done < i || term_writable() < ANSI_STEP_ROOM) {
+            i = done;
+            break;
+        }
+        run = i + 1;
+        step(c);
+    }
+    if (i == len) {
+        i = write_run(buf, run, len);
+    }
+    _stats.bytes += i;
+    return i;
+}
+
+bool ansi_idle() {
+    return _state == AS_GROUND;
+}
+
+void ansi_get_stats(struct ansi_stats *stats) {
+    *stats = _stats;
+}
@@ -0,0 +1,34 @@
+// Translates the VT100/ANSI output of remote hosts into TeleVideo Personal
+// Terminal sequences as it streams through.
+
+#ifndef _ANSI_H
+#define _ANSI_H
+
+#include <Arduino.h>
+#include "busybox.h"
+
+// What we tell remote hosts we are while translating
+#define ANSI_TERM "vt100"
+
+struct ansi_stats {
+    // Bytes translated since boot
+    uint32_t bytes;
+    // Escape and control sequences translated, and those we had to drop
+    uint32_t sequences;
+    uint32_t unsupported;
+};
+
+// Starts a new session.  Answers to status requests (cursor position,
+// device attributes) are written to reply, which sends them to the server.
+void ansi_init(struct busybox_sink reply);
+
+// Translates as much of buf as the terminal has room for and returns how
+// many bytes that was; the caller offers the rest again later.
+size_t ansi_write(const uint8_t *buf, size_t len);
+
+// True between sequences, when a printable byte would just be drawn
+bool ansi_idle();
+
+void ansi_get_stats(struct ansi_stats *stats);
+
+#endif
@@ -10,6 +10,15 @@ BUILD_PATH="${BASE}/build"
 
 mkdir -p "${BUILD_PATH}"
 
+# net.cpp counts SPI transfers to the WiFi chip by wrapping the WiFi101 bus
+# driver's nm_bus_ioctl().
+#
+# wifi_shim.cpp and net.cpp use WiFi101's internals and only compile against
+# the version deps.sh installs.  The installed version goes to them as
+# WIFI101_VERSION, major * 10000 + minor * 100 + patch.
+WIFI101_VERSION="$(sed -n 's/^version=//p' "${HOME}/Arduino/libraries/WiFi101/library.properties" | \
+  awk -F. '{ printf "%d", $1 * 10000 + $2 * 100 + $3 }')"
+
 arduino-builder -compile \
   -hardware "${ARDUINO_HOME}/hardware" \
   -hardware "${HOME}/.arduino15/packages" \
@@ -24,6 +33,8 @@ arduino-builder -compile \
   -build-path "${BUILD_PATH}" \
   -warnings=none \
   -prefs=build.warn_data_percentage=75  \
+  -prefs="compiler.c.elf.extra_flags=-Wl,--wrap=nm_bus_ioctl" \
+  -prefs="compiler.cpp.extra_flags=-DWIFI101_VERSION=${WIFI101_VERSION:-0}" \
   -prefs="runtime.tools.openocd.path=${HOME}/.arduino15/packages/arduino/tools/openocd/0.9.0-arduino6-static"  \
   -prefs="runtime.tools.bossac.path=${HOME}/.arduino15/packages/arduino/tools/bossac/1.7.0" \
   -prefs="runtime.tools.CMSIS.path=${HOME}/.arduino15/packages/arduino/tools/CMSIS/4.5.0" \
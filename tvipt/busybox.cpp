@@ -27,6 +27,10 @@
 
 #include "busybox.h"
 #include "term.h"
+#include "ansi.h"
+#include "predict.h"
+#include "line.h"
+#include "screen.h"
 
 /* from /usr/include/arpa/telnet.h */
 #define TELOPT_NEW_ENVIRON 39
@@ -39,7 +43,7 @@
 typedef signed char smallint;
 typedef unsigned char smalluint;
 
-// Fake file descriptors so we can use WiFi101 and Serial 
+// Fake file descriptors for the session's net and term sinks
 enum {
     netfd = 0, termfd = 1
 };
@@ -49,6 +53,9 @@ enum {
 enum {
     DATABUFSIZE = 128,
     IACBUFSIZE = 128,
+    SBBUFSIZE = 128,
+    ABORT_TIMEOUT_MS = 2000, /* stop waiting for the server's DM */
+    BREAK_KEY = 0x00, /* what the PT's BREAK key sends */
 
     CHM_TRY = 0,
     CHM_ON = 1,
@@ -66,9 +73,60 @@ enum {
     TS_CR = 6,
 };
 
+#if ENABLE_FEATURE_TELNET_LINEMODE
+/* from /usr/include/arpa/telnet.h */
+enum {
+    LM_MODE = 1,
+    LM_FORWARDMASK = 2,
+    LM_SLC = 3,
+
+    MODE_EDIT = 0x01,
+    MODE_TRAPSIG = 0x02,
+    MODE_ACK = 0x04,
+    MODE_SOFT_TAB = 0x08,
+    MODE_LIT_ECHO = 0x10,
+    MODE_MASK = 0x1f,
+
+    SLC_SYNCH = 1,
+    SLC_BRK = 2,
+    SLC_IP = 3,
+    SLC_AO = 4,
+    SLC_AYT = 5,
+    SLC_EOR = 6,
+    SLC_ABORT = 7,
+    SLC_EOF = 8,
+    SLC_SUSP = 9,
+    SLC_EC = 10,
+    SLC_EL = 11,
+    SLC_EW = 12,
+    SLC_RP = 13,
+    SLC_LNEXT = 14,
+    SLC_XON = 15,
+    SLC_XOFF = 16,
+    SLC_FORW1 = 17,
+    SLC_FORW2 = 18,
+    NSLC = 18,
+
+    SLC_NOSUPPORT = 0,
+    SLC_CANTCHANGE = 1,
+    SLC_VALUE = 2,
+    SLC_DEFAULT = 3,
+    SLC_LEVELBITS = 0x03,
+    SLC_FLUSHOUT = 0x20,
+    SLC_FLUSHIN = 0x40,
+    SLC_ACK = 0x80,
+};
+#endif
+
 /* from networking/telnet.c */
 
-struct globals {
+/* One per session; G is the one being worked on (see busybox_open) */
+struct busybox {
+    byte open;
+    byte exited; /* the user asked to exit with the console escape */
+    byte escape_menu; /* the console escape menu is up; the next key picks */
+    byte foreground; /* has the terminal, and its predictions */
+    smallint got_signal; /* came from line mode */
     int iaclen; /* could even use byte, but it's a loss on x86 */
     byte telstate; /* telnet negotiation state from network input */
     byte telwish;  /* DO, DONT, WILL, WONT */
@@ -83,16 +141,43 @@ struct globals {
 #endif
 #if ENABLE_FEATURE_AUTOWIDTH
     unsigned win_width, win_height;
+    byte naws; /* server said DO NAWS, so wants to hear of changes */
 #endif
     /* buffer to handle telnet negotiations */
     char iacbuf[IACBUFSIZE];
-    WiFiClient *client;
+    /* subnegotiation being received, after IAC SB */
+    byte sbbuf[SBBUFSIZE];
+    int sblen;
+#if ENABLE_FEATURE_TELNET_LINEMODE
+    byte linemode; /* we said WILL LINEMODE */
+    byte lmode;    /* MODE_* agreed with the server */
+    byte lnext;    /* next key is literal */
+    byte fwd_on;
+    byte fwdmask[32];
+    struct {
+        byte flags;
+        byte value;
+    } slc[NSLC + 1];
+    /* line being edited */
+    int lmlen;
+    byte lmbuf[DATABUFSIZE];
+#endif
+    byte lflow;    /* we said WILL LFLOW */
+    byte discarding; /* output aborted, dropping data until DM */
+    unsigned long abort_at;
+    struct busybox_sink net;
+    struct busybox_sink term;
 };
 
-struct globals G;
+static struct busybox _sessions[BUSYBOX_SESSIONS];
+static struct busybox *_g;
+#define G (*_g)
 
 /* Standard handler which just records signo */
-smallint bb_got_signal;
+#define bb_got_signal G.got_signal
+
+/* Since boot, for all sessions */
+static struct busybox_stats _stats;
 
 /* from libbb/safe_write.c */
 
@@ -101,9 +186,10 @@ ssize_t FAST_FUNC safe_write(int fd, const void *buf, size_t count) {
 
     do {
         if (fd == netfd) {
-            n = G.client->write((const uint8_t *) buf, count);
+            _stats.net_writes++;
+            n = G.net.write(G.net.ctx, (const uint8_t *) buf, count);
         } else {
-            n = term_write((const uint8_t *) buf, count);
+            n = G.term.write(G.term.ctx, (const uint8_t *) buf, count);
         }
     } while (n < 0 && errno == EINTR);
 
@@ -158,10 +244,24 @@ ssize_t FAST_FUNC full_write1_str(const char *str) {
 # define WILL  251  /* I will use option */
 # define SB    250  /* interpret as subnegotiation */
 # define SE    240  /* end sub negotiation */
+# define DM    242  /* data mark, the end of a Synch */
 # define TELOPT_ECHO   1  /* echo */
 # define TELOPT_SGA    3  /* suppress go ahead */
 # define TELOPT_TTYPE 24  /* terminal type */
 # define TELOPT_NAWS  31  /* window size */
+# define TELOPT_LINEMODE 34 /* line mode */
+# define TELOPT_LFLOW 33  /* remote flow control */
+# define LFLOW_OFF     0  /* disable remote flow control */
+# define LFLOW_ON      1  /* enable remote flow control */
+# define LFLOW_RESTART_ANY 2 /* restart output on any char */
+# define LFLOW_RESTART_XON 3 /* restart output only on XON */
+# define xEOF  236  /* end of file */
+# define SUSP  237  /* suspend process */
+# define ABORT 238  /* abort process */
+# define BREAK 243  /* break */
+# define IP    244  /* interrupt process */
+# define AO    245  /* abort output */
+# define AYT   246  /* are you there */
 
 
 void rawmode(void);
@@ -176,18 +276,72 @@ void telopt(byte c);
 
 void subneg(byte c);
 
+void sb_done(void);
+
+void put_iac(int c);
+
+#if ENABLE_FEATURE_TELNET_LINEMODE
+
+void to_linemode(void);
+
+void lm_subneg(byte *p, int n);
+
+void lm_reset(void);
+
+#endif
+
 void iac_flush(void) {
     full_write(netfd, G.iacbuf, G.iaclen);
     G.iaclen = 0;
 }
 
+/* Throws away what's waiting to be shown and asks the server to do the
+ * same: AO, then the Synch's DM, which it answers with a DM of its own
+ * once its output is flushed.  Everything before that DM is stale.
+ * WiFi101 has no urgent data, so the DM just goes in-band. */
+static void abort_output(void) {
+    predict_reset();
+    term_discard_output();
+
+    if (G.iaclen + 4 > IACBUFSIZE)
+        iac_flush();
+    put_iac(IAC);
+    put_iac(AO);
+    put_iac(IAC);
+    put_iac(DM);
+    iac_flush();
+
+    G.discarding = 1;
+    G.abort_at = millis();
+    _stats.aborts++;
+}
+
+/* The break key: interrupt, and don't wait for the output already on
+ * its way */
+static void send_break(void) {
+    if (G.iaclen + 2 > IACBUFSIZE)
+        iac_flush();
+    put_iac(IAC);
+    put_iac(IP);
+    abort_output();
+}
+
+bool busybox_discarding(struct busybox *bb) {
+    _g = bb;
+    return G.discarding;
+}
+
 void doexit(int ev) {
+    (void) ev; /* the session ends however it went */
     cookmode();
-    G.client->stop();
+    G.exited = 1;
 }
 
+/* Shows the menu.  The loop doesn't wait for the answer: the next key
+ * typed goes to con_escape_key() instead of the server. */
 void con_escape(void) {
-    char b;
+    /* The answer has to come as a key, not a block */
+    line_end();
 
     if (bb_got_signal) /* came from line mode... go raw */
         rawmode();
@@ -195,10 +349,15 @@ void con_escape(void) {
     full_write1_str("\r\nConsole escape. Commands are:\r\n"
                             " l go to line mode\r\n"
                             " c go to character mode\r\n"
+#if ENABLE_FEATURE_AUTOWIDTH
+                            " w switch 40/80 columns\r\n"
+#endif
                             " e exit telnet\r\n");
+    G.escape_menu = 1;
+}
 
-    if (term_serial.readBytes(&b, 1) == -1)
-        doexit(EXIT_FAILURE);
+static void con_escape_key(byte b) {
+    G.escape_menu = 0;
 
     switch (b) {
         case 'l':
@@ -213,6 +372,13 @@ void con_escape(void) {
                 goto ret;
             }
             break;
+#if ENABLE_FEATURE_AUTOWIDTH
+        case 'w':
+            /* The screen is cleared; the server redraws at the new size */
+            term_set_columns(term_columns() == SCREEN_COLS ? SCREEN_NARROW_COLS : SCREEN_COLS);
+            busybox_set_window(_g, term_columns(), G.win_height);
+            goto ret;
+#endif
         case 'e':
             doexit(EXIT_SUCCESS);
     }
@@ -225,18 +391,29 @@ void con_escape(void) {
     bb_got_signal = 0;
 }
 
-void busybox_handle_net_output(byte *buf, int len) {
+bool busybox_remote_echo(struct busybox *bb) {
+    _g = bb;
+    return G.charmode == CHM_ON && (G.telflags & UF_ECHO);
+}
+
+bool busybox_local_edit(struct busybox *bb) {
+    _g = bb;
+#if ENABLE_FEATURE_TELNET_LINEMODE
+    if (G.linemode && !(G.lmode & MODE_EDIT))
+        return false;
+#endif
+    return !busybox_remote_echo(bb);
+}
+
+/* Sends typed bytes, no more than DATABUFSIZE */
+static void send_data(const byte *buf, int len) {
     byte outbuf[2 * DATABUFSIZE];
     byte *dst = outbuf;
-    byte *src = buf;
-    byte *end = src + len;
+    const byte *src = buf;
+    const byte *end = src + len;
 
     while (src < end) {
         byte c = *src++;
-        if (c == 0x1d) {
-            con_escape();
-            return;
-        }
         *dst = c;
         if (c == IAC)
             *++dst = c; /* IAC -> IAC IAC */
@@ -256,11 +433,73 @@ void busybox_handle_net_output(byte *buf, int len) {
         full_write(netfd, outbuf, dst - outbuf);
 }
 
+#if ENABLE_FEATURE_TELNET_LINEMODE
+
+void lm_keys(byte *buf, int len);
+
+#endif
+
+void busybox_handle_net_output(struct busybox *bb, byte *buf, int len) {
+    _g = bb;
+    if (G.escape_menu && len > 0) {
+        con_escape_key(*buf++);
+        len--;
+        if (G.exited)
+            return;
+    }
+    if (len <= 0)
+        return;
+#if ENABLE_FEATURE_TELNET_LINEMODE
+    if (G.linemode) {
+        lm_keys(buf, len);
+        return;
+    }
+#endif
+    /* What's typed around the escape still counts */
+    byte *esc = (byte *) memchr(buf, 0x1d, len);
+    if (esc != NULL) {
+        int n = esc - buf;
+        busybox_handle_net_output(bb, buf, n);
+        con_escape();
+        busybox_handle_net_output(bb, esc + 1, len - n - 1);
+        return;
+    }
+    /* ^C is the server's to act on, as data; only the break key aborts */
+    byte *brk = (byte *) memchr(buf, BREAK_KEY, len);
+    if (brk != NULL) {
+        int n = brk - buf;
+        busybox_handle_net_output(bb, buf, n);
+        send_break();
+        busybox_handle_net_output(bb, brk + 1, len - n - 1);
+        return;
+    }
+    /* The server echoes what we type: show it before it does */
+    if (busybox_remote_echo(bb))
+        predict_keys(buf, len);
+    send_data(buf, len);
+}
+
+void busybox_send_line(struct busybox *bb, byte *buf, int len) {
+    _g = bb;
+    _stats.lines++;
+    send_data(buf, len);
+}
 
-void busybox_handle_net_input(byte *buf, int len) {
+void busybox_reply(struct busybox *bb, const uint8_t *buf, size_t len) {
+    _g = bb;
+    send_data(buf, (int) len);
+}
+
+
+void busybox_handle_net_input(struct busybox *bb, byte *buf, int len) {
+    _g = bb;
     int i;
     int cstart = 0;
 
+    /* Servers that ignore the Synch only get so long */
+    if (G.discarding && millis() - G.abort_at > ABORT_TIMEOUT_MS)
+        G.discarding = 0;
+
     for (i = 0; i < len; i++) {
         byte c = buf[i];
 
@@ -285,7 +524,8 @@ void busybox_handle_net_input(byte *buf, int len) {
                 G.telstate = TS_COPY;
                 if (c == '\0')
                     break;
-                /* else: fall through - need to handle CR IAC ... properly */
+                /* else: need to handle CR IAC ... properly */
+                /* fall through */
 
             case TS_COPY: /* Prev char was ordinary */
                 /* Similar to NORMAL, but in TS_COPY we need to copy bytes */
@@ -306,6 +546,7 @@ void busybox_handle_net_input(byte *buf, int len) {
                 /* else */
                 switch (c) {
                     case SB:
+                        G.sblen = 0;
                         G.telstate = TS_SUB1;
                         break;
                     case DO:
@@ -315,7 +556,17 @@ void busybox_handle_net_input(byte *buf, int len) {
                         G.telwish = c;
                         G.telstate = TS_OPT;
                         break;
-                        /* DATA MARK must be added later */
+                    case DM:
+                        /* The server's output is flushed: drop what
+                         * came before and show what follows */
+                        if (G.discarding) {
+                            _stats.abort_dropped += cstart;
+                            _stats.abort_quiet_ms = millis() - G.abort_at;
+                            G.discarding = 0;
+                            cstart = 0;
+                        }
+                        G.telstate = TS_COPY;
+                        break;
                     default:
                         G.telstate = TS_COPY;
                 }
@@ -342,6 +593,14 @@ void busybox_handle_net_input(byte *buf, int len) {
         len = cstart;
     }
 
+    if (G.discarding) {
+        _stats.abort_dropped += len;
+        return;
+    }
+
+    /* Echoes of keys we've shown already */
+    if (G.foreground)
+        len = predict_echo(buf, len);
     if (len)
         full_write(termfd, buf, len);
 }
@@ -432,22 +691,39 @@ void put_iac_naws(byte c, int x, int y) {
     put_iac(SE);
 }
 
+void busybox_set_window(struct busybox *bb, unsigned int win_width, unsigned int win_height) {
+    _g = bb;
+    if (win_width == G.win_width && win_height == G.win_height)
+        return;
+    G.win_width = win_width;
+    G.win_height = win_height;
+    if (G.naws) {
+        put_iac_naws(TELOPT_NAWS, win_width, win_height);
+        iac_flush();
+        _stats.naws++;
+    }
+}
+
 #endif
 
 
 void setConMode(void) {
     if (G.telflags & UF_ECHO) {
         if (G.charmode == CHM_TRY) {
+            if (G.foreground)
+                predict_reset();
             G.charmode = CHM_ON;
-            term_serial.println("telnets: entering character mode");
-            term_serial.println("telnets: escape character is '^]'.");
+            full_write1_str("telnets: entering character mode\r\n");
+            full_write1_str("telnets: escape character is '^]'.\r\n");
             rawmode();
         }
     } else {
         if (G.charmode != CHM_OFF) {
+            if (G.foreground)
+                predict_reset();
             G.charmode = CHM_OFF;
-            term_serial.println("telnets: entering line mode");
-            term_serial.println("telnets: escape character is '^C'.");
+            full_write1_str("telnets: entering line mode\r\n");
+            full_write1_str("telnets: escape character is '^C'.\r\n");
             cookmode();
         }
     }
@@ -556,6 +832,419 @@ void to_naws(void) {
 
 #endif
 
+#if ENABLE_FEATURE_TELNET_LINEMODE
+
+/*
+ * RFC 1184 LINEMODE.  When the server sets MODE EDIT, keys are edited
+ * here (with the SLC characters the server and we agree on) and echoed
+ * locally, and only whole lines go to the server: at Enter, a forwarding
+ * character, or when the buffer fills.  Without EDIT keys go out as they
+ * are typed, which is how the server asks for character mode.  With
+ * TRAPSIG, the interrupt, abort, suspend and similar characters are sent
+ * as the matching telnet commands.
+ */
+
+/* What we start with; the server may change them with SLC */
+static const byte slc_defaults[NSLC + 1][2] = {
+    {SLC_NOSUPPORT, 0},
+    /* SLC_SYNCH */ {SLC_NOSUPPORT, 0},
+    /* SLC_BRK */ {SLC_NOSUPPORT, 0},
+    /* SLC_IP */ {SLC_VALUE | SLC_FLUSHIN | SLC_FLUSHOUT, 0x03},
+    /* SLC_AO */ {SLC_VALUE | SLC_FLUSHOUT, 0x0f},
+    /* SLC_AYT */ {SLC_VALUE, 0x14},
+    /* SLC_EOR */ {SLC_NOSUPPORT, 0},
+    /* SLC_ABORT */ {SLC_VALUE | SLC_FLUSHIN | SLC_FLUSHOUT, 0x1c},
+    /* SLC_EOF */ {SLC_VALUE, 0x04},
+    /* SLC_SUSP */ {SLC_VALUE | SLC_FLUSHIN, 0x1a},
+    /* SLC_EC */ {SLC_VALUE, 0x7f},
+    /* SLC_EL */ {SLC_VALUE, 0x15},
+    /* SLC_EW */ {SLC_VALUE, 0x17},
+    /* SLC_RP */ {SLC_VALUE, 0x12},
+    /* SLC_LNEXT */ {SLC_VALUE, 0x16},
+    /* SLC_XON and SLC_XOFF belong to the terminal link */ {SLC_NOSUPPORT, 0},
+    {SLC_NOSUPPORT, 0},
+    /* SLC_FORW1 */ {SLC_NOSUPPORT, 0},
+    /* SLC_FORW2 */ {SLC_NOSUPPORT, 0},
+};
+
+/* SLC functions sent as telnet commands with TRAPSIG */
+static const byte slc_traps[][2] = {
+    {SLC_IP, IP},
+    {SLC_AO, AO},
+    {SLC_AYT, AYT},
+    {SLC_BRK, BREAK},
+    {SLC_ABORT, ABORT},
+    {SLC_EOF, xEOF},
+    {SLC_SUSP, SUSP},
+};
+
+static void lm_reset_slc(void) {
+    int i;
+
+    for (i = 0; i <= NSLC; i++) {
+        G.slc[i].flags = slc_defaults[i][0];
+        G.slc[i].value = slc_defaults[i][1];
+    }
+}
+
+void lm_reset(void) {
+    G.linemode = 0;
+    G.lmode = 0;
+    G.lnext = 0;
+    G.fwd_on = 0;
+    G.lmlen = 0;
+    lm_reset_slc();
+}
+
+static int slc_is(int func, byte c) {
+    return (G.slc[func].flags & SLC_LEVELBITS) != SLC_NOSUPPORT && G.slc[func].value == c;
+}
+
+/* IAC SB LINEMODE <data> IAC SE, with IACs in data doubled */
+static void put_iac_lm(const byte *data, int len) {
+    int i;
+
+    if (G.iaclen + 2 * len + 5 > IACBUFSIZE)
+        iac_flush();
+
+    put_iac(IAC);
+    put_iac(SB);
+    put_iac(TELOPT_LINEMODE);
+    for (i = 0; i < len; i++) {
+        put_iac(data[i]);
+        if (data[i] == IAC)
+            put_iac(IAC);
+    }
+    put_iac(IAC);
+    put_iac(SE);
+}
+
+void to_linemode(void) {
+    if (G.telwish == DO) {
+        if (!G.linemode) {
+            G.linemode = 1;
+            put_iac2(WILL, TELOPT_LINEMODE);
+        }
+    } else if (G.telwish == DONT) {
+        if (G.linemode) {
+            lm_reset();
+            put_iac2(WONT, TELOPT_LINEMODE);
+        }
+    } else {
+        to_notsup(TELOPT_LINEMODE);
+    }
+}
+
+static void lm_flush(void) {
+    if (G.lmlen) {
+        if (G.lmode & MODE_EDIT)
+            _stats.lines++;
+        send_data(G.lmbuf, G.lmlen);
+        G.lmlen = 0;
+    }
+}
+
+static void lm_mode(byte mask) {
+    byte reply[2];
+
+    /* An ack of what we said, or a mode we can do anyway */
+    mask &= MODE_MASK;
+    if (mask & MODE_ACK) {
+        G.lmode = mask & ~MODE_ACK;
+        return;
+    }
+    if (!(mask & MODE_EDIT))
+        lm_flush();
+    G.lmode = mask;
+
+    reply[0] = LM_MODE;
+    reply[1] = mask | MODE_ACK;
+    put_iac_lm(reply, sizeof(reply));
+}
+
+static void lm_slc(const byte *p, int n) {
+    /* 20 triplets fit the IAC buffer even with every byte doubled */
+    byte reply[1 + 3 * 20];
+    int len = 1;
+    int i, f;
+
+    reply[0] = LM_SLC;
+    for (i = 0; i + 3 <= n; i += 3) {
+        byte func = p[i];
+        byte flags = p[i + 1];
+        byte value = p[i + 2];
+
+        if (len + 3 > (int) sizeof(reply))
+            break;
+        if (func == 0) {
+            /* 0 SLC_DEFAULT 0 asks us to start over; send our table */
+            if ((flags & SLC_LEVELBITS) == SLC_DEFAULT)
+                lm_reset_slc();
+            for (f = 1; f <= NSLC && len + 3 <= (int) sizeof(reply); f++) {
+                reply[len++] = f;
+                reply[len++] = G.slc[f].flags;
+                reply[len++] = G.slc[f].value;
+            }
+            continue;
+        }
+        if (func > NSLC) {
+            if (!(flags & SLC_ACK)) {
+                reply[len++] = func;
+                reply[len++] = SLC_NOSUPPORT;
+                reply[len++] = 0;
+            }
+            continue;
+        }
+        if (flags & SLC_ACK) {
+            /* The server agrees with us */
+            G.slc[func].flags = flags & ~SLC_ACK;
+            G.slc[func].value = value;
+            continue;
+        }
+        if (G.slc[func].flags == flags && G.slc[func].value == value)
+            continue;
+        if ((flags & SLC_LEVELBITS) == SLC_DEFAULT) {
+            /* Use ours */
+            reply[len++] = func;
+            reply[len++] = G.slc[func].flags;
+            reply[len++] = G.slc[func].value;
+            continue;
+        }
+        /* Take the server's */
+        G.slc[func].flags = flags;
+        G.slc[func].value = value;
+        reply[len++] = func;
+        reply[len++] = flags | SLC_ACK;
+        reply[len++] = value;
+    }
+
+    if (len > 1)
+        put_iac_lm(reply, len);
+}
+
+void lm_subneg(byte *p, int n) {
+    byte reply[2];
+
+    if (n < 1)
+        return;
+
+    switch (p[0]) {
+        case LM_MODE:
+            if (n >= 2)
+                lm_mode(p[1]);
+            break;
+        case LM_SLC:
+            lm_slc(p + 1, n - 1);
+            break;
+        case DO:
+        case DONT:
+            /* DO FORWARDMASK mask0 ... mask31 */
+            if (n < 2 || p[1] != LM_FORWARDMASK)
+                break;
+            G.fwd_on = p[0] == DO;
+            memset(G.fwdmask, 0, sizeof(G.fwdmask));
+            if (G.fwd_on)
+                memcpy(G.fwdmask, p + 2, min(n - 2, (int) sizeof(G.fwdmask)));
+            reply[0] = G.fwd_on ? WILL : WONT;
+            reply[1] = LM_FORWARDMASK;
+            put_iac_lm(reply, sizeof(reply));
+            break;
+    }
+}
+
+static int lm_forwards(byte c) {
+    if (slc_is(SLC_FORW1, c) || slc_is(SLC_FORW2, c))
+        return 1;
+    return G.fwd_on && (G.fwdmask[c >> 3] & (0x80 >> (c & 7)));
+}
+
+/* Sends a trapped signal character as its telnet command */
+static int lm_trap(byte c) {
+    unsigned i;
+
+    for (i = 0; i < sizeof(slc_traps) / sizeof(slc_traps[0]); i++) {
+        int func = slc_traps[i][0];
+        if (!slc_is(func, c))
+            continue;
+        if (G.slc[func].flags & SLC_FLUSHIN)
+            G.lmlen = 0;
+        else
+            lm_flush();
+        /* abort_output() sends the AO itself */
+        if (func != SLC_AO) {
+            put_iac(IAC);
+            put_iac(slc_traps[i][1]);
+        }
+        if (func == SLC_IP || func == SLC_AO || (G.slc[func].flags & SLC_FLUSHOUT))
+            abort_output();
+        else
+            iac_flush();
+        return 1;
+    }
+    return 0;
+}
+
+static void lm_add(byte c) {
+    if (G.lmlen == DATABUFSIZE)
+        lm_flush();
+    G.lmbuf[G.lmlen++] = c;
+}
+
+static void lm_echo(byte c) {
+    char caret[2];
+
+    if ((c >= 0x20 && c < 0x7f) || (G.lmode & MODE_LIT_ECHO) || c == '\t') {
+        full_write(termfd, &c, 1);
+        return;
+    }
+    caret[0] = '^';
+    caret[1] = c == 0x7f ? '?' : c + '@';
+    full_write(termfd, caret, 2);
+}
+
+static void lm_rubout(void) {
+    byte c = G.lmbuf[--G.lmlen];
+    int n = (c >= 0x20 && c < 0x7f) || (G.lmode & MODE_LIT_ECHO) ? 1 : 2;
+
+    while (n--)
+        full_write1_str("\b \b");
+}
+
+/* Keys typed in LINEMODE */
+void lm_keys(byte *buf, int len) {
+    int i;
+
+    for (i = 0; i < len; i++) {
+        byte c = buf[i];
+
+        if (G.lnext) {
+            G.lnext = 0;
+            lm_echo(c);
+            lm_add(c);
+            continue;
+        }
+        if (c == 0x1d) {
+            lm_flush();
+            con_escape();
+            /* The rest starts with the answer */
+            busybox_handle_net_output(_g, buf + i + 1, len - i - 1);
+            return;
+        }
+        if ((G.lmode & MODE_TRAPSIG) && lm_trap(c))
+            continue;
+        if (c == BREAK_KEY) {
+            lm_flush();
+            send_break();
+            continue;
+        }
+        if (!(G.lmode & MODE_EDIT)) {
+            lm_add(c);
+            continue;
+        }
+
+        if (slc_is(SLC_EC, c) || c == '\b') {
+            if (G.lmlen)
+                lm_rubout();
+        } else if (slc_is(SLC_EL, c)) {
+            while (G.lmlen)
+                lm_rubout();
+        } else if (slc_is(SLC_EW, c)) {
+            while (G.lmlen && G.lmbuf[G.lmlen - 1] == ' ')
+                lm_rubout();
+            while (G.lmlen && G.lmbuf[G.lmlen - 1] != ' ')
+                lm_rubout();
+        } else if (slc_is(SLC_RP, c)) {
+            int j;
+            full_write1_str("\r\n");
+            for (j = 0; j < G.lmlen; j++)
+                lm_echo(G.lmbuf[j]);
+        } else if (slc_is(SLC_LNEXT, c)) {
+            G.lnext = 1;
+        } else if (c == '\r' || c == '\n') {
+            full_write1_str("\r\n");
+            lm_add('\r');
+            lm_flush();
+        } else if (c == '\t' && (G.lmode & MODE_SOFT_TAB)) {
+            do {
+                lm_echo(' ');
+                lm_add(' ');
+            } while (screen_shown.col % 8 != 0);
+        } else {
+            lm_echo(c);
+            lm_add(c);
+            /* EOF without TRAPSIG goes with the line, like a forwarding char */
+            if (lm_forwards(c) || slc_is(SLC_EOF, c))
+                lm_flush();
+        }
+    }
+
+    /* Character mode: everything goes now */
+    if (!(G.lmode & MODE_EDIT))
+        lm_flush();
+}
+
+#endif
+
+void sb_done(void) {
+    if (G.sblen == 0)
+        return;
+
+    switch (G.sbbuf[0]) {
+#if ENABLE_FEATURE_TELNET_TTYPE
+        case TELOPT_TTYPE:
+            if (G.ttype)
+                put_iac_subopt(TELOPT_TTYPE, G.ttype);
+            break;
+#endif
+#if ENABLE_FEATURE_TELNET_AUTOLOGIN
+        case TELOPT_NEW_ENVIRON:
+            if (G.autologin)
+                put_iac_subopt_autologin();
+            break;
+#endif
+        case TELOPT_LFLOW:
+            if (G.lflow && G.sblen >= 2 && G.sbbuf[1] <= LFLOW_RESTART_XON) {
+                _stats.flow_mode = G.sbbuf[1];
+                _stats.flow_requests++;
+            }
+            break;
+#if ENABLE_FEATURE_TELNET_LINEMODE
+        case TELOPT_LINEMODE:
+            if (G.linemode)
+                lm_subneg(G.sbbuf + 1, G.sblen - 1);
+            break;
+#endif
+    }
+}
+
+/*
+ * RFC 1372.  XON and XOFF from the PT pace the serial link: term.cpp acts
+ * on them and takes them out of the input, so they never reach the server
+ * as data, and while output is paused sessions stop reading the socket.
+ * We agree to do flow control so the server knows that and leaves it to
+ * us.  The server may ask for it to be off, or to restart on any key, but
+ * a link XOFF from a full PT looks just like one typed, so the link keeps
+ * its XON/XOFF pacing; we only record what was asked.
+ */
+void to_lflow(void) {
+    if (G.telwish == DO) {
+        if (!G.lflow) {
+            G.lflow = 1;
+            _stats.flow_agreed = true;
+            _stats.flow_mode = LFLOW_ON;
+            put_iac2(WILL, TELOPT_LFLOW);
+        }
+    } else if (G.telwish == DONT) {
+        if (G.lflow) {
+            G.lflow = 0;
+            _stats.flow_agreed = false;
+            put_iac2(WONT, TELOPT_LFLOW);
+        }
+    } else {
+        to_notsup(TELOPT_LFLOW);
+    }
+}
+
 void telopt(byte c) {
     switch (c) {
         case TELOPT_ECHO:
@@ -577,35 +1266,42 @@ void telopt(byte c) {
 #if ENABLE_FEATURE_AUTOWIDTH
         case TELOPT_NAWS:
             to_naws();
+            G.naws = (G.telwish == DO);
             put_iac_naws(c, G.win_width, G.win_height);
             break;
 #endif
+#if ENABLE_FEATURE_TELNET_LINEMODE
+        case TELOPT_LINEMODE:
+            to_linemode();
+            break;
+#endif
+        case TELOPT_LFLOW:
+            to_lflow();
+            break;
         default:
             to_notsup(c);
             break;
     }
 }
 
-/* subnegotiation -- ignore all (except TTYPE,NAWS) */
+/* subnegotiation -- collected up to IAC SE, then handled by sb_done() */
 void subneg(byte c) {
     switch (G.telstate) {
         case TS_SUB1:
             if (c == IAC)
                 G.telstate = TS_SUB2;
-#if ENABLE_FEATURE_TELNET_TTYPE
-            else if (c == TELOPT_TTYPE && G.ttype)
-                put_iac_subopt(TELOPT_TTYPE, G.ttype);
-#endif
-#if ENABLE_FEATURE_TELNET_AUTOLOGIN
-            else if (c == TELOPT_NEW_ENVIRON && G.autologin)
-                put_iac_subopt_autologin();
-#endif
+            else if (G.sblen < SBBUFSIZE)
+                G.sbbuf[G.sblen++] = c;
             break;
         case TS_SUB2:
             if (c == SE) {
                 G.telstate = TS_COPY;
+                sb_done();
                 return;
             }
+            /* IAC IAC is a 255 in the data */
+            if (c == IAC && G.sblen < SBBUFSIZE)
+                G.sbbuf[G.sblen++] = c;
             G.telstate = TS_SUB1;
             break;
     }
@@ -625,13 +1321,48 @@ void cookmode(void) {
       */
 }
 
-void busybox_init(unsigned int win_width, unsigned int win_height, char *ttype, WiFiClient *client,
-                  const char *autologin) {
+struct busybox *busybox_open(unsigned int win_width, unsigned int win_height, char *ttype,
+                             struct busybox_sink net, struct busybox_sink term, const char *autologin) {
+    int i;
+
+    for (i = 0; i < BUSYBOX_SESSIONS && _sessions[i].open; i++)
+        continue;
+    if (i == BUSYBOX_SESSIONS)
+        return NULL;
+
+    _g = &_sessions[i];
     memset(&G, 0, sizeof(G));
+    G.open = 1;
+    G.foreground = 1;
     G.win_width = win_width;
     G.win_height = win_height;
     G.ttype = ttype;
-    G.client = client;
     G.autologin = autologin;
+    G.net = net;
+    G.term = term;
+#if ENABLE_FEATURE_TELNET_LINEMODE
+    lm_reset();
+#endif
+    predict_reset();
+    return _g;
+}
+
+void busybox_close(struct busybox *bb) {
+    bb->open = 0;
+}
+
+bool busybox_exited(struct busybox *bb) {
+    return bb->exited;
+}
+
+void busybox_set_foreground(struct busybox *bb, bool foreground) {
+    bb->foreground = foreground;
+    /* Keys typed elsewhere don't answer the menu */
+    if (!foreground)
+        bb->escape_menu = 0;
+}
+
+void busybox_get_stats(struct busybox_stats *stats) {
+    *stats = _stats;
 }
 
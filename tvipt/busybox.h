@@ -1,20 +1,108 @@
-// Busybox's telnet client hacked up for WiFi101.
+// Busybox's telnet client hacked up for WiFi101.  Each connection is its
+// own session, writing to the sinks it was opened with, so several can be
+// negotiated at once and none of it needs a real network or terminal.
 
 #ifndef _BUSYBOX_H
 #define _BUSYBOX_H
 
 #include <Arduino.h>
-#include <WiFi101.h>
 
 #define ENABLE_FEATURE_TELNET_TTYPE 1
 #define ENABLE_FEATURE_TELNET_AUTOLOGIN 1
 #define ENABLE_FEATURE_AUTOWIDTH 1
+#define ENABLE_FEATURE_TELNET_LINEMODE 1
 
-void busybox_init(unsigned int win_width, unsigned int win_height, char *ttype, WiFiClient *client,
-                  const char *autologin);
+// Sessions that can be open at once
+#define BUSYBOX_SESSIONS 2
 
-void busybox_handle_net_output(byte *buf, int len);
+struct busybox_stats {
+    // Since boot, for all sessions.  Writes to the server, and lines sent
+    // whole by LINEMODE editing
+    uint32_t net_writes;
+    uint32_t lines;
+    // Whether we agreed to do RFC 1372 flow control, the server's requests
+    // since, and the last one: 0 off, 1 on, 2 restart on any key, 3 restart
+    // on XON.  XON/XOFF stay with the terminal link whatever it asks.
+    bool flow_agreed;
+    uint32_t flow_requests;
+    uint8_t flow_mode;
+    // Output aborts (the break key, or a signal key under LINEMODE with
+    // TRAPSIG agreed), data dropped until the server's DM, and how long the
+    // last one took to come
+    uint32_t aborts;
+    uint32_t abort_dropped;
+    uint32_t abort_quiet_ms;
+    // Window size changes sent to the server after the first
+    uint32_t naws;
+};
 
-void busybox_handle_net_input(byte *buf, int len);
+// Where a session's bytes go: write() returns how many it took, or -1.
+struct busybox_sink {
+    void *ctx;
+
+    int (*write)(void *ctx, const uint8_t *buf, size_t len);
+};
+
+// A sink for anything with write(buf, len), like a Client or a Print.  Each
+// write is a call through the sink's pointer and then out's own write,
+// virtual for those two.
+template<class T>
+int busybox_sink_write(void *ctx, const uint8_t *buf, size_t len) {
+    return (int) static_cast<T *>(ctx)->write(buf, len);
+}
+
+template<class T>
+struct busybox_sink busybox_sink_to(T &out) {
+    struct busybox_sink sink = {&out, busybox_sink_write<T>};
+    return sink;
+}
+
+struct busybox;
+
+// Starts a session with data for the server going to net and data for the
+// terminal (commands taken out) to term.  NULL if BUSYBOX_SESSIONS are open.
+struct busybox *busybox_open(unsigned int win_width, unsigned int win_height, char *ttype,
+                             struct busybox_sink net, struct busybox_sink term, const char *autologin);
+
+void busybox_close(struct busybox *bb);
+
+// True once the user has exited with the console escape; the connection is
+// the caller's to close
+bool busybox_exited(struct busybox *bb);
+
+// Whether the session has the terminal.  One that doesn't leaves typed
+// keys' predictions alone, since they're another session's.  Sessions
+// start with it.
+void busybox_set_foreground(struct busybox *bb, bool foreground);
+
+// Keys typed at the terminal
+void busybox_handle_net_output(struct busybox *bb, byte *buf, int len);
+
+// A line edited by the terminal itself, sent as it is
+void busybox_send_line(struct busybox *bb, byte *buf, int len);
+
+// Answers from the terminal emulation to the server's status requests,
+// sent as data through the net sink, past line editing and predictions
+void busybox_reply(struct busybox *bb, const uint8_t *buf, size_t len);
+
+void busybox_handle_net_input(struct busybox *bb, byte *buf, int len);
+
+#if ENABLE_FEATURE_AUTOWIDTH
+// The terminal changed size; tells the server if it asked for NAWS
+void busybox_set_window(struct busybox *bb, unsigned int win_width, unsigned int win_height);
+#endif
+
+// True in character mode with the server echoing what we type
+bool busybox_remote_echo(struct busybox *bb);
+
+// True when lines may be edited locally: the server isn't echoing and,
+// with LINEMODE, has asked for EDIT
+bool busybox_local_edit(struct busybox *bb);
+
+// True after an abort until the server's DM (or a timeout): the session
+// should keep reading, whatever the terminal can take, to get to it
+bool busybox_discarding(struct busybox *bb);
+
+void busybox_get_stats(struct busybox_stats *stats);
 
 #endif
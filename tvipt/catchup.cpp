@@ -0,0 +1,118 @@
+#include "catchup.h"
+#include "screen.h"
+
+/*
+ * When a remote program redraws faster than the UART can carry it, every
+ * intermediate frame still goes out, and the terminal ends up seconds
+ * behind the host.  In catch-up mode, once more than TERM_CATCHUP_HIGH
+ * bytes are queued, output stops going to the ring and is only applied to
+ * screen_shown, which then describes what the terminal *should* show.  When
+ * the ring has drained below TERM_CATCHUP_LOW, screen_release() sends the
+ * rows that differ between that and what the terminal has, the cursor's
+ * row first, as many as fit under the high mark.  Output keeps being held
+ * until a pass finds nothing left to send, so the terminal skips straight
+ * to the latest screen and the ring (and so the delay before a
+ * keystroke's echo appears) stays under the high mark, plus a row at most.
+ *
+ * A short burst is cheaper to send as it is than as a difference (which
+ * may redraw the whole screen after a scroll), so the first
+ * TERM_CATCHUP_REPLAY bytes held are kept, and replayed if that's all.
+ *
+ * Holding only starts and ends between sequences.  Output with no effect
+ * on the screen model, like a bell, is lost once a burst is collapsed.
+ */
+
+static bool _enabled = false;
+static bool _holding = false;
+// While screen_release() is sending, so its output isn't held
+static bool _releasing = false;
+static uint8_t _held_buf[TERM_CATCHUP_REPLAY];
+// More than TERM_CATCHUP_REPLAY once the burst is too long to replay
+static size_t _held_len = 0;
+static uint32_t _held_total = 0;
+// What screen_release() has sent for this burst so far
+static uint32_t _held_sent = 0;
+
+static uint32_t _catchups = 0;
+static uint32_t _catchup_held_bytes = 0;
+static uint32_t _catchup_sent_bytes = 0;
+
+static uint32_t bytes_sent() {
+    struct term_stats stats;
+    term_get_stats(&stats);
+    return stats.tx_bytes;
+}
+
+void catchup_enable(bool enable) {
+    _enabled = enable;
+}
+
+bool catchup_enabled() {
+    return _enabled;
+}
+
+bool catchup_hold(size_t queued) {
+    if (!_holding && !_releasing && _enabled && queued > TERM_CATCHUP_HIGH &&
+        !screen_in_sequence(&screen_shown)) {
+        screen_hold();
+        _holding = true;
+        _held_len = 0;
+        _held_total = 0;
+        _held_sent = 0;
+    }
+    return _holding && !_releasing;
+}
+
+void catchup_keep(const uint8_t *buf, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        screen_apply(&screen_shown, buf[i]);
+    }
+    _held_total += size;
+    if (_held_len + size <= TERM_CATCHUP_REPLAY) {
+        memcpy(_held_buf + _held_len, buf, size);
+        _held_len += size;
+    } else {
+        _held_len = TERM_CATCHUP_REPLAY + 1;
+    }
+}
+
+bool catchup_holding() {
+    return _holding;
+}
+
+void catchup_release(size_t queued) {
+    if (!_holding || screen_in_sequence(&screen_shown)) {
+        return;
+    }
+
+    _releasing = true;
+    if (_held_len <= TERM_CATCHUP_REPLAY) {
+        screen_rewind();
+        term_write(_held_buf, _held_len);
+        _releasing = false;
+        _holding = false;
+        return;
+    }
+
+    uint32_t before = bytes_sent();
+    bool done = screen_release(queued < TERM_CATCHUP_HIGH ? TERM_CATCHUP_HIGH - queued : 0);
+    _held_sent += bytes_sent() - before;
+    _releasing = false;
+    if (!done) {
+        return;
+    }
+    _holding = false;
+    _catchups++;
+    _catchup_held_bytes += _held_total;
+    _catchup_sent_bytes += _held_sent;
+}
+
+void catchup_discard() {
+    _holding = false;
+}
+
+void catchup_get_stats(struct term_stats *stats) {
+    stats->catchups = _catchups;
+    stats->catchup_held_bytes = _catchup_held_bytes;
+    stats->catchup_sent_bytes = _catchup_sent_bytes;
+}
@@ -0,0 +1,35 @@
+// Catch-up mode's policy (see catchup.cpp): when output is held back, and
+// how the terminal is brought up to date.  term.cpp calls it with how full
+// its transmit ring is; the host bench calls it with a simulated one.
+
+#ifndef _CATCHUP_H
+#define _CATCHUP_H
+
+#include <Arduino.h>
+#include "term.h"
+
+void catchup_enable(bool enable);
+
+bool catchup_enabled();
+
+// Whether output should be held rather than queued, with queued bytes
+// waiting for the terminal; starts holding past TERM_CATCHUP_HIGH.
+bool catchup_hold(size_t queued);
+
+// Applies held output to screen_shown, and keeps it for a replay
+void catchup_keep(const uint8_t *buf, size_t size);
+
+bool catchup_holding();
+
+// Sends the next piece of what the terminal is behind by with term_write(),
+// no more than keeps the ring under TERM_CATCHUP_HIGH; call it when fewer
+// than TERM_CATCHUP_LOW bytes are queued, until catchup_holding() is false.
+void catchup_release(size_t queued);
+
+// Forgets held output, for when the terminal is about to be redrawn
+void catchup_discard();
+
+// Fills in the catchup_* counts of stats
+void catchup_get_stats(struct term_stats *stats);
+
+#endif
@@ -2,10 +2,20 @@
 #include "cli.h"
 #include "wifi.h"
 #include "term.h"
+#include "screen.h"
+#include "ansi.h"
+#include "relay.h"
+#include "net.h"
+#include "predict.h"
+#include "sched.h"
+#include "line.h"
+#include "fmt.h"
 #include "tcp.h"
 #include "telnets.h"
+#include "busybox.h"
 #include "keyboard_test.h"
 #include "weather.h"
+#include "session.h"
 
 //////////////////////////////////////////////////////////////////////////////
 // Internal Data
@@ -15,6 +25,14 @@ static uint64_t _uptime;
 static unsigned long _last_millis = 0;
 static bool _handling_io = false;
 
+// How long after boot the prompt first showed, WiFi joined and the
+// automatic session opened, in ms; 0 until they do
+static struct {
+    unsigned long prompt_ms;
+    unsigned long wifi_ms;
+    unsigned long session_ms;
+} _boot_times;
+
 //////////////////////////////////////////////////////////////////////////////
 // Command Executor Return Values
 //////////////////////////////////////////////////////////////////////////////
@@ -33,12 +51,45 @@ enum command_status {
             CMD_IO
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// Running Commands
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * A command that has to wait (for keys, the network or time) starts a
+ * protothread with cli_run() and returns CMD_IO.  cli_loop() then runs it
+ * each pass instead of reading commands, and when it ends reports
+ * _run_status, which the protothread sets if it isn't CMD_OK.
+ *
+ * Two still hold the loop until they're done: pad cal, whose trials each
+ * fill the screen and wait for the terminal's answer (seconds per
+ * operation), and the search for the terminal's rate in term_init(),
+ * which runs before anything else does.
+ */
+
+static char (*_run)(struct pt *pt) = NULL;
+static struct pt _run_pt;
+static command_status _run_status;
+
+static command_status cli_run(char (*thread)(struct pt *pt)) {
+    _run = thread;
+    PT_INIT(&_run_pt);
+    _run_status = CMD_OK;
+    return CMD_IO;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Commands
 //////////////////////////////////////////////////////////////////////////////
 
+command_status cmd_baud(char *tok);
+
+command_status cmd_catchup(char *tok);
+
 command_status cmd_chars(char *tok);
 
+command_status cmd_cols(char *tok);
+
 command_status cmd_echo(char *tok);
 
 command_status cmd_help(char *tok);
@@ -49,10 +100,20 @@ command_status cmd_wifi_join(char *tok);
 
 command_status cmd_keyboard_test(char *tok);
 
+command_status cmd_line(char *tok);
+
+command_status cmd_padding(char *tok);
+
+command_status cmd_predict(char *tok);
+
 command_status cmd_reset(char *tok);
 
+command_status cmd_sessions(char *tok);
+
 command_status cmd_wifi_scan(char *tok);
 
+command_status cmd_speed(char *tok);
+
 command_status cmd_tcp_connect(char *tok);
 
 command_status cmd_telnets_connect(char *tok);
@@ -69,17 +130,25 @@ struct command {
 
 // Help is printed in this order
 struct command _commands[] = {
-        {"chars", "chars [alt]",   "print the (alternate) printable characters", cmd_chars},
-        {"echo",  "echo [dbg]",    "echo chars typed to terminal (or debugger)", cmd_echo},
-        {"h",     "h",             "print this help",                            cmd_help},
-        {"i",     "i",             "print system info",                          cmd_info},
-        {"j",     "j",             "join a WPA wireless network",                cmd_wifi_join},
-        {"keys",  "keys",          "keyboard input test",                        cmd_keyboard_test},
-        {"reset", "reset",         "uptime goes to 0",                           cmd_reset},
-        {"scan",  "scan",          "scan for wireless networks",                 cmd_wifi_scan},
-        {"tcp",   "tcp host port", "open TCP connection",                        cmd_tcp_connect},
-        {"tel",   "tel host port", "open Telnet/SSL connection",                 cmd_telnets_connect},
-        {"w",     "w",             "show the weather",                           cmd_weather},
+        {"baud",    "baud [n|auto]",            "show or change the terminal baud rate",      cmd_baud},
+        {"catch",   "catch [on|off]",           "skip ahead when output falls behind",        cmd_catchup},
+        {"chars",   "chars [alt]",              "print the (alternate) printable characters", cmd_chars},
+        {"cols",    "cols [40|80]",             "show or change the terminal width",          cmd_cols},
+        {"echo",    "echo [dbg]",               "echo chars typed to terminal (or debugger)", cmd_echo},
+        {"h",       "h",                        "print this help",                            cmd_help},
+        {"i",       "i",                        "print system info",                          cmd_info},
+        {"j",       "j",                        "join a WPA wireless network",                cmd_wifi_join},
+        {"keys",    "keys",                     "keyboard input test",                        cmd_keyboard_test},
+        {"line",    "line [on|off]",            "edit lines on the terminal, sent with SEND", cmd_line},
+        {"pad",     "pad [cal]",                "show (or measure) padding after slow ops",   cmd_padding},
+        {"predict", "predict [on|off|auto]",    "draw typed keys before the server echoes",   cmd_predict},
+        {"reset",   "reset",                    "uptime goes to 0",                           cmd_reset},
+        {"s",       "s [n]",                    "list sessions, or go back to session n",     cmd_sessions},
+        {"scan",    "scan",                     "scan for wireless networks",                 cmd_wifi_scan},
+        {"speed",   "speed [n|fmt]",            "measure output (or formatting) speed",       cmd_speed},
+        {"tcp",     "tcp host port",            "open TCP connection",                        cmd_tcp_connect},
+        {"tel",     "tel host port [ms [max]]", "open Telnet/SSL connection, batching keys",  cmd_telnets_connect},
+        {"w",       "w",                        "show the weather",                           cmd_weather},
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -89,6 +158,8 @@ struct command _commands[] = {
 // Buffers a command until we parse and run it
 static char _command[60];
 static byte _command_index = 0;
+// A command has been entered since boot, so the boot auto-connect is off
+static bool _commanded = false;
 
 void clear_command() {
     memset(&_command, 0, sizeof(_command));
@@ -99,6 +170,41 @@ void print_prompt() {
     term_write("> ");
 }
 
+/*
+ * Background news (like WiFi joining) goes on lines of its own between
+ * notice_begin() and notice_end(), which draw the prompt again with what
+ * was being typed.  Nothing is printed while a session has the terminal.
+ */
+
+bool notice_begin() {
+    if (sched_terminal_taken()) {
+        return false;
+    }
+    term_writeln();
+    return true;
+}
+
+void notice_end() {
+    if (_run == NULL && !_handling_io) {
+        print_prompt();
+        term_write(_command, _command_index);
+    }
+}
+
+static const char *_join_states[] = {"idle", "joining", "joined", "failed", "timed out", "lost, rejoining"};
+
+// Says how the last join went; true if it joined
+bool print_join_result() {
+    if (wifi_get_join_state() != WIFI_JOIN_JOINED) {
+        term_printf("wifi: join %s\r\n", _join_states[wifi_get_join_state()]);
+        return false;
+    }
+    struct wifi_info w_info;
+    wifi_get_info(&w_info);
+    term_printf("wifi: joined %s, address %I\r\n", w_info.ssid, &w_info.address);
+    return true;
+}
+
 uint8_t parse_uint8(char *str, uint8_t *dest) {
     char *endptr = 0;
     uint8_t value = (uint8_t) strtol(str, &endptr, 10);
@@ -121,6 +227,18 @@ uint16_t parse_uint16(char *str, uint16_t *dest) {
     return 0;
 }
 
+// A line for a command to read with term_readln(), leaving room in buf
+// for the terminator
+static struct pt _readln_pt;
+static struct term_line _line;
+
+void prompt_line(const char *prompt, char *buf, size_t size, readln_echo echo) {
+    term_write(prompt);
+    _line.buf = buf;
+    _line.max = (int) size - 1;
+    _line.echo = echo;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Error Strings
 //////////////////////////////////////////////////////////////////////////////
@@ -133,6 +251,97 @@ static const char *_e_missing_port = "missing port";
 static const char *_e_invalid_target = "invalid target";
 static const char *_e_invalid_charset = "invalid charset: ";
 static const char *_e_missing_zip = "missing zip";
+static const char *_e_invalid_baud = "invalid baud: ";
+static const char *_e_invalid_count = "invalid count: ";
+static const char *_e_invalid_option = "invalid option: ";
+
+//////////////////////////////////////////////////////////////////////////////
+// Baud
+//////////////////////////////////////////////////////////////////////////////
+
+// How long the user has to change the terminal's SETUP to the new rate
+#define BAUD_CONFIRM_TIMEOUT    30000
+
+// Waits for the search cmd_baud() started
+static PT_THREAD(baud_thread(struct pt *pt)) {
+    PT_BEGIN(pt);
+    PT_WAIT_WHILE(pt, term_baud_searching());
+    if (!term_baud_found()) {
+        // Probably nobody reads this after autobaud
+        term_write("no answer; staying at ");
+        _run_status = CMD_ERR;
+    } else {
+        term_write("terminal at ");
+    }
+    term_print(term_baud(), DEC);
+    term_writeln(" baud");
+    PT_END(pt);
+}
+
+command_status cmd_baud(char *tok) {
+    char *arg = strtok_r(NULL, " ", &tok);
+
+    if (arg == NULL) {
+        term_write("terminal at ");
+        term_print(term_baud(), DEC);
+        term_write(" baud; supported:");
+        for (const unsigned long *baud = term_bauds; *baud != 0; baud++) {
+            term_write(' ');
+            term_print(*baud, DEC);
+        }
+        term_writeln();
+        return CMD_OK;
+    }
+
+    if (strcmp("auto", arg) == 0) {
+        term_autobaud_begin();
+        return cli_run(baud_thread);
+    }
+
+    char *endptr = 0;
+    unsigned long baud = strtoul(arg, &endptr, 10);
+    const unsigned long *supported = term_bauds;
+    while (*supported != 0 && *supported != baud) {
+        supported++;
+    }
+    if (*arg == 0 || *endptr != 0 || *supported == 0) {
+        term_write(_e_invalid_baud);
+        term_writeln(arg);
+        return CMD_ERR;
+    }
+
+    term_write("now set the terminal to ");
+    term_print(baud, DEC);
+    term_write(" baud in SETUP (");
+    term_print(BAUD_CONFIRM_TIMEOUT / 1000, DEC);
+    term_writeln(" seconds)");
+
+    term_set_baud_begin(baud, BAUD_CONFIRM_TIMEOUT);
+    return cli_run(baud_thread);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Catch-up
+//////////////////////////////////////////////////////////////////////////////
+
+command_status cmd_catchup(char *tok) {
+    char *arg = strtok_r(NULL, " ", &tok);
+    if (arg != NULL) {
+        if (strcmp("on", arg) == 0) {
+            term_set_catchup(true);
+        } else if (strcmp("off", arg) == 0) {
+            term_set_catchup(false);
+        } else {
+            term_write(_e_invalid_option);
+            term_writeln(arg);
+            return CMD_ERR;
+        }
+    }
+
+    term_write("catch-up ");
+    term_writeln(term_catchup() ? "on" : "off");
+    return CMD_OK;
+}
 
 //////////////////////////////////////////////////////////////////////////////
 // Chars
@@ -161,10 +370,6 @@ command_status cmd_chars(char *tok) {
     byte c = FIRST_PRINTABLE;
     while (c <= FIRST_PRINTABLE + 11) {
         for (int col = 0; col < 8; col++) {
-            if (term_serial.read() == TERM_XOFF) {
-                while (term_serial.read() != TERM_XON) {}
-            }
-
             byte ch = (byte) (c + (col * 12));
 
             // On the last row, we'll have some columns to leave empty
@@ -188,7 +393,7 @@ command_status cmd_chars(char *tok) {
                 term_write(TERM_DISABLE_ALT_CHAR);
             }
 
-            term_write("    ");
+            term_pad(4);
         }
         c++;
         term_writeln("");
@@ -197,15 +402,50 @@ command_status cmd_chars(char *tok) {
     return CMD_OK;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Columns
+//////////////////////////////////////////////////////////////////////////////
+
+command_status cmd_cols(char *tok) {
+    char *arg = strtok_r(NULL, " ", &tok);
+    if (arg != NULL && !term_set_columns(atoi(arg))) {
+        term_write(_e_invalid_option);
+        term_writeln(arg);
+        return CMD_ERR;
+    }
+
+    term_print(term_columns(), DEC);
+    term_writeln(" columns");
+    return CMD_OK;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Echo
 //////////////////////////////////////////////////////////////////////////////
 
 #include <Arduino.h>
 
+static Print *_echo_target;
+
+static PT_THREAD(echo_thread(struct pt *pt)) {
+    PT_BEGIN(pt);
+    term_writeln("send break to quit");
+
+    while (true) {
+        // Handle break and flow control
+        PT_AWAIT_READABLE(pt, term_available());
+        int c = term_read();
+        if (c == TERM_BREAK) {
+            break;
+        }
+        _echo_target->write((uint8_t) c);
+    }
+    PT_END(pt);
+}
+
 command_status cmd_echo(char *tok) {
     char *arg;
-    Print *target = &term_serial;
+    Print *target = &term_stream;
 
     // Parse target
     arg = strtok_r(NULL, " ", &tok);
@@ -219,17 +459,8 @@ command_status cmd_echo(char *tok) {
         }
     }
 
-    term_writeln("send break to quit");
-
-    while (true) {
-        // Handle break and flow control
-        int c = term_serial.read();
-        if (c == TERM_BREAK) {
-            return CMD_OK;
-        } else if (c != -1) {
-            target->write((uint8_t) c);
-        }
-    }
+    _echo_target = target;
+    return cli_run(echo_thread);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -244,14 +475,9 @@ command_status cmd_help(char *tok) {
     }
 
     for (int i = 0; i < (sizeof(_commands) / sizeof(struct command)); i++) {
-        // Syntax with padding
+        // Syntax with padding and separator
         term_write(_commands[i].syntax, strlen(_commands[i].syntax));
-        for (int j = strlen(_commands[i].syntax); j < max_syntax_width; j++) {
-            term_write(' ');
-        }
-
-        // Separator
-        term_write("    ");
+        term_pad(max_syntax_width - strlen(_commands[i].syntax) + 4);
 
         // Help column (might wrap if really long)
         term_writeln(_commands[i].help);
@@ -271,67 +497,141 @@ command_status cmd_help(char *tok) {
 
 void print_time(uint64_t elapsed_ms) {
     uint16_t days = (uint16_t) (elapsed_ms / DAY_MILLIS);
-    term_print(days, DEC);
-    term_write(" days, ");
     elapsed_ms -= days * DAY_MILLIS;
 
     uint8_t hours = (uint8_t) (elapsed_ms / HOUR_MILLIS);
-    term_print(hours, DEC);
-    term_write(" hours, ");
     elapsed_ms -= hours * HOUR_MILLIS;
 
     uint8_t minutes = (uint8_t) (elapsed_ms / MINUTE_MILLIS);
-    term_print(minutes, DEC);
-    term_write(" minutes, ");
     elapsed_ms -= minutes * MINUTE_MILLIS;
 
     uint8_t seconds = (uint8_t) (elapsed_ms / SECOND_MILLIS);
-    term_print(seconds, DEC);
-    term_write(" seconds, ");
     elapsed_ms -= seconds * SECOND_MILLIS;
 
-    term_print((long) elapsed_ms, DEC);
-    term_write(" milliseconds");
+    term_printf("%u days, %u hours, %u minutes, %u seconds, %lu milliseconds",
+                days, hours, minutes, seconds, (unsigned long) elapsed_ms);
 }
 
 command_status cmd_info(char *tok) {
     // System
     term_write("uptime: ");
     print_time(_uptime);
-    term_writeln("");
+    term_writeln();
+    term_printf("boot: prompt after %lu ms, wifi after %lu ms, session after %lu ms (0 if not yet)\r\n",
+                _boot_times.prompt_ms, _boot_times.wifi_ms, _boot_times.session_ms);
+
+    struct sched_task_stats task_stats[SCHED_MAX_TASKS];
+    int tasks = sched_get_stats(task_stats, SCHED_MAX_TASKS);
+    for (int i = 0; i < tasks; i++) {
+        term_printf("task %s: %u.%u%% cpu, %lu runs, %lu over budget, busy %lu us, max %lu us\r\n",
+                    task_stats[i].name, task_stats[i].share / 10, task_stats[i].share % 10, task_stats[i].runs,
+                    task_stats[i].overruns, task_stats[i].busy_us, task_stats[i].max_us);
+    }
 
     // Wifi
 
     struct wifi_info w_info;
     wifi_get_info(&w_info);
 
-    term_write("wifi status: ");
-    term_writeln(w_info.status_description);
-
-    term_write("wifi ssid: ");
-    term_writeln(w_info.ssid);
+    term_printf("wifi status: %s\r\n", w_info.status_description);
+    term_printf("wifi join: %s\r\n", _join_states[wifi_get_join_state()]);
+    term_printf("wifi ssid: %s\r\n", w_info.ssid);
+    term_printf("wifi pass: %m\r\n", w_info.pass);
+    term_printf("wifi address: %I\r\n", &w_info.address);
+    term_printf("wifi netmask: %I\r\n", &w_info.netmask);
+    term_printf("wifi gateway: %I\r\n", &w_info.gateway);
+    term_printf("wifi time: %lu\r\n", w_info.time);
+    term_printf("wifi firmware: %s\r\n", w_info.firmware_version);
+    term_printf("wifi drops: %lu, %lu rejoins\r\n", w_info.drops, w_info.rejoins);
+
+    struct net_stats n_stats;
+    net_get_stats(&n_stats);
+
+    term_printf("net events: %lu, %u/sec; spi transfers: %lu, %u/sec\r\n", n_stats.events,
+                n_stats.events_per_sec, n_stats.spi, n_stats.spi_per_sec);
+    term_printf("net polls: %lu made (%lu with data), %lu skipped; %u/sec made, %u/sec skipped\r\n",
+                n_stats.polls, n_stats.data, n_stats.quiet, n_stats.polls_per_sec, n_stats.quiet_per_sec);
+    term_printf("net connected asks: %lu made, %lu skipped; %u/sec made, %u/sec skipped\r\n",
+                n_stats.asks, n_stats.skipped, n_stats.asks_per_sec, n_stats.skipped_per_sec);
+
+    // Terminal
+
+    struct term_stats t_stats;
+    term_get_stats(&t_stats);
+
+    term_printf("term: %lu baud, %u columns\r\n", term_baud(), term_columns());
+    term_printf("term tx: %lu bytes, %lu bytes/sec, blocked %lu ms\r\n",
+                t_stats.tx_bytes, t_stats.tx_bytes_per_sec, t_stats.tx_blocked_ms);
+    term_printf("term rx: %lu bytes, %lu overruns, %lu uart overruns, %lu framing errors\r\n",
+                t_stats.rx_bytes, t_stats.rx_overruns, t_stats.rx_uart_overruns, t_stats.rx_framing_errors);
+    term_printf("term flow: %lu xoffs, paused %lu ms\r\n", t_stats.xoffs, t_stats.paused_ms);
+    term_printf("term motion: %lu bytes (absolute/spaces %lu)\r\n",
+                t_stats.motion_bytes, t_stats.motion_naive_bytes);
+    term_printf("term padding: %lu bytes\r\n", t_stats.pad_bytes);
+    term_printf("term catch-up: %lu times, %lu bytes held, %lu sent instead\r\n",
+                t_stats.catchups, t_stats.catchup_held_bytes, t_stats.catchup_sent_bytes);
+    term_printf("term discard: %lu times, %lu bytes\r\n", t_stats.discards, t_stats.discarded_bytes);
+
+    struct ansi_stats a_stats;
+    ansi_get_stats(&a_stats);
+
+    term_printf("ansi: %lu bytes, %lu sequences, %lu unsupported\r\n",
+                a_stats.bytes, a_stats.sequences, a_stats.unsupported);
+
+    struct relay_stats r_stats;
+    relay_get_stats(&r_stats);
+
+    term_printf("relay: %lu polls, %lu blocks, %lu bytes to net, %lu to term, %lu to backlogs, busy %lu us\r\n",
+                r_stats.polls, r_stats.blocks, r_stats.bytes_to_net, r_stats.bytes_to_term, r_stats.bytes_to_backlog,
+                r_stats.busy_us);
+    term_printf("relay keys: %lu yields, waited at most %lu us\r\n", r_stats.yields, r_stats.input_wait_max_us);
+
+    struct session_stats se_stats;
+    session_get_stats(&se_stats);
+
+    term_printf("sessions: %u of %u open, %lu opened, %lu switches, %lu redrawn behind\r\n",
+                se_stats.open, SESSION_MAX, se_stats.opens, se_stats.switches, se_stats.restarts);
+    term_printf("sessions memory: %u bytes of backlogs, %u in connections, %u free\r\n",
+                se_stats.backlog_bytes, se_stats.connection_bytes, se_stats.free_bytes);
+
+    struct telnets_stats tn_stats;
+    telnets_get_stats(&tn_stats);
+
+    term_printf("telnets: %lu records, %lu bytes, %lu bytes/record\r\n",
+                tn_stats.records, tn_stats.payload_bytes,
+                tn_stats.records > 0 ? tn_stats.payload_bytes / tn_stats.records : 0UL);
+
+    struct busybox_stats b_stats;
+    busybox_get_stats(&b_stats);
+
+    term_printf("telnets session: %lu writes, %lu lines edited locally, %lu resizes\r\n",
+                b_stats.net_writes, b_stats.lines, b_stats.naws);
+    if (b_stats.flow_agreed) {
+        static const char *flow_modes[] = {"off", "on", "restart any", "restart xon"};
+        term_printf("telnets flow: local, server asked %s (%lu requests)\r\n",
+                    flow_modes[b_stats.flow_mode], b_stats.flow_requests);
+    }
+    term_printf("telnets abort: %lu times, %lu bytes dropped, last quiet after %lu ms\r\n",
+                b_stats.aborts, b_stats.abort_dropped, b_stats.abort_quiet_ms);
 
-    term_write("wifi pass: ");
-    term_writeln_masked(w_info.pass);
+    struct predict_stats p_stats;
+    predict_get_stats(&p_stats);
 
-    term_write("wifi address: ");
-    w_info.address.printTo(term_serial);
-    term_writeln("");
+    term_printf("predict: %lu keys shown, %lu confirmed, %lu repaired, echo %lu ms\r\n",
+                p_stats.shown, p_stats.confirmed, p_stats.repaired, p_stats.echo_ms);
 
-    term_write("wifi netmask: ");
-    w_info.netmask.printTo(term_serial);
-    term_writeln("");
+    struct line_stats l_stats;
+    line_get_stats(&l_stats);
 
-    term_write("wifi gateway: ");
-    w_info.gateway.printTo(term_serial);
-    term_writeln("");
+    term_printf("line: %lu lines, %lu bytes, %lu bytes sent by the terminal\r\n",
+                l_stats.lines, l_stats.line_bytes, l_stats.burst_bytes);
 
-    term_write("wifi time: ");
-    term_print(w_info.time, DEC);
-    term_writeln("");
+    struct screen_stats s_stats;
+    screen_get_stats(&s_stats);
 
-    term_write("wifi firmware: ");
-    term_writeln(w_info.firmware_version);
+    term_printf("screen: %lu frames, last %lu bytes (full redraw %lu), total %lu bytes (full redraw %lu)\r\n",
+                s_stats.commits, s_stats.last_bytes, s_stats.last_full_bytes,
+                s_stats.total_bytes, s_stats.total_full_bytes);
 
     return CMD_OK;
 }
@@ -341,12 +641,98 @@ command_status cmd_info(char *tok) {
 //////////////////////////////////////////////////////////////////////////////
 
 command_status cmd_keyboard_test(char *tok) {
-    if (keyboard_test()) {
-        return CMD_IO;
-    } else {
-        term_writeln("keyboard test failed");
-        return CMD_ERR;
+    return cli_run(keyboard_test);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Line Mode
+//////////////////////////////////////////////////////////////////////////////
+
+command_status cmd_line(char *tok) {
+    char *arg = strtok_r(NULL, " ", &tok);
+    if (arg != NULL) {
+        if (strcmp("on", arg) == 0) {
+            line_set_enabled(true);
+        } else if (strcmp("off", arg) == 0) {
+            line_set_enabled(false);
+        } else {
+            term_write(_e_invalid_option);
+            term_writeln(arg);
+            return CMD_ERR;
+        }
+    }
+
+    term_write("line mode ");
+    term_writeln(line_enabled() ? "on" : "off");
+    return CMD_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Padding
+//////////////////////////////////////////////////////////////////////////////
+
+command_status cmd_padding(char *tok) {
+    bool calibrate = false;
+
+    char *arg = strtok_r(NULL, " ", &tok);
+    if (arg != NULL) {
+        if (strcmp("cal", arg) == 0) {
+            calibrate = true;
+        } else {
+            term_write(_e_invalid_option);
+            term_writeln(arg);
+            return CMD_ERR;
+        }
     }
+
+    // Calibration draws all over the screen, so results are printed after
+    uint32_t failed = 0;
+    if (calibrate) {
+        for (int i = 0; term_paddings[i].name != NULL; i++) {
+            if (!term_calibrate_padding(&term_paddings[i])) {
+                failed |= 1UL << i;
+            }
+        }
+        term_save_padding();
+    }
+
+    for (int i = 0; term_paddings[i].name != NULL; i++) {
+        term_write(term_paddings[i].name);
+        term_pad(12 - strlen(term_paddings[i].name));
+        term_print(term_paddings[i].ms, DEC);
+        term_write(" ms");
+        if (failed & (1UL << i)) {
+            term_write(" (no padding worked; unchanged)");
+        }
+        term_writeln();
+    }
+    return CMD_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Predict
+//////////////////////////////////////////////////////////////////////////////
+
+static const char *_predict_modes[] = {"off", "on", "auto"};
+
+command_status cmd_predict(char *tok) {
+    char *arg = strtok_r(NULL, " ", &tok);
+    if (arg != NULL) {
+        int mode = 0;
+        while (mode <= PREDICT_AUTO && strcmp(_predict_modes[mode], arg) != 0) {
+            mode++;
+        }
+        if (mode > PREDICT_AUTO) {
+            term_write(_e_invalid_option);
+            term_writeln(arg);
+            return CMD_ERR;
+        }
+        predict_set_mode((predict_mode) mode);
+    }
+
+    term_write("predictive echo ");
+    term_writeln(_predict_modes[predict_get_mode()]);
+    return CMD_OK;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -355,16 +741,146 @@ command_status cmd_keyboard_test(char *tok) {
 
 command_status cmd_reset(char *tok) {
     term_writeln("starting over!");
-    term_serial.flush();
-    while (term_serial.available()) {
-        term_serial.read();
-    }
+    term_flush();
+    term_discard_input();
     NVIC_SystemReset();
 
     // Never happens!
     return CMD_OK;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Sessions
+//////////////////////////////////////////////////////////////////////////////
+
+command_status cmd_sessions(char *tok) {
+    char *arg = strtok_r(NULL, " ", &tok);
+    if (arg != NULL) {
+        uint8_t n;
+        if (!parse_uint8(arg, &n) || !session_resume(n)) {
+            term_write("no session ");
+            term_writeln(arg);
+            return CMD_ERR;
+        }
+        return CMD_IO;
+    }
+
+    struct session_info info[SESSION_MAX];
+    int count = session_list(info, SESSION_MAX);
+    for (int i = 0; i < count; i++) {
+        term_printf("%u %s: %lu bytes, %u in backlog\r\n",
+                    info[i].number, info[i].name, info[i].bytes, info[i].backlog);
+    }
+    if (count == 0) {
+        term_writeln("no sessions");
+    } else {
+        term_printf("in a session, ^\\ then 1-%u, n (next) or c (command line)\r\n", SESSION_MAX);
+    }
+    return CMD_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Speed
+//////////////////////////////////////////////////////////////////////////////
+
+#define SPEED_DEFAULT_BYTES     4000
+#define SPEED_FMT_LINES         1000
+
+// Swallows output, so formatting can be timed on its own
+class null_print : public Print {
+public:
+    size_t write(uint8_t) {
+        return 1;
+    }
+
+    size_t write(const uint8_t *, size_t size) {
+        return size;
+    }
+};
+
+// Times formatting a line of `i` output with Print calls and with fmt()
+command_status speed_fmt() {
+    uint32_t a = 123456, b = 1920, c = 42;
+    null_print out;
+    char line[TERM_PRINTF_BUFSIZE];
+
+    unsigned long start = micros();
+    for (int i = 0; i < SPEED_FMT_LINES; i++) {
+        out.print("term tx: ");
+        out.print(a, DEC);
+        out.print(" bytes, ");
+        out.print(b, DEC);
+        out.print(" bytes/sec, blocked ");
+        out.print(c, DEC);
+        out.print(" ms\r\n");
+    }
+    unsigned long print_us = micros() - start;
+
+    start = micros();
+    for (int i = 0; i < SPEED_FMT_LINES; i++) {
+        size_t len = fmt(line, sizeof(line), "term tx: %lu bytes, %lu bytes/sec, blocked %lu ms\r\n", a, b, c);
+        out.write((const uint8_t *) line, len);
+    }
+    unsigned long fmt_us = micros() - start;
+
+    term_printf("%d lines: Print %lu us, fmt %lu us\r\n", SPEED_FMT_LINES, print_us, fmt_us);
+    return CMD_OK;
+}
+
+static uint16_t _speed_count;
+static uint16_t _speed_sent;
+static unsigned long _speed_start;
+
+// Keeps the ring topped up until count bytes are out, then reports the rate
+static PT_THREAD(speed_thread(struct pt *pt)) {
+    PT_BEGIN(pt);
+    PT_WAIT_UNTIL(pt, term_queued() == 0);
+    _speed_start = millis();
+    _speed_sent = 0;
+    while (_speed_sent < _speed_count) {
+        PT_WAIT_UNTIL(pt, term_writable() > 0);
+        uint8_t buf[64];
+        size_t len = min(sizeof(buf), (size_t) (_speed_count - _speed_sent));
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = (uint8_t) (FIRST_PRINTABLE + (_speed_sent + i) % (LAST_PRINTABLE - FIRST_PRINTABLE + 1));
+        }
+        _speed_sent += (uint16_t) term_write_some(buf, len);
+    }
+    PT_WAIT_UNTIL(pt, term_queued() == 0);
+
+    unsigned long elapsed = max(millis() - _speed_start, 1UL);
+    term_writeln();
+    term_print(_speed_count, DEC);
+    term_write(" bytes in ");
+    term_print(elapsed, DEC);
+    term_write(" ms: ");
+    term_print(_speed_count * 1000UL / elapsed, DEC);
+    term_write(" bytes/s at ");
+    term_print(term_baud(), DEC);
+    term_write(" baud (line rate ");
+    // 8N1 is ten bits per byte
+    term_print(term_baud() / 10, DEC);
+    term_writeln(")");
+    PT_END(pt);
+}
+
+command_status cmd_speed(char *tok) {
+    uint16_t count = SPEED_DEFAULT_BYTES;
+
+    char *arg = strtok_r(NULL, " ", &tok);
+    if (arg != NULL && strcmp("fmt", arg) == 0) {
+        return speed_fmt();
+    }
+    if (arg != NULL && !parse_uint16(arg, &count)) {
+        term_write(_e_invalid_count);
+        term_writeln(arg);
+        return CMD_ERR;
+    }
+
+    _speed_count = count;
+    return cli_run(speed_thread);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // TCP Connect
 //////////////////////////////////////////////////////////////////////////////
@@ -424,7 +940,26 @@ command_status cmd_telnets_connect(char *tok) {
     }
     port = (uint16_t) atoi(arg);
 
-    if (telnets_connect(host, port, NULL)) {
+    // Parse the coalescing budget and batch size
+    uint8_t coalesce_ms = TELNETS_COALESCE_MS;
+    uint8_t coalesce_max = TELNETS_BATCH_MAX;
+    arg = strtok_r(NULL, " ", &tok);
+    if (arg != NULL) {
+        if (!parse_uint8(arg, &coalesce_ms) || coalesce_ms > TELNETS_COALESCE_MAX_MS) {
+            term_write(_e_invalid_option);
+            term_writeln(arg);
+            return CMD_ERR;
+        }
+        arg = strtok_r(NULL, " ", &tok);
+        if (arg != NULL && (!parse_uint8(arg, &coalesce_max) || coalesce_max == 0 ||
+                            coalesce_max > TELNETS_BATCH_MAX)) {
+            term_write(_e_invalid_option);
+            term_writeln(arg);
+            return CMD_ERR;
+        }
+    }
+
+    if (telnets_connect(host, port, NULL, coalesce_ms, coalesce_max)) {
         return CMD_IO;
     } else {
         term_writeln("connection failed");
@@ -436,27 +971,42 @@ command_status cmd_telnets_connect(char *tok) {
 // Wifi Join
 //////////////////////////////////////////////////////////////////////////////
 
-command_status cmd_wifi_join(char *tok) {
-    int n;
-    char ssid[100];
-    char pass[100];
+// The same sizes wifi.cpp keeps
+static char _ssid[40];
+static char _pass[40];
 
-    term_write("ssid: ");
-    n = term_readln(ssid, sizeof(ssid) - 1, READLN_ECHO);
-    if (n == 0) {
+static PT_THREAD(wifi_join_thread(struct pt *pt)) {
+    PT_BEGIN(pt);
+    prompt_line("ssid: ", _ssid, sizeof(_ssid), READLN_ECHO);
+    PT_SPAWN(pt, &_readln_pt, term_readln(&_readln_pt, &_line));
+    if (_line.len == 0) {
         term_writeln(_e_missing_ssid);
-        return CMD_ERR;
+        _run_status = CMD_ERR;
+        PT_EXIT(pt);
     }
-    ssid[n] = '\0';
+    _ssid[_line.len] = '\0';
     term_writeln("");
 
-    term_write("password: ");
-    n = term_readln(pass, sizeof(pass) - 1, READLN_MASKED);
-    pass[n] = '\0';
+    prompt_line("password: ", _pass, sizeof(_pass), READLN_MASKED);
+    PT_SPAWN(pt, &_readln_pt, term_readln(&_readln_pt, &_line));
+    _pass[_line.len] = '\0';
     term_writeln("");
 
-    wifi_connect(ssid, pass);
-    return CMD_OK;
+    if (!wifi_join(_ssid, _pass, WIFI_JOIN_TIMEOUT_MS)) {
+        term_writeln("wifi: join failed");
+        _run_status = CMD_ERR;
+        PT_EXIT(pt);
+    }
+    term_writeln("joining...");
+    PT_WAIT_WHILE(pt, wifi_joining());
+    if (!print_join_result()) {
+        _run_status = CMD_ERR;
+    }
+    PT_END(pt);
+}
+
+command_status cmd_wifi_join(char *tok) {
+    return cli_run(wifi_join_thread);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -464,12 +1014,7 @@ command_status cmd_wifi_join(char *tok) {
 //////////////////////////////////////////////////////////////////////////////
 
 void print_wifi_network(struct wifi_network net) {
-    term_write("\"");
-    term_write(net.ssid);
-    term_write("\" ");
-    term_print(net.rssi, DEC);
-    term_write(" dBm, ");
-    term_writeln(net.encryption_description);
+    term_printf("\"%s\" %ld dBm, %s\r\n", net.ssid, (long) net.rssi, net.encryption_description);
 }
 
 command_status cmd_wifi_scan(char *tok) {
@@ -478,8 +1023,7 @@ command_status cmd_wifi_scan(char *tok) {
         term_writeln("scan error");
         return CMD_ERR;
     } else {
-        term_print(nets, DEC);
-        term_writeln(" networks");
+        term_printf("%d networks\r\n", nets);
         return CMD_OK;
     }
 }
@@ -488,27 +1032,35 @@ command_status cmd_wifi_scan(char *tok) {
 // Weather
 //////////////////////////////////////////////////////////////////////////////
 
-command_status cmd_weather(char *tok) {
-    int n;
-    char zip[6];
+static char _zip[6];
+static struct pt _weather_pt;
 
-    term_write("zip: ");
-    n = term_readln(zip, sizeof(zip) - 1, READLN_ECHO);
-    if (n == 0) {
+static PT_THREAD(weather_thread(struct pt *pt)) {
+    PT_BEGIN(pt);
+    prompt_line("zip: ", _zip, sizeof(_zip), READLN_ECHO);
+    PT_SPAWN(pt, &_readln_pt, term_readln(&_readln_pt, &_line));
+    if (_line.len == 0) {
         term_writeln(_e_missing_zip);
-        return CMD_ERR;
+        _run_status = CMD_ERR;
+        PT_EXIT(pt);
     }
-    zip[n] = '\0';
+    _zip[_line.len] = '\0';
     term_writeln("");
 
-    weather(zip);
-    return CMD_OK;
+    PT_SPAWN(pt, &_weather_pt, weather(&_weather_pt, _zip));
+    PT_END(pt);
+}
+
+command_status cmd_weather(char *tok) {
+    return cli_run(weather_thread);
 }
 
 //////////////////////////////////////////////////////////////////////////////
 // Command Dispatch
 //////////////////////////////////////////////////////////////////////////////
 
+void print_status(command_status status);
+
 command_status process_command() {
     char *tok = NULL;
     const char *command_name = strtok_r(_command, " ", &tok);
@@ -534,14 +1086,19 @@ command_status process_command() {
         }
     }
 
+    print_status(status);
+    return status;
+}
+
+void print_status(command_status status) {
     switch (status) {
         case CMD_OK:
             term_writeln("= ok");
-            term_serial.flush();
+            term_flush();
             break;
         case CMD_ERR:
             term_writeln("= err");
-            term_serial.flush();
+            term_flush();
             break;
         case CMD_IO:
             // Print nothing, program is handling IO
@@ -549,8 +1106,6 @@ command_status process_command() {
         default:
             break;
     }
-
-    return status;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -567,8 +1122,19 @@ void cli_loop() {
     _uptime += millis() - _last_millis;
     _last_millis = now;
 
+    // A command that's still running reads keys itself
+    if (_run != NULL) {
+        if (PT_SCHEDULE(_run(&_run_pt))) {
+            return;
+        }
+        _run = NULL;
+        print_status(_run_status);
+        // With CMD_IO it started something else; prompt once that's done
+        _handling_io = true;
+    }
+
     // Don't consume keys if commands we're running are handling IO
-    if (wifi_has_loop_callback()) {
+    if (sched_terminal_taken()) {
         _handling_io = true;
         return;
     }
@@ -577,10 +1143,13 @@ void cli_loop() {
     if (_handling_io) {
         _handling_io = false;
         print_prompt();
+        if (_boot_times.prompt_ms == 0) {
+            _boot_times.prompt_ms = millis();
+        }
     }
 
-    while (term_serial && term_serial.available()) {
-        uint8_t c = (uint8_t) term_serial.read();
+    while (term_available()) {
+        uint8_t c = (uint8_t) term_read();
 
         // Handle backspace before normal character echo so we can do what's
         // required to make it look right and prevent it from erasing too far
@@ -589,11 +1158,11 @@ void cli_loop() {
             if (_command_index > 0) {
                 if (ECHO) {
                     // Go back one char
-                    term_serial.write(0x08);
+                    term_write((char) 0x08);
                     // Overwrite char with a space
-                    term_serial.write(" ");
+                    term_write(" ");
                     // Go back again
-                    term_serial.write(0x08);
+                    term_write((char) 0x08);
                 }
                 // Shrink the command buffer
                 _command[_command_index] = 0;
@@ -603,7 +1172,7 @@ void cli_loop() {
         }
 
         if (ECHO) {
-            term_serial.write(c);
+            term_write((char) c);
         }
 
         if (c != '\r' && c != '\n' && _command_index < sizeof(_command)) {
@@ -615,6 +1184,7 @@ void cli_loop() {
         if (c == '\r' || c == '\n') {
             term_writeln("");
             _command[_command_index] = 0;
+            _commanded = true;
             prompt = process_command() != CMD_IO;
         } else {
             term_writeln("command too long");
@@ -624,7 +1194,67 @@ void cli_loop() {
         clear_command();
         if (prompt) {
             print_prompt();
+        } else {
+            // Keys typed from here on are for whatever the command started
+            break;
+        }
+    }
+}
+
+// What cli_boot() was asked to do, for boot_thread
+static struct {
+    const char *wifi_ssid;
+    const char *wifi_pass;
+    uint16_t wifi_join_timeout;
+    const char *telnets_host;
+    uint16_t telnets_port;
+    const char *telnets_user;
+} _boot;
+
+static struct pt _boot_pt;
+static int _boot_task = -1;
+
+// Waits out the join in the background, then opens the session if there
+// is one to open, unless the command line has been used meanwhile.
+// connectSSL() still blocks the whole loop for the TLS handshake.
+static PT_THREAD(boot_thread(struct pt *pt)) {
+    PT_BEGIN(pt);
+    PT_WAIT_WHILE(pt, wifi_joining());
+    if (notice_begin()) {
+        print_join_result();
+        notice_end();
+    }
+    if (!wifi_is_connected()) {
+        PT_EXIT(pt);
+    }
+    _boot_times.wifi_ms = millis();
+    if (_boot.telnets_host == NULL || _boot.telnets_port == 0) {
+        PT_EXIT(pt);
+    }
+
+    // Not over a command being typed.  Once one has been entered (which is
+    // also how a command runs or a session opens) the user has taken over.
+    PT_WAIT_UNTIL(pt, _commanded || (_command_index == 0 && notice_begin()));
+    if (_commanded) {
+        if (notice_begin()) {
+            term_writeln("telnets: auto connect skipped, a command was entered");
+            notice_end();
         }
+        PT_EXIT(pt);
+    }
+    term_printf("telnets: auto connect host=%s port=%u\r\n", _boot.telnets_host, _boot.telnets_port);
+    if (telnets_connect(_boot.telnets_host, _boot.telnets_port, _boot.telnets_user)) {
+        _boot_times.session_ms = millis();
+    } else {
+        notice_end();
+    }
+    PT_END(pt);
+}
+
+static void boot_loop() {
+    if (!PT_SCHEDULE(boot_thread(&_boot_pt))) {
+        sched_remove(_boot_task);
+        _boot_task = -1;
     }
 }
 
@@ -634,33 +1264,30 @@ void cli_boot(const char *default_wifi_ssid,
               const char *default_telnets_host,
               uint16_t default_telnets_port,
               const char *default_telnets_user) {
-
-    boolean connected = false;
-    if (default_wifi_ssid != NULL && default_wifi_pass != NULL) {
-        term_write("wifi: auto join ssid=[");
-        term_write(default_wifi_ssid);
-        term_write("] timeout=");
-        term_print(wifi_join_timeout, DEC);
-        term_writeln("ms");
-
-        wifi_connect(default_wifi_ssid, default_wifi_pass);
-        unsigned long timeout = millis() + wifi_join_timeout;
-        while (!wifi_is_connected() && millis() < timeout) {
-            delay(1);
-        }
-
-        if (default_telnets_host != NULL && default_telnets_port > 0) {
-            term_write("telnets: auto connect host=");
-            term_write(default_telnets_host);
-            term_write(" port=");
-            term_print(default_telnets_port, DEC);
-            term_writeln("");
-
-            connected = telnets_connect(default_telnets_host, default_telnets_port, default_telnets_user);
-        }
+    _boot.wifi_ssid = default_wifi_ssid;
+    _boot.wifi_pass = default_wifi_pass;
+    _boot.wifi_join_timeout = wifi_join_timeout;
+    _boot.telnets_host = default_telnets_host;
+    _boot.telnets_port = default_telnets_port;
+    _boot.telnets_user = default_telnets_user;
+
+    // The prompt comes at once, on the first pass
+    _handling_io = true;
+    if (_boot.wifi_ssid == NULL || _boot.wifi_pass == NULL) {
+        return;
     }
 
-    if (!connected) {
-        print_prompt();
+    term_write("wifi: joining [");
+    term_write(_boot.wifi_ssid);
+    term_write("] timeout=");
+    term_print(_boot.wifi_join_timeout, DEC);
+    term_writeln("ms");
+    if (!wifi_join(_boot.wifi_ssid, _boot.wifi_pass, _boot.wifi_join_timeout)) {
+        term_writeln("wifi: join failed");
+        return;
     }
+
+    // Reports the join, and opens the session once it's up
+    PT_INIT(&_boot_pt);
+    _boot_task = sched_add("boot", boot_loop, NULL, 0, 0);
 }
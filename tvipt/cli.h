@@ -10,6 +10,8 @@ void cli_init();
 
 void cli_loop();
 
+// Shows the prompt at once, joins the WiFi network in the background and,
+// once it's joined, opens a session to the telnets host if there is one.
 void cli_boot(const char *default_wifi_ssid,
               const char *default_wifi_pass,
               uint16_t wifi_join_timeout,
@@ -5,5 +5,8 @@
 # https://github.com/arduino/Arduino/blob/master/build/shared/manpage.adoc
 
 arduino --pref "boardsmanager.additional.urls=https://adafruit.github.io/arduino-board-index/package_adafruit_index.json" --save-prefs
+# wifi_shim.cpp and net.cpp are written against this version's internals,
+# and build.sh fails with any other
 arduino --install-library WiFi101:0.15.0
+arduino --install-library FlashStorage:0.7.0
 arduino --install-boards adafruit:samd:1.0.17
@@ -0,0 +1,197 @@
+#include "fmt.h"
+
+#include <IPAddress.h>
+
+#define FLAG_LEFT       0x01
+#define FLAG_ZERO       0x02
+
+static void put(struct fmt_out *out, char c) {
+    out->total++;
+    if (out->len == out->size) {
+        if (out->flush == NULL) {
+            return;
+        }
+        out->flush(out);
+    }
+    out->buf[out->len++] = c;
+}
+
+static void put_repeat(struct fmt_out *out, char c, int count) {
+    while (count-- > 0) {
+        put(out, c);
+    }
+}
+
+// Writes len chars of val padded to width
+static void put_field(struct fmt_out *out, const char *val, int len, int width, byte flags) {
+    int pad = width - len;
+    if (!(flags & FLAG_LEFT)) {
+        put_repeat(out, (flags & FLAG_ZERO) ? '0' : ' ', pad);
+    }
+    for (int i = 0; i < len; i++) {
+        put(out, val[i]);
+    }
+    if (flags & FLAG_LEFT) {
+        put_repeat(out, ' ', pad);
+    }
+}
+
+static void put_number(struct fmt_out *out, unsigned long long val, bool negative, byte base, bool upper,
+                       int width, byte flags) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    // Digits go in from the end
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    do {
+        *--p = digits[val % base];
+        val /= base;
+    } while (val > 0);
+
+    if (negative) {
+        if (flags & FLAG_ZERO) {
+            // The sign goes before the zeros
+            put(out, '-');
+            width--;
+        } else {
+            *--p = '-';
+        }
+    }
+    put_field(out, p, (int) (buf + sizeof(buf) - p), width, flags);
+}
+
+static void put_address(struct fmt_out *out, const IPAddress *address, int width, byte flags) {
+    char buf[16];
+    char *p = buf;
+    for (int i = 0; i < 4; i++) {
+        if (i > 0) {
+            *p++ = '.';
+        }
+        uint8_t octet = (*address)[i];
+        if (octet >= 100) {
+            *p++ = (char) ('0' + octet / 100);
+        }
+        if (octet >= 10) {
+            *p++ = (char) ('0' + octet / 10 % 10);
+        }
+        *p++ = (char) ('0' + octet % 10);
+    }
+    put_field(out, buf, (int) (p - buf), width, flags & FLAG_LEFT);
+}
+
+void fmt_init(struct fmt_out *out, char *buf, size_t size, void (*flush)(struct fmt_out *out)) {
+    out->buf = buf;
+    out->size = size;
+    out->len = 0;
+    out->flush = flush;
+    out->total = 0;
+}
+
+void fmt_vformat(struct fmt_out *out, const char *format, va_list args) {
+    for (const char *f = format; *f != '\0'; f++) {
+        if (*f != '%') {
+            put(out, *f);
+            continue;
+        }
+
+        // Flags
+        byte flags = 0;
+        for (f++; *f == '-' || *f == '0'; f++) {
+            flags |= *f == '-' ? FLAG_LEFT : FLAG_ZERO;
+        }
+
+        // Width
+        int width = 0;
+        if (*f == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                flags |= FLAG_LEFT;
+                width = -width;
+            }
+            f++;
+        } else {
+            for (; *f >= '0' && *f <= '9'; f++) {
+                width = width * 10 + (*f - '0');
+            }
+        }
+
+        // Length
+        byte longs = 0;
+        for (; *f == 'l'; f++) {
+            longs++;
+        }
+
+        switch (*f) {
+            case 'd':
+            case 'i': {
+                long long val = longs >= 2 ? va_arg(args, long long) :
+                                longs == 1 ? va_arg(args, long) : va_arg(args, int);
+                bool negative = val < 0;
+                put_number(out, negative ? 0ULL - (unsigned long long) val : (unsigned long long) val, negative,
+                           10, false, width, flags);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X': {
+                unsigned long long val = longs >= 2 ? va_arg(args, unsigned long long) :
+                                         longs == 1 ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+                put_number(out, val, false, (byte) (*f == 'u' ? 10 : 16), *f == 'X', width, flags);
+                break;
+            }
+            case 'c': {
+                char c = (char) va_arg(args, int);
+                put_field(out, &c, 1, width, flags & FLAG_LEFT);
+                break;
+            }
+            case 's':
+            case 'm': {
+                const char *val = va_arg(args, const char *);
+                if (val == NULL) {
+                    val = "";
+                }
+                int len = (int) strlen(val);
+                if (*f == 's') {
+                    put_field(out, val, len, width, flags & FLAG_LEFT);
+                } else {
+                    if (flags & FLAG_LEFT) {
+                        put_repeat(out, '*', len);
+                    }
+                    put_repeat(out, ' ', width - len);
+                    if (!(flags & FLAG_LEFT)) {
+                        put_repeat(out, '*', len);
+                    }
+                }
+                break;
+            }
+            case 'I':
+                put_address(out, va_arg(args, const IPAddress *), width, flags);
+                break;
+            case '%':
+                put(out, '%');
+                break;
+            case '\0':
+                // A lone % at the end
+                return;
+            default:
+                // Unknown conversions print as written
+                put(out, '%');
+                put(out, *f);
+                break;
+        }
+    }
+}
+
+size_t fmt(char *buf, size_t size, const char *format, ...) {
+    struct fmt_out out;
+    // Leave room for the terminator
+    fmt_init(&out, buf, size - 1, NULL);
+
+    va_list args;
+    va_start(args, format);
+    fmt_vformat(&out, format, args);
+    va_end(args);
+
+    buf[out.len] = '\0';
+    return out.total;
+}
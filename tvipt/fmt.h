@@ -0,0 +1,35 @@
+// printf-style formatting with no heap and no floating point.
+//
+// Conversions: %d %i %u %x %X %c %s %%, with the - and 0 flags, a width
+// (or * to take it from the arguments) and the l and ll length modifiers.
+// Two of our own:
+//
+//   %I   IP address, from a const IPAddress *
+//   %m   string masked with one * per character (passwords)
+
+#ifndef _FMT_H
+#define _FMT_H
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+struct fmt_out {
+    char *buf;
+    size_t size;
+    size_t len;
+    // Called when buf is full to empty it (and set len to 0).  With no
+    // flush, output that doesn't fit is dropped.
+    void (*flush)(struct fmt_out *out);
+    // Everything formatted, including anything dropped
+    size_t total;
+};
+
+void fmt_init(struct fmt_out *out, char *buf, size_t size, void (*flush)(struct fmt_out *out));
+
+void fmt_vformat(struct fmt_out *out, const char *format, va_list args);
+
+// Formats into buf, which is always terminated.  Returns the length the
+// whole result would have had.
+size_t fmt(char *buf, size_t size, const char *format, ...);
+
+#endif
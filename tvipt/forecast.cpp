@@ -0,0 +1,61 @@
+#include "forecast.h"
+#include "screen.h"
+
+const char *wind_direction(int angle) {
+    if (angle == 999) {
+        return "?";
+    }
+
+    const char *dirs[] = {"N", "NE", "E", "SE", "S", "SW", "W", "NW", "N"};
+    const short angles[] = {0, 45, 90, 135, 180, 225, 270, 315, 360};
+
+    short min_diff = 360;
+    const char *dir_for_min_diff = NULL;
+
+    // Quick and dirty "find closest direction"
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        short diff = (short) abs(angle - angles[i]);
+        if (diff < min_diff) {
+            min_diff = diff;
+            dir_for_min_diff = dirs[i];
+        }
+    }
+
+    return dir_for_min_diff;
+}
+
+void print_weather(const struct weather *weather) {
+    screen_begin();
+
+    screen_printf("%s (%s)\r\n", weather->area, weather->timestamp);
+    screen_printf(" Station:      %s (%s)\r\n", weather->station_id, weather->station_name);
+    screen_printf(" Weather:      %s\r\n", weather->description);
+    screen_printf(" Temperature:  %d F\r\n", weather->temperature);
+    screen_printf(" Humidity:     %d %%\r\n", weather->relative_humidity);
+    screen_printf(" Dewpoint:     %d F\r\n", weather->dewpoint);
+    screen_printf(" Pressure:     %s in/Hg\r\n", weather->sea_level_pressure);
+    screen_printf(" Wind:         %d mph (gusts %d mph) from the %s\r\n",
+                  weather->wind_speed, weather->gust, wind_direction(weather->wind_direction));
+
+    screen_writeln();
+
+    for (int i = 0; i < 12; i++) {
+        int row = 10 + i;
+        const struct period_forecast *fc = &weather->future[i];
+
+        screen_print(row, 1, fc->name);
+        screen_print(row, 18, fc->temperature_label);
+        screen_print(row, 24, fc->temperature);
+        screen_print(row, 28, fc->precipitation);
+        if (strlen(fc->precipitation) > 0) {
+            screen_write("%");
+        }
+        screen_print(row, 33, fc->weather, 80 - 43);
+    }
+
+    screen_writeln();
+    screen_writeln();
+
+    // Only what changed since the last frame (or prompt) goes to the terminal
+    screen_commit();
+}
@@ -0,0 +1,42 @@
+// A forecast as weather.cpp parses it, and how it's drawn.
+
+#ifndef _FORECAST_H
+#define _FORECAST_H
+
+#define FUTURE_PERIODS 14
+
+struct period_forecast {
+    char name[24];
+    char weather[42];
+    char temperature_label[5];
+    char temperature[4];
+    char precipitation[4];
+};
+
+struct weather {
+    char timestamp[32];
+    char area[32];
+
+    // Current conditions
+    char station_id[24];
+    char station_name[64];
+    char description[24];
+    short temperature;
+    short dewpoint;
+    short relative_humidity;
+    short wind_speed;
+    short wind_direction;
+    short gust;
+    char sea_level_pressure[6];
+
+    // Future
+    struct period_forecast future[FUTURE_PERIODS];
+};
+
+// The compass point nearest angle, or "?" for 999 (no wind)
+const char *wind_direction(int angle);
+
+// Draws the forecast as a frame, sending only what changed since the last
+void print_weather(const struct weather *weather);
+
+#endif
@@ -4,37 +4,57 @@
 
 static int http_request_id = 0;
 
-// Reads one CRLF-terminated HTTP line from the client into a buffer
-// and terminates it.  Returns the number of bytes written to buf not 
-// including the terminator.
-size_t http_read_line(WiFiClient *client, char *buf, size_t bufsize) {
-    bool last_char_was_cr = false;
-
-    char *start = buf;
-    // end leaves room for the terminator
-    char *end = start + bufsize - 1;
-
-    while (buf < end && client->connected()) {
-        int c = client->read();
+// True once the server has sent something, closed, or gone quiet too long.
+static bool http_readable(struct http_request *req) {
+    if (net_available(*req->client) > 0 || !net_connected(*req->client, req->watch)) {
+        return true;
+    }
+    return PT_PASSED(req->deadline);
+}
 
-        if (c == -1) {
-            continue;
-        }
+// Adds what the client has to the line; true at the end of the line.
+static bool http_take_line(struct http_request *req) {
+    int c;
+    while ((c = req->client->read()) != -1) {
         if (c == '\r') {
-            last_char_was_cr = true;
+            req->line_cr = true;
             continue;
         }
-        if (last_char_was_cr && c == '\n') {
-            // Done reading the line or the connection closed
-            break;
+        if (req->line_cr && c == '\n') {
+            return true;
         }
-        last_char_was_cr = false;
+        req->line_cr = false;
 
-        *buf++ = c;
+        // end leaves room for the terminator
+        if (req->line_len < sizeof(req->line) - 1) {
+            req->line[req->line_len++] = (char) c;
+        }
     }
+    return false;
+}
 
-    *buf++ = '\0';
-    return (buf - start) - 1;
+// Reads one CRLF-terminated HTTP line from the client into req->line and
+// terminates it, leaving its length in req->line_len.  Stops early if the
+// connection closes or times out.
+static PT_THREAD(http_read_line(struct pt *pt, struct http_request *req)) {
+    PT_BEGIN(pt);
+    req->line_len = 0;
+    req->line_cr = false;
+    req->deadline = millis() + HTTP_TIMEOUT_MS;
+
+    while (req->client->connected() || req->client->available() > 0) {
+        PT_WAIT_UNTIL(pt, http_readable(req));
+        if (http_take_line(req)) {
+            break;
+        }
+        if (PT_PASSED(req->deadline)) {
+            req->status = HTTP_STATUS_TIMEOUT;
+            break;
+        }
+    }
+
+    req->line[req->line_len] = '\0';
+    PT_END(pt);
 }
 
 // Mutate a terminated string that contains an HTTP header and get
@@ -174,6 +194,7 @@ void http_request_init(struct http_request *req) {
     req->status = 0;
 
     req->client = NULL;
+    req->watch = NET_NO_WATCH;
 }
 
 #define DBG() print_dbg_prefix(req);
@@ -187,11 +208,13 @@ void print_dbg_prefix(struct http_request *req) {
 void http_request_disconnect(struct http_request *req) {
     if (req->client != NULL) {
         req->client->stop();
+        net_unwatch(req->watch);
         delete req->client;
         DBG();
         dbg_serial.println("disconnected");
     }
     req->client = NULL;
+    req->watch = NET_NO_WATCH;
 }
 
 bool http_request_connect(struct http_request *req) {
@@ -208,16 +231,23 @@ bool http_request_connect(struct http_request *req) {
         req->client = new WiFiSSLClient();
         DBG();
         dbg_serial.println("connecting (https)");
-        return req->client->connectSSL(req->host, req->port);
+        if (!req->client->connectSSL(req->host, req->port)) {
+            return false;
+        }
     } else {
         req->client = new WiFiClient();
         DBG();
         dbg_serial.println("connecting (http)");
-        return req->client->connect(req->host, req->port);
+        if (!req->client->connect(req->host, req->port)) {
+            return false;
+        }
     }
+    req->watch = net_watch(*req->client);
+    return true;
 }
 
-void http_get(struct http_request *req) {
+PT_THREAD(http_get(struct pt *pt, struct http_request *req)) {
+    PT_BEGIN(pt);
     DBG();
     dbg_serial.println("get");
 
@@ -225,72 +255,93 @@ void http_get(struct http_request *req) {
         req->status = HTTP_STATUS_CONNECT_ERR;
         DBG();
         dbg_serial.print("connect failed");
-    } else {
-        req->client->print("GET ");
-        req->client->print(req->path_and_query);
-        req->client->println(" HTTP/1.1");
+        http_request_disconnect(req);
+        PT_EXIT(pt);
+    }
+
+    req->client->print("GET ");
+    req->client->print(req->path_and_query);
+    req->client->println(" HTTP/1.1");
 
-        req->client->print("Host: ");
-        req->client->println(req->host);
+    req->client->print("Host: ");
+    req->client->println(req->host);
 
-        req->client->println("Connection: close");
+    req->client->println("Connection: close");
 
-        req->client->println("Accept: */*");
-        req->client->println("User-Agent: tvipt/1");
+    req->client->println("Accept: */*");
+    req->client->println("User-Agent: tvipt/1");
 
-        req->client->println();
+    req->client->println();
 
-        req->client->flush();
+    req->client->flush();
 
-        char line[1024];
-        size_t read = http_read_line(req->client, line, sizeof(line));
+    PT_SPAWN(pt, &req->line_pt, http_read_line(&req->line_pt, req));
 
-        // 12 chars is enough for "HTTP/1.1 200"
-        if (read < 12 || (strncmp(line, "HTTP/1.0 ", 9) != 0 && strncmp(line, "HTTP/1.1 ", 9) != 0)) {
+    // 12 chars is enough for "HTTP/1.1 200"
+    if (req->line_len < 12 || (strncmp(req->line, "HTTP/1.0 ", 9) != 0 && strncmp(req->line, "HTTP/1.1 ", 9) != 0)) {
+        if (req->status != HTTP_STATUS_TIMEOUT) {
             req->status = HTTP_STATUS_MALFROMED_RESPONSE_LINE;
-            DBG();
-            dbg_serial.print("malformed response line: ");
-            dbg_serial.println(line);
-            http_request_disconnect(req);
-            return;
         }
+        DBG();
+        dbg_serial.print("malformed response line: ");
+        dbg_serial.println(req->line);
+        http_request_disconnect(req);
+        PT_EXIT(pt);
+    }
 
-        req->status = atoi(line + 9);
-
-        // Read headers until we read an empty line
-        do {
-            // Read headers
-            read = http_read_line(req->client, line, sizeof(line));
-            if (read > 0 && req->header_cb != NULL) {
-                char *header;
-                char *value;
-                if (!parse_header(line, &header, &value)) {
-                    req->status = HTTP_STATUS_MALFROMED_RESPONSE_HEADER;
-                    DBG();
-                    dbg_serial.print("malformed response header: ");
-                    dbg_serial.println(line);
-                    http_request_disconnect(req);
-                    return;
-                }
+    req->status = atoi(req->line + 9);
+
+    // Read headers until we read an empty line
+    do {
+        PT_SPAWN(pt, &req->line_pt, http_read_line(&req->line_pt, req));
+        if (req->line_len > 0 && req->header_cb != NULL) {
+            char *header;
+            char *value;
+            if (!parse_header(req->line, &header, &value)) {
+                req->status = HTTP_STATUS_MALFROMED_RESPONSE_HEADER;
                 DBG();
-                dbg_serial.print("header: ");
-                dbg_serial.print(header);
-                dbg_serial.print(": ");
-                dbg_serial.println(value);
-                req->header_cb(req, header, value);
+                dbg_serial.print("malformed response header: ");
+                dbg_serial.println(req->line);
+                http_request_disconnect(req);
+                PT_EXIT(pt);
             }
-        } while (read > 0);
-
-        // Now read the body
-        if (req->body_cb != NULL) {
             DBG();
-            dbg_serial.println("invoking body cb");
-            req->body_cb(req);
+            dbg_serial.print("header: ");
+            dbg_serial.print(header);
+            dbg_serial.print(": ");
+            dbg_serial.println(value);
+            req->header_cb(req, header, value);
+        }
+    } while (req->line_len > 0);
+
+    if (req->status == HTTP_STATUS_TIMEOUT) {
+        DBG();
+        dbg_serial.println("timed out");
+        http_request_disconnect(req);
+        PT_EXIT(pt);
+    }
+
+    // Now read the body as it comes
+    if (req->body_cb != NULL) {
+        DBG();
+        dbg_serial.println("invoking body cb");
+        req->deadline = millis() + HTTP_TIMEOUT_MS;
+        while (req->client->connected() || req->client->available() > 0) {
+            PT_WAIT_UNTIL(pt, http_readable(req));
+            if (req->client->available() > 0) {
+                if (!req->body_cb(req)) {
+                    break;
+                }
+                req->deadline = millis() + HTTP_TIMEOUT_MS;
+            } else if (PT_PASSED(req->deadline)) {
+                req->status = HTTP_STATUS_TIMEOUT;
+                break;
+            }
         }
     }
 
     DBG();
     dbg_serial.println("success");
     http_request_disconnect(req);
+    PT_END(pt);
 }
-
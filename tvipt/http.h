@@ -2,10 +2,19 @@
 #define _HTTP_H
 
 #include <WiFi101.h>
+#include "pt.h"
+#include "net.h"
 
 #define HTTP_STATUS_CONNECT_ERR                 -1
 #define HTTP_STATUS_MALFROMED_RESPONSE_LINE     -2
 #define HTTP_STATUS_MALFROMED_RESPONSE_HEADER   -3
+#define HTTP_STATUS_TIMEOUT                     -4
+
+// Longest response line kept; the rest of a longer one is dropped
+#define HTTP_LINE_MAX       256
+
+// Give up when the server sends nothing for this long
+#define HTTP_TIMEOUT_MS     10000
 
 enum http_method_state {
     HTTP_METHOD_NEW,
@@ -25,7 +34,9 @@ struct http_request {
 
     void (*header_cb)(struct http_request *req, const char *header, const char *value);
 
-    void (*body_cb)(struct http_request *req);
+    // Called whenever body bytes are available; returns false once it
+    // doesn't want any more
+    bool (*body_cb)(struct http_request *req);
 
     void *caller_ctx;
 
@@ -35,6 +46,15 @@ struct http_request {
 
     // Valid during callback execution
     WiFiClient *client;
+    // For net_connected()
+    int watch;
+
+    // The response line being read
+    struct pt line_pt;
+    char line[HTTP_LINE_MAX];
+    size_t line_len;
+    bool line_cr;
+    unsigned long deadline;
 };
 
 struct url_parts {
@@ -48,6 +68,8 @@ bool parse_url(struct url_parts *parts, const char *url);
 
 void http_request_init(struct http_request *req);
 
-void http_get(struct http_request *req);
+// Runs a GET, calling back with headers and body as they arrive.  A
+// protothread: it waits for the server without holding up the loop.
+PT_THREAD(http_get(struct pt *pt, struct http_request *req));
 
 #endif
@@ -1,13 +1,19 @@
 #include "keyboard_test.h"
 #include "term.h"
 
-bool keyboard_test() {
+PT_THREAD(keyboard_test(struct pt *pt)) {
+    PT_BEGIN(pt);
     term_writeln("characters you type will be described and echoed in square brackets");
     term_writeln("send break to quit");
     term_writeln("");
 
-    byte c;
-    while (term_serial.readBytes(&c, 1) > 0 && c != TERM_BREAK) {
+    while (true) {
+        PT_AWAIT_READABLE(pt, term_available());
+        int c = term_read();
+        if (c == TERM_BREAK) {
+            break;
+        }
+
         // Start a new line so the description is clear
         term_writeln("");
         term_write("hex=");
@@ -18,11 +24,10 @@ bool keyboard_test() {
         term_print(c, DEC);
         term_writeln("");
         term_write(" literal=[");
-        term_write(c);
+        term_write((char) c);
         term_writeln("]");
     }
 
     term_writeln("keyboard test finished");
-    return true;
+    PT_END(pt);
 }
-
@@ -1,6 +1,10 @@
 #ifndef _KEYBOARD_TEST_H
 #define _KEYBOARD_TEST_H
 
-bool keyboard_test();
+#include "pt.h"
+
+// Describes keys as they're typed until break; a protothread, so the rest
+// of the loop keeps running between keys.
+PT_THREAD(keyboard_test(struct pt *pt));
 
 #endif
@@ -0,0 +1,129 @@
+#include "line.h"
+#include "term.h"
+#include "screen.h"
+
+/*
+ * In block mode (ESC B) the PT keeps typed keys to itself, and with local
+ * edit (ESC k) its editing keys work on the screen too, so a line is
+ * typed and corrected without a byte crossing the link.  SEND is
+ * programmed to send the screen from home to the cursor (ESC 0 1 7), the
+ * only thing it can send short of the whole screen.  That is up to a
+ * screenful per line, but it arrives in one burst, and only the row the
+ * cursor is on is kept: rows come a screen width apiece, or end early at
+ * a CR or US (the PT's line delimiters are programmable, so either may
+ * show up).
+ *
+ * The line starts where output last left the cursor, which is where the
+ * screen model still thinks it is, so a prompt on the same row isn't sent
+ * back to the host.  The typed text never went through term_write(), so
+ * it is put into the model afterwards.
+ */
+
+// ESC B, ESC k, ESC 0 1 7
+#define LINE_ENTER              "\x1b" "B" "\x1b" "k" "\x1b" "017"
+// ESC D F (full duplex), ESC l (duplex edit)
+#define LINE_LEAVE              "\x1b" "DF" "\x1b" "l"
+
+#define CTRL_US                 0x1F
+
+// The burst is over when the terminal goes quiet this long
+#define LINE_QUIET_MS           20
+
+static bool _enabled = false;
+static bool _active = false;
+
+static struct line_stats _stats;
+
+void line_set_enabled(bool enable) {
+    _enabled = enable;
+    if (!enable) {
+        line_end();
+    }
+}
+
+bool line_enabled() {
+    return _enabled;
+}
+
+void line_begin() {
+    if (_enabled && !_active) {
+        term_write(LINE_ENTER);
+        _active = true;
+    }
+}
+
+void line_end() {
+    if (_active) {
+        term_write(LINE_LEAVE);
+        _active = false;
+    }
+}
+
+bool line_active() {
+    return _active;
+}
+
+size_t line_read(uint8_t *buf, size_t max) {
+    if (!_active || term_available() == 0) {
+        return 0;
+    }
+
+    // Keeps the cursor's row of the burst
+    char cells[SCREEN_COLS];
+    byte row = 0;
+    byte col = 0;
+    bool wrapped = false;
+
+    unsigned long last = millis();
+    while (millis() - last < LINE_QUIET_MS) {
+        int c = term_read();
+        if (c < 0) {
+            continue;
+        }
+        last = millis();
+        _stats.burst_bytes++;
+
+        if (c == TERM_RETURN || c == CTRL_US) {
+            // A delimiter right after a full row ends the same row
+            if (!wrapped) {
+                row++;
+                col = 0;
+            }
+            wrapped = false;
+            continue;
+        }
+        cells[col++] = (char) c;
+        wrapped = col == screen_cols(&screen_shown);
+        if (wrapped) {
+            row++;
+            col = 0;
+        }
+    }
+
+    byte start = row == screen_shown.row ? min(screen_shown.col, col) : 0;
+    byte end = col;
+    while (end > start && cells[end - 1] == ' ') {
+        end--;
+    }
+
+    // The terminal shows what was typed; so should the model
+    if (row < SCREEN_ROWS) {
+        memcpy(screen_shown.cells[row] + start, cells + start, col - start);
+        screen_shown.row = row;
+        screen_shown.col = col;
+    } else {
+        screen_shown.valid = false;
+    }
+
+    size_t len = min((size_t) (end - start), max - 1);
+    memcpy(buf, cells + start, len);
+    buf[len++] = TERM_RETURN;
+
+    _stats.lines++;
+    _stats.line_bytes += len;
+    return len;
+}
+
+void line_get_stats(struct line_stats *stats) {
+    *stats = _stats;
+}
@@ -0,0 +1,39 @@
+// Line mode: the PT edits a line locally in block mode and sends it when
+// SEND is pressed, so a session gets whole lines instead of single keys.
+
+#ifndef _LINE_H
+#define _LINE_H
+
+#include <Arduino.h>
+
+// Longest line returned, including the RETURN added at the end
+#define LINE_MAX                (80 + 1)
+
+struct line_stats {
+    // Lines sent with SEND, their bytes, and what the terminal sent to get
+    // them to us
+    uint32_t lines;
+    uint32_t line_bytes;
+    uint32_t burst_bytes;
+};
+
+// Whether sessions use line mode when they can
+void line_set_enabled(bool enable);
+
+bool line_enabled();
+
+// Puts the terminal in block mode (if line mode is enabled), or back.
+// Sessions call these freely; they only send anything on a change.
+void line_begin();
+
+void line_end();
+
+bool line_active();
+
+// Reads a line the terminal sent with SEND, ending in RETURN.  Returns 0
+// if none has been sent.
+size_t line_read(uint8_t *buf, size_t max);
+
+void line_get_stats(struct line_stats *stats);
+
+#endif
@@ -0,0 +1,185 @@
+#include "motion.h"
+
+/*
+ * The screen model (screen.cpp) sees every byte we send, so it knows where
+ * the cursor is and what's on the glass.  term_move() uses that to pick the
+ * cheapest way to get somewhere: ESC = r c always costs 4 bytes, but a move
+ * to the next line or a few columns over is 1-3 bytes of CR, LF, BS,
+ * CTRL K, CTRL L, CTRL ^ (home) or CTRL _ (new line).  When the model is
+ * stale we fall back to absolute addressing.
+ */
+
+static uint32_t _motion_bytes = 0;
+static uint32_t _motion_naive_bytes = 0;
+
+static bool cursor_known() {
+    return screen_shown.valid;
+}
+
+// Cost of getting from (row, col) to (to_row, to_col) with single-byte
+// cursor controls.
+static int relative_cost(int row, int col, int to_row, int to_col) {
+    return abs(to_row - row) + abs(to_col - col);
+}
+
+int motion_plan(const struct screen *s, byte row, byte col, enum motion_start *start) {
+    *start = FROM_CURSOR;
+    int best = relative_cost(s->row, s->col, row, col);
+
+    int cost = 1 + relative_cost(s->row, 0, row, col);
+    if (cost < best) {
+        best = cost;
+        *start = FROM_LEFT_MARGIN;
+    }
+
+    // CTRL _ from the last row would scroll
+    if (s->row < row) {
+        cost = 1 + relative_cost(s->row + 1, 0, row, col);
+        if (cost < best) {
+            best = cost;
+            *start = FROM_NEXT_LINE;
+        }
+    }
+
+    cost = 1 + relative_cost(0, 0, row, col);
+    if (cost < best) {
+        best = cost;
+        *start = FROM_HOME;
+    }
+
+    return best;
+}
+
+static void move_relative(byte row, byte col, enum motion_start start) {
+    struct screen *s = &screen_shown;
+
+    switch (start) {
+        case FROM_CURSOR:
+            break;
+        case FROM_LEFT_MARGIN:
+            term_write((char) TERM_RETURN);
+            break;
+        case FROM_NEXT_LINE:
+            term_write((char) TERM_NEW_LINE);
+            break;
+        case FROM_HOME:
+            term_write((char) TERM_HOME);
+            break;
+    }
+
+    while (s->row < row) {
+        term_write((char) TERM_CURSOR_DOWN);
+    }
+    while (s->row > row) {
+        term_write((char) TERM_CURSOR_UP);
+    }
+    while (s->col < col) {
+        term_write((char) TERM_CURSOR_RIGHT);
+    }
+    while (s->col > col) {
+        term_write((char) TERM_CURSOR_LEFT);
+    }
+}
+
+static void move_absolute(byte row, byte col) {
+    // ASCII 0x20 (SPACE) is row/column value 1, and subsequent ASCII values
+    // enumerate the row/column value space up to ASCII 0x6F ('o') for value
+    // 80.
+    char seq[] = {TERM_ESCAPE, TERM_MOVE_TO_POS, (char) (row + 0x20), (char) (col + 0x20)};
+    term_write(seq, sizeof(seq));
+}
+
+// Cheapest move to a 0-based position; returns the bytes it cost.
+static int move_to(byte row, byte col) {
+    enum motion_start start;
+    if (cursor_known()) {
+        int cost = motion_plan(&screen_shown, row, col, &start);
+        if (cost < MOTION_ABSOLUTE_COST) {
+            move_relative(row, col, start);
+            return cost;
+        }
+    }
+    move_absolute(row, col);
+    return MOTION_ABSOLUTE_COST;
+}
+
+static int motion_cost(byte row, byte col) {
+    enum motion_start start;
+    if (!cursor_known()) {
+        return MOTION_ABSOLUTE_COST;
+    }
+    return min(motion_plan(&screen_shown, row, col, &start), MOTION_ABSOLUTE_COST);
+}
+
+// Row is 1-24, col is 1-80 (1-40 in 40-column mode)
+void term_move(byte row, byte col) {
+    if (row < 1) { row = 1; }
+    if (row > SCREEN_ROWS) { row = SCREEN_ROWS; }
+    if (col < 1) { col = 1; }
+    if (col > term_columns()) { col = term_columns(); }
+
+    _motion_naive_bytes += MOTION_ABSOLUTE_COST;
+    _motion_bytes += move_to(row - 1, col - 1);
+}
+
+// Cells are counted from the top left, a row of cols at a time
+static bool shown_blank(size_t cols, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) {
+        if (screen_shown.cells[i / cols][i % cols] != ' ') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Erases from the cursor with ESC code and moves to (row, col); returns
+// the bytes it cost
+static int erase_to(char code, byte row, byte col) {
+    char seq[] = {TERM_ESCAPE, code};
+    term_write(seq, sizeof(seq));
+    return (int) sizeof(seq) + move_to(row, col);
+}
+
+// Writes count blanks, wrapping at the end of the row.  Blanks the terminal
+// already shows are skipped with a cursor move.  When everything after the
+// run is blank too, the run is erased instead: with ESC T if that's to the
+// end of the row, or ESC Y to the end of the screen.
+void term_pad(size_t count) {
+    struct screen *s = &screen_shown;
+
+    _motion_naive_bytes += count;
+
+    size_t cols = screen_cols(s);
+    size_t from = s->row * cols + s->col;
+    size_t to = from + count;
+    // Never onto the last cell, which would scroll
+    if (cursor_known() && to < SCREEN_ROWS * cols - 1) {
+        byte row = (byte) (to / cols);
+        byte col = (byte) (to % cols);
+
+        if (shown_blank(cols, from, to)) {
+            _motion_bytes += move_to(row, col);
+            return;
+        }
+
+        bool cheaper = (size_t) (2 + motion_cost(row, col)) < count;
+        if (cheaper && row == s->row && shown_blank(cols, to, (row + 1) * cols)) {
+            _motion_bytes += erase_to(TERM_ERASE_TO_EOL, row, col);
+            return;
+        }
+        if (cheaper && shown_blank(cols, to, SCREEN_ROWS * cols)) {
+            _motion_bytes += erase_to(TERM_ERASE_TO_EOP, row, col);
+            return;
+        }
+    }
+
+    _motion_bytes += count;
+    for (size_t i = 0; i < count; i++) {
+        term_write(' ');
+    }
+}
+
+void motion_get_stats(struct term_stats *stats) {
+    stats->motion_bytes = _motion_bytes;
+    stats->motion_naive_bytes = _motion_naive_bytes;
+}
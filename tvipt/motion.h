@@ -0,0 +1,29 @@
+// Cursor motion for term_move() and term_pad(): the cheapest bytes that get
+// the PT's cursor somewhere, from where screen_shown says it is.
+
+#ifndef _MOTION_H
+#define _MOTION_H
+
+#include <Arduino.h>
+#include "screen.h"
+#include "term.h"
+
+// ESC = r c
+#define MOTION_ABSOLUTE_COST    4
+
+// Where a relative move starts, reached with one byte unless it's the cursor
+enum motion_start {
+    FROM_CURSOR,
+    FROM_LEFT_MARGIN,
+    FROM_NEXT_LINE,
+    FROM_HOME,
+};
+
+// Cheapest way from s's cursor to a 0-based position with single-byte
+// cursor controls; returns its cost in bytes.
+int motion_plan(const struct screen *s, byte row, byte col, enum motion_start *start);
+
+// Fills in the motion_bytes and motion_naive_bytes of stats
+void motion_get_stats(struct term_stats *stats);
+
+#endif
@@ -0,0 +1,215 @@
+#include <WiFi101.h>
+
+extern "C" {
+#include "bus_wrapper/include/nm_bus_wrapper.h"
+#include "driver/include/m2m_wifi.h"
+#include "socket/include/socket.h"
+
+// Where registerSocketCallback() keeps WiFi101's socket callback (socket.c)
+extern volatile tpfAppSocketCb gpfAppSocketCb;
+
+// The bus driver's entry point, wrapped by the linker (see build.sh)
+sint8 __real_nm_bus_ioctl(uint8 cmd, void *param);
+sint8 __wrap_nm_bus_ioctl(uint8 cmd, void *param);
+}
+
+#include "net.h"
+// For its check of the WiFi101 version
+#include "wifi_shim.h"
+
+/*
+ * WiFi101 0.15.0 registers its own socket callback, which buffers received
+ * data for the clients.  Ours goes in front of it in the driver's dispatch
+ * and passes every event on, counting those that aren't send completions:
+ * data, a close (a receive of nothing), a connect.  The chip only reports
+ * through these, so a client that had no data when last asked, and has had
+ * no event since, has none now, and is as connected as it was.  Events can
+ * come during available(), connected() and read() themselves, so the count
+ * is noted before an ask rather than after.  The count isn't per socket;
+ * another socket's event just costs an ask.  connected() is also true while
+ * data is left after a close, so it's asked again once that's read.
+ *
+ * WiFi101 registers its callback again when it's initialized again, so the
+ * loop puts ours back in front, and until it has every client is pending.
+ */
+
+struct net_watch {
+    Client *client;
+    // _events when available() was last asked, and whether it found data
+    uint32_t polled;
+    bool had_data;
+    // _events when connected() was last asked, and its answer
+    uint32_t asked;
+    bool connected;
+};
+
+static struct net_watch _watches[NET_WATCH_MAX];
+
+static tpfAppSocketCb _chained = NULL;
+static uint32_t _events = 0;
+
+static struct net_stats _stats;
+
+// Counts since the start of the second, and when that was
+static uint16_t _window_events;
+static uint16_t _window_polls;
+static uint16_t _window_quiet;
+static uint16_t _window_asks;
+static uint16_t _window_skipped;
+static uint16_t _window_spi;
+static unsigned long _window_start;
+
+sint8 __wrap_nm_bus_ioctl(uint8 cmd, void *param) {
+    if (cmd == NM_BUS_IOCTL_RW) {
+        _stats.spi++;
+        _window_spi++;
+    }
+    return __real_nm_bus_ioctl(cmd, param);
+}
+
+static void socket_event(SOCKET sock, uint8 msg, void *data) {
+    if (msg != SOCKET_MSG_SEND && msg != SOCKET_MSG_SENDTO) {
+        _events++;
+        _stats.events++;
+        _window_events++;
+    }
+    _chained(sock, msg, data);
+}
+
+static bool hooked() {
+    return gpfAppSocketCb == socket_event;
+}
+
+// Goes in front of WiFi101's callback once it has registered one
+static void hook() {
+    if (hooked() || gpfAppSocketCb == NULL) {
+        return;
+    }
+    _chained = gpfAppSocketCb;
+    gpfAppSocketCb = socket_event;
+    // Whatever came before wasn't counted
+    _events++;
+}
+
+void net_init() {
+    _window_start = millis();
+    hook();
+}
+
+void net_loop() {
+    hook();
+    m2m_wifi_handle_events(NULL);
+
+    unsigned long now = millis();
+    if (now - _window_start >= 1000) {
+        _stats.events_per_sec = _window_events;
+        _stats.polls_per_sec = _window_polls;
+        _stats.quiet_per_sec = _window_quiet;
+        _stats.asks_per_sec = _window_asks;
+        _stats.skipped_per_sec = _window_skipped;
+        _stats.spi_per_sec = _window_spi;
+        _window_events = 0;
+        _window_polls = 0;
+        _window_quiet = 0;
+        _window_asks = 0;
+        _window_skipped = 0;
+        _window_spi = 0;
+        _window_start = now;
+    }
+}
+
+static struct net_watch *watched(int watch) {
+    if (watch < 0 || watch >= NET_WATCH_MAX || _watches[watch].client == NULL) {
+        return NULL;
+    }
+    return &_watches[watch];
+}
+
+static struct net_watch *find_watch(Client &client) {
+    for (int watch = 0; watch < NET_WATCH_MAX; watch++) {
+        if (_watches[watch].client == &client) {
+            return &_watches[watch];
+        }
+    }
+    return NULL;
+}
+
+int net_watch(Client &client) {
+    for (int watch = 0; watch < NET_WATCH_MAX; watch++) {
+        struct net_watch *w = &_watches[watch];
+        if (w->client == NULL) {
+            w->client = &client;
+            // Asked once before anything is taken from the last answers
+            w->polled = _events - 1;
+            w->had_data = false;
+            w->asked = _events - 1;
+            w->connected = true;
+            return watch;
+        }
+    }
+    return NET_NO_WATCH;
+}
+
+void net_unwatch(int watch) {
+    struct net_watch *w = watched(watch);
+    if (w != NULL) {
+        w->client = NULL;
+    }
+}
+
+// Whether w's last available() answer still holds
+static bool unchanged(struct net_watch *w) {
+    return w != NULL && hooked() && !w->had_data && w->polled == _events;
+}
+
+int net_available(Client &client) {
+    struct net_watch *w = find_watch(client);
+    if (unchanged(w)) {
+        _stats.quiet++;
+        _window_quiet++;
+        return 0;
+    }
+    _stats.polls++;
+    _window_polls++;
+    uint32_t events = _events;
+    int available = client.available();
+    if (available > 0) {
+        _stats.data++;
+    }
+    if (w != NULL) {
+        // connected() stays true while there's data left, so once it's
+        // gone the last answer may no longer hold
+        if (w->had_data && available <= 0) {
+            w->asked = events - 1;
+        }
+        w->polled = events;
+        w->had_data = available > 0;
+    }
+    return available;
+}
+
+bool net_pending(int watch) {
+    return !unchanged(watched(watch));
+}
+
+bool net_connected(Client &client, int watch) {
+    struct net_watch *w = watched(watch);
+    if (w != NULL && hooked() && w->asked == _events) {
+        _stats.skipped++;
+        _window_skipped++;
+        return w->connected;
+    }
+    _stats.asks++;
+    _window_asks++;
+    uint32_t events = _events;
+    bool connected = client.connected();
+    if (w != NULL) {
+        w->asked = events;
+        w->connected = connected;
+    }
+    return connected;
+}
+
+void net_get_stats(struct net_stats *stats) {
+    *stats = _stats;
+}
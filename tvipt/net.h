@@ -0,0 +1,65 @@
+// Socket bookkeeping for sessions and requests: notes the chip's socket
+// events, so clients are only asked for data or their state after one.
+
+#ifndef _NET_H
+#define _NET_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Not watched: always pending, and connected() is asked every time
+#define NET_NO_WATCH    -1
+
+// Sessions, and the weather's request
+#define NET_WATCH_MAX   4
+
+struct net_stats {
+    // Socket events from the chip other than send completions
+    uint32_t events;
+    // available() asks, and those that found data
+    uint32_t polls;
+    uint32_t data;
+    // available() answered 0 without asking, there having been no event
+    uint32_t quiet;
+    // connected() asks, and those answered from the last ask instead
+    uint32_t asks;
+    uint32_t skipped;
+    // SPI transfers to the chip (see build.sh)
+    uint32_t spi;
+    // The same over the last full second
+    uint16_t events_per_sec;
+    uint16_t polls_per_sec;
+    uint16_t quiet_per_sec;
+    uint16_t asks_per_sec;
+    uint16_t skipped_per_sec;
+    uint16_t spi_per_sec;
+};
+
+void net_init();
+
+// Has WiFi101 handle the chip's events, which only goes to the chip when
+// it has raised its interrupt, so it's cheap to call every pass.
+void net_loop();
+
+// Starts watching a connection that was just made, and returns its id, or
+// NET_NO_WATCH if NET_WATCH_MAX are watched.
+int net_watch(Client &client);
+
+// Stops watching, when the client is stopped.
+void net_unwatch(int watch);
+
+// client.available(), counted; 0 without asking for a watched client
+// that had none when last asked, if there has been no socket event since.
+int net_available(Client &client);
+
+// True if the watched client had data when last asked, or there has been a
+// socket event since.
+bool net_pending(int watch);
+
+// client.connected(), or for a watched client the last answer when there
+// has been no socket event since (a close is one).
+bool net_connected(Client &client, int watch);
+
+void net_get_stats(struct net_stats *stats);
+
+#endif
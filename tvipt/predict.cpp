@@ -0,0 +1,187 @@
+#include "predict.h"
+#include "term.h"
+#include "screen.h"
+#include "ansi.h"
+
+/*
+ * Like mosh, but for the one thing that matters on a serial terminal:
+ * characters typed at the end of what's being edited.  A printable key is
+ * drawn as soon as it's typed, remembering the cell it covered; when the
+ * server's echo arrives it matches the oldest pending key and is dropped,
+ * since it's already on the screen.  Anything else from the server while
+ * keys are pending means the guess was wrong (or the server is doing
+ * something else first), so the shown keys are erased by putting back the
+ * cells they covered and the server's output is drawn as it came.
+ *
+ * Prediction is only trusted after the server has echoed a key it wasn't
+ * shown, and that trust ends with any control key (Enter, editing keys),
+ * a wrong guess or a timeout.  So at a password prompt, where the server
+ * stops echoing without saying so, the first key is never shown and
+ * neither are the rest.
+ *
+ * Keys are only drawn when they can't scroll, wrap or land in an escape
+ * sequence: the cursor is short of the last column, on the row of the
+ * other shown keys, with no translation or alternate characters going on.
+ */
+
+// 0-based, like screen_shown
+#define LAST_COL                (screen_cols(&screen_shown) - 1)
+
+#define CTRL_DEL                0x7F
+
+struct key {
+    uint8_t c;
+    // What the key covered, and where, when shown
+    char under;
+    byte col;
+    bool shown;
+    unsigned long at;
+};
+
+// Oldest first; shown keys always come before the rest
+static struct key _keys[PREDICT_MAX];
+static byte _count = 0;
+// The row shown keys are on
+static byte _row;
+static bool _trusted = false;
+
+static predict_mode _mode = PREDICT_AUTO;
+
+static struct predict_stats _stats;
+
+static bool can_show() {
+    if (!_trusted || _mode == PREDICT_OFF) {
+        return false;
+    }
+    if (_mode == PREDICT_AUTO && _stats.echo_ms < PREDICT_SLOW_MS) {
+        return false;
+    }
+    // The echo of a key that isn't shown will land where this one would go
+    if (_count > 0 && !_keys[_count - 1].shown) {
+        return false;
+    }
+    if (!screen_shown.valid || screen_shown.alt || screen_in_sequence(&screen_shown) || !ansi_idle()) {
+        return false;
+    }
+    return screen_shown.col < LAST_COL && (_count == 0 || screen_shown.row == _row);
+}
+
+static void pop() {
+    unsigned long echo_ms = millis() - _keys[0].at;
+    _stats.echo_ms = (_stats.echo_ms * 3 + echo_ms) / 4;
+
+    _count--;
+    memmove(_keys, _keys + 1, _count * sizeof(struct key));
+}
+
+// Puts back what the shown keys covered, leaving the cursor where the
+// first of them was, and forgets them all.
+static void repair() {
+    byte shown = 0;
+    while (shown < _count && _keys[shown].shown) {
+        shown++;
+    }
+
+    if (shown > 0) {
+        term_move((byte) (_row + 1), (byte) (_keys[0].col + 1));
+        for (byte i = 0; i < shown; i++) {
+            bool alt = (_keys[i].under & SCREEN_ALT) != 0;
+            if (alt != screen_shown.alt) {
+                term_write((char) TERM_ESCAPE);
+                term_write(alt ? TERM_ENABLE_ALT_CHAR : TERM_DISABLE_ALT_CHAR);
+            }
+            term_write((char) (_keys[i].under & ~SCREEN_ALT));
+        }
+        // Keys are only shown with alternate characters off
+        if (screen_shown.alt) {
+            term_write((char) TERM_ESCAPE);
+            term_write(TERM_DISABLE_ALT_CHAR);
+        }
+        term_move((byte) (_row + 1), (byte) (_keys[0].col + 1));
+        _stats.repaired += shown;
+    }
+
+    _count = 0;
+    _trusted = false;
+}
+
+void predict_set_mode(predict_mode mode) {
+    predict_reset();
+    _mode = mode;
+}
+
+predict_mode predict_get_mode() {
+    return _mode;
+}
+
+void predict_reset() {
+    repair();
+}
+
+void predict_keys(const uint8_t *buf, size_t len) {
+    if (_mode == PREDICT_OFF) {
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = buf[i];
+        if (c < 0x20 || c >= CTRL_DEL || _count == PREDICT_MAX) {
+            // What these do to the screen is up to the server
+            _trusted = false;
+            continue;
+        }
+
+        struct key *key = &_keys[_count];
+        key->c = c;
+        key->at = millis();
+        key->shown = can_show();
+        if (key->shown) {
+            _row = screen_shown.row;
+            key->col = screen_shown.col;
+            key->under = screen_shown.cells[_row][key->col];
+            term_write((char) c);
+            _stats.shown++;
+        }
+        _count++;
+    }
+}
+
+size_t predict_echo(uint8_t *buf, size_t len) {
+    if (_count == 0) {
+        return len;
+    }
+
+    // Echoes of keys that weren't shown stay in buf
+    size_t kept = 0;
+    size_t i = 0;
+    for (; i < len && _count > 0; i++) {
+        if (buf[i] != _keys[0].c) {
+            repair();
+            break;
+        }
+        if (_keys[0].shown) {
+            _stats.confirmed++;
+        } else {
+            buf[kept++] = buf[i];
+            _trusted = true;
+        }
+        pop();
+    }
+
+    memmove(buf + kept, buf + i, len - i);
+    return kept + len - i;
+}
+
+void predict_loop() {
+    if (_count > 0 && millis() - _keys[0].at > PREDICT_TIMEOUT_MS) {
+        repair();
+    }
+}
+
+bool predict_waiting() {
+    return _count > 0;
+}
+
+void predict_get_stats(struct predict_stats *stats) {
+    *stats = _stats;
+}
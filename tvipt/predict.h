@@ -0,0 +1,59 @@
+// Predictive local echo for telnets: typed characters are drawn at once
+// and the server's echo of them is swallowed, so typing doesn't wait a
+// round trip.  Wrong guesses are erased when the server says otherwise.
+
+#ifndef _PREDICT_H
+#define _PREDICT_H
+
+#include <Arduino.h>
+
+// Keys waiting for their echo
+#define PREDICT_MAX             32
+
+// Give up on echoes that take longer than this, in ms
+#define PREDICT_TIMEOUT_MS      1000
+
+// In auto mode, only show predictions when echoes take at least this long
+#define PREDICT_SLOW_MS         30
+
+enum predict_mode {
+    PREDICT_OFF,
+    PREDICT_ON,
+    PREDICT_AUTO,
+};
+
+struct predict_stats {
+    // Keys drawn before their echo, those the echo confirmed, and guesses
+    // taken back because the server sent something else or nothing
+    uint32_t shown;
+    uint32_t confirmed;
+    uint32_t repaired;
+    // Smoothed time from key to echo, in ms
+    uint32_t echo_ms;
+};
+
+void predict_set_mode(predict_mode mode);
+
+predict_mode predict_get_mode();
+
+// Forgets pending keys (erasing any shown) for a new session, or when the
+// server stops echoing.
+void predict_reset();
+
+// Keys about to be sent to a server that echoes them.
+void predict_keys(const uint8_t *buf, size_t len);
+
+// Takes the echoes of shown keys out of data from the server (after
+// Telnet commands are removed) and returns what is left to display.
+size_t predict_echo(uint8_t *buf, size_t len);
+
+// Takes back guesses whose echo never came.
+void predict_loop();
+
+// True while keys wait for their echo, and predict_loop() has a timeout to
+// watch
+bool predict_waiting();
+
+void predict_get_stats(struct predict_stats *stats);
+
+#endif
@@ -0,0 +1,63 @@
+// Protothreads, after Adam Dunkels': functions that wait by returning, and
+// carry on from where they waited the next time they're called.  There's
+// no stack of their own, so locals don't live across a wait (keep state in
+// statics or a struct), and a protothread can't use switch itself.
+//
+//     PT_THREAD(reader(struct pt *pt)) {
+//         PT_BEGIN(pt);
+//         PT_AWAIT_READABLE(pt, term_available());
+//         ...
+//         PT_END(pt);
+//     }
+
+#ifndef _PT_H
+#define _PT_H
+
+#include <Arduino.h>
+
+struct pt {
+    unsigned short lc;
+};
+
+// What a protothread returns: still running (waiting or yielded), or done
+#define PT_WAITING      0
+#define PT_YIELDED      1
+#define PT_EXITED       2
+#define PT_ENDED        3
+
+#define PT_THREAD(decl)         char decl
+
+#define PT_INIT(pt)             ((pt)->lc = 0)
+
+#define PT_BEGIN(pt)            { char pt_yielded = 1; (void) pt_yielded; switch ((pt)->lc) { case 0:
+
+#define PT_END(pt)              } PT_INIT(pt); return PT_ENDED; }
+
+#define PT_WAIT_UNTIL(pt, cond) \
+    do { (pt)->lc = __LINE__; case __LINE__: if (!(cond)) { return PT_WAITING; } } while (0)
+
+#define PT_WAIT_WHILE(pt, cond) PT_WAIT_UNTIL(pt, !(cond))
+
+// Lets the rest of the loop run once
+#define PT_YIELD(pt) \
+    do { pt_yielded = 0; (pt)->lc = __LINE__; case __LINE__: if (!pt_yielded) { return PT_YIELDED; } } while (0)
+
+#define PT_EXIT(pt)             do { PT_INIT(pt); return PT_EXITED; } while (0)
+
+// True while the protothread call hasn't finished
+#define PT_SCHEDULE(call)       ((call) < PT_EXITED)
+
+// Runs a child protothread (started from the top) until it finishes
+#define PT_SPAWN(pt, child, call) \
+    do { PT_INIT(child); PT_WAIT_WHILE(pt, PT_SCHEDULE(call)); } while (0)
+
+// Waits until avail, a count of readable bytes such as term_available() or
+// a client's available(), is nonzero
+#define PT_AWAIT_READABLE(pt, avail)    PT_WAIT_UNTIL(pt, (avail) > 0)
+
+// True once millis() has reached deadline, across wraparound
+#define PT_PASSED(deadline)     ((long) (millis() - (deadline)) >= 0)
+
+#define PT_AWAIT_DEADLINE(pt, deadline) PT_WAIT_UNTIL(pt, PT_PASSED(deadline))
+
+#endif
@@ -0,0 +1,165 @@
+#include "relay.h"
+#include "term.h"
+
+/*
+ * Each call moves whatever is pending as one block: the amount is known up
+ * front from available() (and term_writable() for the terminal side), so
+ * there's one bulk read and one bulk write per block instead of an
+ * available()/read()/write() round per byte, and nothing at all is done
+ * when nothing is pending.  The break char is found with memchr() over the
+ * block.
+ *
+ * Session turns read the terminal first, then move one quantum from the
+ * network, sized by relay_quantum() to what the UART can drain in a time
+ * slice.  A download then never holds the loop long enough to delay keys
+ * (or the break char) by more than about a slice, however big it is.
+ */
+
+static uint8_t _buf[RELAY_BUFSIZE];
+static struct relay_stats _stats;
+
+// When relay_read_term() last looked
+static unsigned long _last_poll_us;
+
+void relay_begin() {
+    _last_poll_us = micros();
+    _stats.input_wait_max_us = 0;
+}
+
+size_t relay_quantum(size_t limit) {
+    // 10 bits a byte
+    size_t slice = (size_t) (term_baud() / 10 * RELAY_SLICE_MS / 1000);
+    size_t quantum = min(limit, min(term_writable(), max(slice, (size_t) RELAY_MIN_QUANTUM)));
+    // Don't bother with scraps of headroom
+    return quantum < RELAY_MIN_QUANTUM && quantum < limit ? 0 : quantum;
+}
+
+size_t relay_hot_key(uint8_t *buf, size_t len) {
+    const uint8_t *hot = (const uint8_t *) memchr(buf, SESSION_HOT_KEY, len);
+    if (hot == NULL) {
+        return len;
+    }
+    // The command key and whatever was typed after it are read again, the
+    // command by the session manager and the rest by whoever is in front then
+    size_t before = (size_t) (hot - buf);
+    term_unread(hot + 1, len - before - 1);
+    session_hot_key();
+    return before;
+}
+
+int relay_read_term(uint8_t *buf, size_t max, int break_char) {
+    _stats.polls++;
+    unsigned long start = micros();
+    unsigned long waited = start - _last_poll_us;
+    _last_poll_us = start;
+    if (term_available() == 0) {
+        return 0;
+    }
+
+    // Anything here arrived since the last look
+    if (waited > _stats.input_wait_max_us) {
+        _stats.input_wait_max_us = waited;
+    }
+
+    size_t len = relay_hot_key(buf, term_read(buf, max));
+    _stats.blocks++;
+    _stats.bytes_to_net += len;
+
+    if (break_char >= 0) {
+        const uint8_t *brk = (const uint8_t *) memchr(buf, break_char, len);
+        if (brk != NULL) {
+            _stats.busy_us += micros() - start;
+            return RELAY_BREAK;
+        }
+    }
+
+    _stats.busy_us += micros() - start;
+    return (int) len;
+}
+
+// Reads what client has, up to max
+static int read_available(Client &client, uint8_t *buf, size_t max) {
+    int available = net_available(client);
+    if (available <= 0) {
+        return 0;
+    }
+
+    unsigned long start = micros();
+    int got = client.read(buf, min(max, (size_t) available));
+    if (got > 0) {
+        _stats.blocks++;
+    }
+    _stats.busy_us += micros() - start;
+    return got;
+}
+
+int relay_read_net(Client &client, uint8_t *buf, size_t max) {
+    _stats.polls++;
+    size_t len = min(max, term_writable());
+    if (len == 0) {
+        return 0;
+    }
+    int got = read_available(client, buf, len);
+    if (got > 0) {
+        _stats.bytes_to_term += got;
+    }
+    return got;
+}
+
+int relay_drain_net(Client &client, uint8_t *buf, size_t max) {
+    _stats.polls++;
+    return read_available(client, buf, max);
+}
+
+int relay_read_back(Client &client, uint8_t *buf, size_t max) {
+    _stats.polls++;
+    int got = read_available(client, buf, max);
+    if (got > 0) {
+        _stats.bytes_to_backlog += got;
+    }
+    return got;
+}
+
+bool relay_term_to_net(Client &client, int break_char) {
+    int len = relay_read_term(_buf, sizeof(_buf), -1);
+    if (len <= 0) {
+        return true;
+    }
+
+    // What was typed before the break char still goes out
+    const uint8_t *brk = break_char >= 0 ? (const uint8_t *) memchr(_buf, break_char, (size_t) len) : NULL;
+    if (brk != NULL) {
+        len = (int) (brk - _buf);
+    }
+    if (len > 0) {
+        unsigned long start = micros();
+        client.write(_buf, (size_t) len);
+        _stats.busy_us += micros() - start;
+    }
+    return brk == NULL;
+}
+
+size_t relay_net_to_term(Client &client, size_t max, struct session *to) {
+    // The server keeps the rest until the terminal has shown what it sent
+    max = session_behind(to) ? 0 : relay_quantum(max);
+    size_t moved = 0;
+    while (moved < max) {
+        if (moved > 0 && term_available() > 0) {
+            _stats.yields++;
+            break;
+        }
+        int len = relay_read_net(client, _buf, min(max - moved, sizeof(_buf)));
+        if (len <= 0) {
+            break;
+        }
+        unsigned long start = micros();
+        session_output(to, _buf, (size_t) len);
+        _stats.busy_us += micros() - start;
+        moved += len;
+    }
+    return moved;
+}
+
+void relay_get_stats(struct relay_stats *stats) {
+    *stats = _stats;
+}
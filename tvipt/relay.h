@@ -0,0 +1,77 @@
+// Moves session traffic between the terminal and a network client in blocks.
+
+#ifndef _RELAY_H
+#define _RELAY_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include "net.h"
+#include "session.h"
+
+#define RELAY_BUFSIZE   128
+
+// relay_read_term() found the break char
+#define RELAY_BREAK     -1
+
+// Network turns are sized so the UART drains them in about this long,
+// which bounds how long typed keys wait behind a download
+#define RELAY_SLICE_MS      20
+#define RELAY_MIN_QUANTUM   16
+
+struct relay_stats {
+    // Reads that looked for data, and those that found some
+    uint32_t polls;
+    uint32_t blocks;
+    // Bytes read from each side
+    uint32_t bytes_to_net;
+    uint32_t bytes_to_term;
+    // Bytes read for sessions in the back
+    uint32_t bytes_to_backlog;
+    // Time spent moving blocks
+    uint32_t busy_us;
+    // Network turns cut short because keys were waiting
+    uint32_t yields;
+    // Longest typed bytes waited to be read since the session started
+    uint32_t input_wait_max_us;
+};
+
+// Starts timing input waits for a new session.
+void relay_begin();
+
+// How much of limit a network turn should move now: what the UART drains in
+// RELAY_SLICE_MS at the current baud, no more than the terminal can take,
+// and 0 if that's less than RELAY_MIN_QUANTUM.
+size_t relay_quantum(size_t limit);
+
+// Reads up to max bytes the terminal has sent.  Call this first in every
+// session turn so keys are never stuck behind network data.  Returns RELAY_BREAK if
+// break_char (or -1 for none) is among them.  Stops at SESSION_HOT_KEY.
+int relay_read_term(uint8_t *buf, size_t max, int break_char);
+
+// Cuts len typed bytes short at SESSION_HOT_KEY, if it's there, tells the
+// session manager, and puts what came after it back to be read again.
+// Returns the bytes left.
+size_t relay_hot_key(uint8_t *buf, size_t len);
+
+// Reads up to max bytes the client has received, no more than the
+// terminal can take right now.
+int relay_read_net(Client &client, uint8_t *buf, size_t max);
+
+// Reads up to max bytes the client has received, however full the terminal
+// is, for data that is going to be dropped.
+int relay_drain_net(Client &client, uint8_t *buf, size_t max);
+
+// Reads up to max bytes the client of a session in the back has received,
+// for its backlog.
+int relay_read_back(Client &client, uint8_t *buf, size_t max);
+
+// Copies from the terminal to client; false if the break char was typed.
+bool relay_term_to_net(Client &client, int break_char);
+
+// Copies up to a quantum of max bytes from client to the session in front,
+// stopping early if keys are typed.
+size_t relay_net_to_term(Client &client, size_t max, struct session *to);
+
+void relay_get_stats(struct relay_stats *stats);
+
+#endif
@@ -0,0 +1,136 @@
+#include "sched.h"
+
+/*
+ * Tasks are polled round-robin, each to completion, so a task that wants
+ * to be fair has to keep its polls short: do a quantum of work and return.
+ * The budget is a promise, not a limit; polls that break it are counted so
+ * the culprit shows up in the stats.  Time is measured around every poll,
+ * and once a second each task's share of that second is worked out.
+ */
+
+struct task {
+    void (*poll)();
+    bool (*ready)();
+    uint16_t period_ms;
+    uint16_t budget_us;
+    uint8_t flags;
+    unsigned long last_ms;
+    // Time spent in the task in the current window
+    uint32_t window_us;
+    struct sched_task_stats stats;
+};
+
+static struct task _tasks[SCHED_MAX_TASKS];
+
+// Task being polled, and when its poll started
+static int _running = -1;
+static unsigned long _running_since_us;
+
+static unsigned long _window_start;
+
+int sched_add(const char *name, void (*poll)(), bool (*ready)(), uint16_t period_ms, uint16_t budget_us,
+              uint8_t flags) {
+    for (int id = 0; id < SCHED_MAX_TASKS; id++) {
+        struct task *task = &_tasks[id];
+        if (task->poll != NULL) {
+            continue;
+        }
+        memset(task, 0, sizeof(*task));
+        task->poll = poll;
+        task->ready = ready;
+        task->period_ms = period_ms;
+        task->budget_us = budget_us;
+        task->flags = flags;
+        task->last_ms = millis() - period_ms;
+        task->stats.name = name;
+        return id;
+    }
+    return -1;
+}
+
+void sched_remove(int id) {
+    if (id >= 0 && id < SCHED_MAX_TASKS) {
+        _tasks[id].poll = NULL;
+    }
+}
+
+void sched_set_flags(int id, uint8_t flags) {
+    if (id >= 0 && id < SCHED_MAX_TASKS) {
+        _tasks[id].flags = flags;
+    }
+}
+
+static void update_shares(unsigned long now) {
+    unsigned long elapsed_us = (now - _window_start) * 1000;
+    for (int id = 0; id < SCHED_MAX_TASKS; id++) {
+        struct task *task = &_tasks[id];
+        task->stats.share = (uint16_t) ((uint64_t) task->window_us * 1000 / elapsed_us);
+        task->window_us = 0;
+    }
+    _window_start = now;
+}
+
+void sched_loop() {
+    for (int id = 0; id < SCHED_MAX_TASKS; id++) {
+        struct task *task = &_tasks[id];
+        if (task->poll == NULL) {
+            continue;
+        }
+        unsigned long now = millis();
+        if (task->period_ms > 0 && now - task->last_ms < task->period_ms) {
+            continue;
+        }
+        if (task->ready != NULL && !task->ready()) {
+            continue;
+        }
+        task->last_ms = now;
+
+        _running = id;
+        _running_since_us = micros();
+        task->poll();
+        unsigned long took = micros() - _running_since_us;
+        _running = -1;
+
+        task->window_us += took;
+        task->stats.runs++;
+        task->stats.busy_us += took;
+        if (took > task->stats.max_us) {
+            task->stats.max_us = took;
+        }
+        if (task->budget_us > 0 && took > task->budget_us) {
+            task->stats.overruns++;
+        }
+    }
+
+    unsigned long now = millis();
+    if (now - _window_start >= 1000) {
+        update_shares(now);
+    }
+}
+
+unsigned long sched_time_left_us() {
+    if (_running < 0 || _tasks[_running].budget_us == 0) {
+        return 0;
+    }
+    unsigned long used = micros() - _running_since_us;
+    return used < _tasks[_running].budget_us ? _tasks[_running].budget_us - used : 0;
+}
+
+bool sched_terminal_taken() {
+    for (int id = 0; id < SCHED_MAX_TASKS; id++) {
+        if (_tasks[id].poll != NULL && (_tasks[id].flags & SCHED_TERMINAL)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int sched_get_stats(struct sched_task_stats *stats, int max) {
+    int count = 0;
+    for (int id = 0; id < SCHED_MAX_TASKS && count < max; id++) {
+        if (_tasks[id].poll != NULL) {
+            stats[count++] = _tasks[id].stats;
+        }
+    }
+    return count;
+}
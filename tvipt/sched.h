@@ -0,0 +1,52 @@
+// A cooperative scheduler: loop() polls registered tasks in turn, so
+// background work keeps going while a session has the terminal.
+
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include <Arduino.h>
+
+#define SCHED_MAX_TASKS         8
+
+// The task reads the terminal itself; the CLI leaves keys alone while one
+// is running
+#define SCHED_TERMINAL          0x01
+
+struct sched_task_stats {
+    const char *name;
+    // Polls, and polls that ran past the task's budget
+    uint32_t runs;
+    uint32_t overruns;
+    // Time spent in the task since it was added, and its longest poll
+    uint32_t busy_us;
+    uint32_t max_us;
+    // Share of the last full second spent in the task, in tenths of a percent
+    uint16_t share;
+};
+
+// Adds a task.  poll() is called each pass when ready() (NULL for always)
+// says there's something to do, and no more often than every period_ms.
+// A poll should return within budget_us; it's only counted when it
+// doesn't.  Returns the task's id, or -1 if SCHED_MAX_TASKS are running.
+int sched_add(const char *name, void (*poll)(), bool (*ready)(), uint16_t period_ms, uint16_t budget_us,
+              uint8_t flags = 0);
+
+// Takes a task out; a task may remove itself from its poll().
+void sched_remove(int id);
+
+// Changes a task's flags, as when it takes the terminal or gives it back.
+void sched_set_flags(int id, uint8_t flags);
+
+// Runs one pass over the tasks.  loop() calls this and nothing else.
+void sched_loop();
+
+// Time the running task has left of its budget, 0 once it's used up
+unsigned long sched_time_left_us();
+
+// True while a SCHED_TERMINAL task is running
+bool sched_terminal_taken();
+
+// Fills stats with up to max tasks and returns how many it filled.
+int sched_get_stats(struct sched_task_stats *stats, int max);
+
+#endif
@@ -0,0 +1,623 @@
+#include "screen.h"
+#include "term.h"
+#include "fmt.h"
+#include "motion.h"
+
+/*
+ * screen_shown tracks the terminal by interpreting the same bytes the
+ * terminal does (see the control and escape sequence tables in term.cpp).
+ * Because it sees everything term.cpp sends, prompts, remote sessions and
+ * frames drawn here all keep it current, and a frame only has to send the
+ * cells that differ from what's already on the glass.
+ *
+ * The model assumes the terminal wraps to the next line after writing the
+ * last column (term_init() turns autowrap on) and scrolls when the cursor
+ * moves down from the last row.  In 40-column mode only the left half of
+ * the cells is used.  Switching modes, and sequences that change the
+ * layout in ways we don't model (reset, self test), mark it invalid, and
+ * the next commit clears the screen and draws everything.
+ */
+
+struct screen screen_shown;
+
+// The frame being drawn
+static char _want[SCREEN_ROWS][SCREEN_COLS];
+// Where drawing stopped; _want_row is SCREEN_ROWS once drawing runs off the bottom
+static byte _want_row = 0;
+static byte _want_col = 0;
+
+static struct screen_stats _stats;
+
+// What the terminal shows while catch-up mode is holding output
+static struct screen _held;
+// Set once screen_release() has started sending, and the next row it looks at
+static bool _releasing = false;
+static byte _release_row = 0;
+
+#define CTRL_Y          0x19
+
+// 0-based; writing the bottom-right cell would scroll the screen
+#define LAST_ROW        (SCREEN_ROWS - 1)
+#define LAST_COL(s)     (screen_cols(s) - 1)
+
+enum screen_state {
+    SS_NORMAL,
+    SS_ESC,
+    SS_MOVE_ROW,
+    SS_MOVE_COL,
+    // Skipping s->arg more parameter bytes
+    SS_SKIP,
+    // Skipping a programming string up to CTRL Y
+    SS_SKIP_TO_CTRL_Y,
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Model
+//////////////////////////////////////////////////////////////////////////////
+
+static void blank(struct screen *s, byte row, byte col, size_t count) {
+    memset(&s->cells[row][col], ' ', count);
+}
+
+static void clear(struct screen *s) {
+    memset(s->cells, ' ', sizeof(s->cells));
+    s->row = 0;
+    s->col = 0;
+    s->valid = true;
+}
+
+static void line_feed(struct screen *s) {
+    if (s->row < LAST_ROW) {
+        s->row++;
+        return;
+    }
+    memmove(s->cells[0], s->cells[1], LAST_ROW * SCREEN_COLS);
+    blank(s, LAST_ROW, 0, SCREEN_COLS);
+}
+
+// Parameter bytes that follow escape sequences we otherwise ignore
+static byte escape_params(uint8_t c) {
+    switch (c) {
+        case '.':
+        case 'D':
+        case 'Z':
+            return 1;
+        case '0':
+        case 'm':
+            return 2;
+        case 'G':
+        case 'x':
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+static void apply_escape(struct screen *s, uint8_t c) {
+    s->state = SS_NORMAL;
+
+    switch (c) {
+        case TERM_MOVE_TO_POS:
+            s->state = SS_MOVE_ROW;
+            break;
+        case TERM_ERASE_TO_EOL:
+            blank(s, s->row, s->col, SCREEN_COLS - s->col);
+            break;
+        case TERM_ERASE_TO_EOP:
+            blank(s, s->row, s->col, SCREEN_COLS - s->col);
+            if (s->row < LAST_ROW) {
+                memset(s->cells[s->row + 1], ' ', (LAST_ROW - s->row) * SCREEN_COLS);
+            }
+            break;
+        case TERM_CLEAR_TO_SPACES:
+        case '*':
+            clear(s);
+            break;
+        case 'E':
+            memmove(s->cells[s->row + 1], s->cells[s->row], (LAST_ROW - s->row) * SCREEN_COLS);
+            blank(s, s->row, 0, SCREEN_COLS);
+            s->col = 0;
+            break;
+        case 'R':
+            memmove(s->cells[s->row], s->cells[s->row + 1], (LAST_ROW - s->row) * SCREEN_COLS);
+            blank(s, LAST_ROW, 0, SCREEN_COLS);
+            s->col = 0;
+            break;
+        case TERM_ENABLE_ALT_CHAR:
+            s->alt = true;
+            break;
+        case TERM_DISABLE_ALT_CHAR:
+            s->alt = false;
+            break;
+        case 'I':
+            s->col = s->col == 0 ? 0 : (byte) (((s->col - 1) / 8) * 8);
+            break;
+        case '|':
+        case ']':
+            s->state = SS_SKIP_TO_CTRL_Y;
+            break;
+        case 'p':
+            s->narrow = true;
+            s->valid = false;
+            break;
+        case 'u':
+            s->narrow = false;
+            s->valid = false;
+            break;
+        case 'V':
+        case '~':
+            s->valid = false;
+            break;
+        default:
+            s->arg = escape_params(c);
+            if (s->arg > 0) {
+                s->state = SS_SKIP;
+            }
+            break;
+    }
+}
+
+void screen_reset(struct screen *s) {
+    clear(s);
+    s->state = SS_NORMAL;
+    s->alt = false;
+}
+
+byte screen_cols(const struct screen *s) {
+    return s->narrow ? SCREEN_NARROW_COLS : SCREEN_COLS;
+}
+
+bool screen_in_sequence(const struct screen *s) {
+    return s->state != SS_NORMAL;
+}
+
+void screen_apply(struct screen *s, uint8_t c) {
+    switch (s->state) {
+        case SS_NORMAL:
+            break;
+        case SS_ESC:
+            apply_escape(s, c);
+            return;
+        case SS_MOVE_ROW:
+            s->arg = c;
+            s->state = SS_MOVE_COL;
+            return;
+        case SS_MOVE_COL:
+            s->row = (byte) min(max(s->arg - 0x20, 0), LAST_ROW);
+            s->col = (byte) min(max(c - 0x20, 0), LAST_COL(s));
+            s->state = SS_NORMAL;
+            return;
+        case SS_SKIP:
+            if (--s->arg == 0) {
+                s->state = SS_NORMAL;
+            }
+            return;
+        case SS_SKIP_TO_CTRL_Y:
+            if (c == CTRL_Y) {
+                s->state = SS_NORMAL;
+            }
+            return;
+    }
+
+    if (c >= 0x20 && c < 0x7F) {
+        s->cells[s->row][s->col] = s->alt ? (char) (c | SCREEN_ALT) : (char) c;
+        if (++s->col == screen_cols(s)) {
+            s->col = 0;
+            line_feed(s);
+        }
+        return;
+    }
+
+    switch (c) {
+        case TERM_CURSOR_LEFT:
+            if (s->col > 0) {
+                s->col--;
+            }
+            break;
+        case '\t':
+            s->col = (byte) min((s->col / 8 + 1) * 8, LAST_COL(s));
+            break;
+        case TERM_CURSOR_DOWN:
+            line_feed(s);
+            break;
+        case TERM_CURSOR_UP:
+            if (s->row > 0) {
+                s->row--;
+            }
+            break;
+        case TERM_CURSOR_RIGHT:
+            if (s->col < LAST_COL(s)) {
+                s->col++;
+            }
+            break;
+        case TERM_RETURN:
+            s->col = 0;
+            break;
+        case TERM_CLEAR:
+            clear(s);
+            break;
+        case TERM_ESCAPE:
+            s->state = SS_ESC;
+            break;
+        case TERM_HOME:
+            s->row = 0;
+            s->col = 0;
+            break;
+        case TERM_NEW_LINE:
+            s->col = 0;
+            line_feed(s);
+            break;
+        default:
+            break;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame Drawing
+//////////////////////////////////////////////////////////////////////////////
+
+void screen_begin() {
+    memset(_want, ' ', sizeof(_want));
+    _want_row = 0;
+    _want_col = 0;
+}
+
+void screen_move(byte row, byte col) {
+    _want_row = (byte) (constrain(row, 1, SCREEN_ROWS) - 1);
+    _want_col = (byte) (constrain(col, 1, screen_cols(&screen_shown)) - 1);
+}
+
+void screen_write(const char c) {
+    if (_want_row >= SCREEN_ROWS) {
+        return;
+    }
+
+    if (c == '\r') {
+        _want_col = 0;
+    } else if (c == '\n') {
+        _want_row++;
+    } else {
+        _want[_want_row][_want_col] = c;
+        if (++_want_col == screen_cols(&screen_shown)) {
+            _want_col = 0;
+            _want_row++;
+        }
+    }
+}
+
+void screen_write(const char *val) {
+    while (*val != '\0') {
+        screen_write(*val++);
+    }
+}
+
+void screen_write(const char *val, size_t width) {
+    const char *end = val + width;
+    while (val < end && *val != '\0') {
+        screen_write(*val++);
+    }
+}
+
+void screen_writeln(const char *val) {
+    screen_write(val);
+    screen_writeln();
+}
+
+void screen_writeln() {
+    screen_write("\r\n");
+}
+
+void screen_print(long val, int format) {
+    char buf[8 * sizeof(long) + 2];
+    screen_write(ltoa(val, buf, format));
+}
+
+static void printf_flush(struct fmt_out *out) {
+    screen_write(out->buf, out->len);
+    out->len = 0;
+}
+
+void screen_printf(const char *format, ...) {
+    char buf[SCREEN_COLS];
+    struct fmt_out out;
+    fmt_init(&out, buf, sizeof(buf), printf_flush);
+
+    va_list args;
+    va_start(args, format);
+    fmt_vformat(&out, format, args);
+    va_end(args);
+
+    printf_flush(&out);
+}
+
+void screen_print(byte row, byte col, const char *value, size_t width) {
+    screen_move(row, col);
+    if (width > 0) {
+        screen_write(value, width);
+    } else {
+        screen_write(value);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Rendering
+//////////////////////////////////////////////////////////////////////////////
+
+static void emit_escape(const char c) {
+    char seq[] = {TERM_ESCAPE, c};
+    term_write(seq, sizeof(seq));
+}
+
+static void emit_cell(char c) {
+    if (c & SCREEN_ALT) {
+        emit_escape(TERM_ENABLE_ALT_CHAR);
+        term_write((char) (c & ~SCREEN_ALT));
+        emit_escape(TERM_DISABLE_ALT_CHAR);
+    } else {
+        term_write(c);
+    }
+}
+
+// term_move() picks the cheapest motion from wherever the cursor is
+static void move_to(byte row, byte col) {
+    if (screen_shown.row != row || screen_shown.col != col) {
+        term_move(row + 1, col + 1);
+    }
+}
+
+static uint32_t bytes_sent() {
+    struct term_stats stats;
+    term_get_stats(&stats);
+    return stats.tx_bytes;
+}
+
+static int last_nonblank(const char *cells) {
+    int col = SCREEN_COLS - 1;
+    while (col >= 0 && cells[col] == ' ') {
+        col--;
+    }
+    return col;
+}
+
+static void commit_row(byte row) {
+    const char *want = _want[row];
+    const char *shown = screen_shown.cells[row];
+
+    int want_last = last_nonblank(want);
+    int shown_last = last_nonblank(shown);
+    int end = max(want_last, shown_last);
+
+    // Erase a stale tail with ESC T when that beats overwriting it with spaces
+    bool erase_tail = false;
+    if (shown_last > want_last) {
+        int stale = 0;
+        for (int col = want_last + 1; col <= shown_last; col++) {
+            if (shown[col] != ' ') {
+                stale++;
+            }
+        }
+        if (stale > 2) {
+            erase_tail = true;
+            end = want_last;
+        }
+    }
+
+    for (int col = 0; col <= end; col++) {
+        if (want[col] == shown[col] || (row == LAST_ROW && col == LAST_COL(&screen_shown))) {
+            continue;
+        }
+        move_to(row, (byte) col);
+        emit_cell(want[col]);
+    }
+
+    if (erase_tail) {
+        move_to(row, (byte) (want_last + 1));
+        emit_escape(TERM_ERASE_TO_EOL);
+    }
+}
+
+size_t screen_commit() {
+    struct screen *s = &screen_shown;
+    uint32_t start_bytes = bytes_sent();
+
+    if (s->alt) {
+        emit_escape(TERM_DISABLE_ALT_CHAR);
+    }
+
+    // What the old way (clear, then address and write every line) would cost
+    uint32_t full_bytes = 1;
+    int changed = 0;
+    int drawn = 0;
+    for (byte row = 0; row < SCREEN_ROWS; row++) {
+        int last = last_nonblank(_want[row]);
+        if (last >= 0) {
+            // ESC = r c and the line
+            full_bytes += 4 + last + 1;
+        }
+        for (byte col = 0; col < SCREEN_COLS; col++) {
+            if (_want[row][col] != ' ') {
+                drawn++;
+            }
+            if (_want[row][col] != s->cells[row][col]) {
+                changed++;
+            }
+        }
+    }
+
+    // Start over when the model is stale or most of the screen changed
+    if (!s->valid || changed > drawn) {
+        term_write((char) TERM_CLEAR);
+    }
+
+    // Rows from blank_from down are empty in the new frame
+    byte blank_from = SCREEN_ROWS;
+    while (blank_from > 0 && last_nonblank(_want[blank_from - 1]) < 0) {
+        blank_from--;
+    }
+
+    for (byte row = 0; row < SCREEN_ROWS; row++) {
+        if (row == blank_from) {
+            int stale = 0;
+            for (byte r = row; r < SCREEN_ROWS; r++) {
+                for (byte col = 0; col < SCREEN_COLS; col++) {
+                    if (s->cells[r][col] != ' ') {
+                        stale++;
+                    }
+                }
+            }
+            if (stale > 2) {
+                move_to(row, 0);
+                emit_escape(TERM_ERASE_TO_EOP);
+                break;
+            }
+        }
+        commit_row(row);
+    }
+
+    if (_want_row < SCREEN_ROWS) {
+        move_to(_want_row, _want_col);
+    }
+
+    uint32_t commit_bytes = bytes_sent() - start_bytes;
+
+    _stats.commits++;
+    _stats.last_bytes = commit_bytes;
+    _stats.last_full_bytes = full_bytes;
+    _stats.total_bytes += commit_bytes;
+    _stats.total_full_bytes += full_bytes;
+
+    return commit_bytes;
+}
+
+void screen_hold() {
+    _held = screen_shown;
+    _releasing = false;
+}
+
+// Most that commit_row() can send for row: a move and a cell (with the
+// alternate set switched on and off around it) for each changed run, and
+// ESC T
+static size_t row_cost(byte row) {
+    size_t cost = MOTION_ABSOLUTE_COST + 2;
+    bool run = false;
+    for (byte col = 0; col < SCREEN_COLS; col++) {
+        if (_want[row][col] == screen_shown.cells[row][col]) {
+            run = false;
+            continue;
+        }
+        cost += (run ? 0 : MOTION_ABSOLUTE_COST) + (_want[row][col] & SCREEN_ALT ? 5 : 1);
+        run = true;
+    }
+    return cost;
+}
+
+// Whether the terminal has row as drawn; the bottom-right cell is never written
+static bool row_matches(byte row) {
+    size_t len = row == LAST_ROW ? LAST_COL(&screen_shown) : SCREEN_COLS;
+    return memcmp(_want[row], screen_shown.cells[row], len) == 0;
+}
+
+// Sends row if it's stale and fits in what's left of room; the first row
+// sent goes out whatever it costs.  Returns false if it didn't fit.
+static bool release_row(byte row, uint32_t start, size_t room) {
+    if (row_matches(row)) {
+        return true;
+    }
+    uint32_t sent = bytes_sent() - start;
+    if (sent > 0 && sent + row_cost(row) > room) {
+        return false;
+    }
+    commit_row(row);
+    return true;
+}
+
+bool screen_release(size_t room) {
+    // screen_shown stands for the terminal while rows go out, and the
+    // latest cells wait in _want
+    struct screen *s = &screen_shown;
+    byte row = s->row;
+    byte col = s->col;
+    byte state = s->state;
+    byte arg = s->arg;
+    bool alt = s->alt;
+    bool narrow = s->narrow;
+    bool valid = s->valid;
+    memcpy(_want, s->cells, sizeof(_want));
+    screen_shown = _held;
+
+    uint32_t start = bytes_sent();
+    if (!_releasing) {
+        _releasing = true;
+        _release_row = 0;
+        if (s->alt) {
+            emit_escape(TERM_DISABLE_ALT_CHAR);
+        }
+        int changed = 0;
+        int drawn = 0;
+        for (byte r = 0; r < SCREEN_ROWS; r++) {
+            for (byte c = 0; c < SCREEN_COLS; c++) {
+                drawn += _want[r][c] != ' ';
+                changed += _want[r][c] != s->cells[r][c];
+            }
+        }
+        if (!s->valid || changed > drawn) {
+            term_write((char) TERM_CLEAR);
+        }
+    }
+
+    // The cursor's row first, where a typed key's echo shows, then the rest
+    // in turn from where the last pass stopped
+    bool fits = room > 0 && release_row(row, start, room);
+    for (byte n = 0; fits && n < SCREEN_ROWS; n++) {
+        fits = release_row(_release_row, start, room);
+        if (fits) {
+            _release_row = (byte) ((_release_row + 1) % SCREEN_ROWS);
+        }
+    }
+
+    bool done = fits;
+    for (byte r = 0; done && r < SCREEN_ROWS; r++) {
+        done = row_matches(r);
+    }
+    if (done) {
+        move_to(row, col);
+        if (alt) {
+            emit_escape(TERM_ENABLE_ALT_CHAR);
+        }
+        _releasing = false;
+    } else {
+        _held = screen_shown;
+        memcpy(s->cells, _want, sizeof(_want));
+        s->row = row;
+        s->col = col;
+        s->alt = alt;
+        s->narrow = narrow;
+        s->valid = valid;
+    }
+    s->state = state;
+    s->arg = arg;
+    return done;
+}
+
+void screen_rewind() {
+    screen_shown = _held;
+}
+
+void screen_redraw() {
+    _releasing = false;
+    memcpy(_want, screen_shown.cells, sizeof(_want));
+    _want_row = screen_shown.row;
+    _want_col = screen_shown.col;
+    bool alt = screen_shown.alt;
+
+    screen_shown.state = SS_NORMAL;
+    screen_shown.valid = false;
+    screen_commit();
+    if (alt) {
+        emit_escape(TERM_ENABLE_ALT_CHAR);
+    }
+}
+
+void screen_get_stats(struct screen_stats *stats) {
+    *stats = _stats;
+}
@@ -0,0 +1,100 @@
+// A model of what the TeleVideo Personal Terminal is showing, and a renderer
+// that redraws the terminal by sending only the cells that changed.
+
+#ifndef _SCREEN_H
+#define _SCREEN_H
+
+#include <Arduino.h>
+
+#define SCREEN_ROWS     24
+#define SCREEN_COLS     80
+// Columns in 40-column mode (ESC p)
+#define SCREEN_NARROW_COLS  40
+
+// Cells drawn from the alternate character set have this bit set
+#define SCREEN_ALT      0x80
+
+struct screen {
+    char cells[SCREEN_ROWS][SCREEN_COLS];
+    // Cursor position, 0-based
+    byte row;
+    byte col;
+    // Escape sequence parser state
+    byte state;
+    byte arg;
+    bool alt;
+    // In 40-column mode; cells past the 40th stay blank
+    bool narrow;
+    // False when the terminal may show something the model doesn't know about
+    bool valid;
+};
+
+struct screen_stats {
+    uint32_t commits;
+    // Bytes the last commit sent, and what a full clear-and-redraw would have sent
+    uint32_t last_bytes;
+    uint32_t last_full_bytes;
+    uint32_t total_bytes;
+    uint32_t total_full_bytes;
+};
+
+// What the terminal is displaying.  term.cpp feeds it every byte it sends.
+extern struct screen screen_shown;
+
+void screen_reset(struct screen *s);
+
+void screen_apply(struct screen *s, uint8_t c);
+
+// Columns s wraps at: SCREEN_COLS, or SCREEN_NARROW_COLS in 40-column mode
+byte screen_cols(const struct screen *s);
+
+// True in the middle of an escape sequence
+bool screen_in_sequence(const struct screen *s);
+
+// Catch-up mode (see catchup.cpp): screen_hold() remembers what the
+// terminal shows, after which screen_shown runs ahead of it.
+// screen_release() sends the rows that differ, as many as fit in room
+// bytes (and always one), and returns true once they're back together;
+// screen_rewind() just puts screen_shown back, for output that will be
+// sent after all.
+void screen_hold();
+
+bool screen_release(size_t room);
+
+void screen_rewind();
+
+// Clears the terminal and draws screen_shown again, for when the terminal
+// may show something else
+void screen_redraw();
+
+// Drawing a frame: screen_begin() starts from a blank screen, the screen_*
+// calls below draw into it (row and col are 1-based like term_move), and
+// screen_commit() updates the terminal with the difference and leaves the
+// cursor where drawing stopped.
+
+void screen_begin();
+
+void screen_move(byte row, byte col);
+
+void screen_write(const char c);
+
+void screen_write(const char *val);
+
+void screen_write(const char *val, size_t width);
+
+void screen_writeln(const char *val);
+
+void screen_writeln();
+
+void screen_print(long val, int format = DEC);
+
+// Formats (see fmt.h) into the frame
+void screen_printf(const char *format, ...);
+
+void screen_print(byte row, byte col, const char *value, size_t width = 0);
+
+size_t screen_commit();
+
+void screen_get_stats(struct screen_stats *stats);
+
+#endif
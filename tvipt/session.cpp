@@ -0,0 +1,367 @@
+#include "session.h"
+#include "sched.h"
+#include "relay.h"
+#include "term.h"
+#include "screen.h"
+#include "util.h"
+
+/*
+ * All sessions are polled by one task, which holds the terminal
+ * (SCHED_TERMINAL) while one of them is in front.  Everything a session
+ * outputs goes into its backlog, a ring of the latest SESSION_BACKLOG
+ * bytes, and to the terminal too when it's in front.  Drawing never waits
+ * for the terminal: what it has no room for stays in the backlog, counted
+ * by unshown, and is drawn on later turns.  Coming back to a
+ * session clears the screen and draws its backlog from the start of the
+ * last SCREEN_ROWS lines, all the screen could show anyway, or from the
+ * first whole line the ring still has.  That starts
+ * full-screen programs in the middle of their output, so they may want
+ * their own redraw (usually ^L).  The same happens to the session in front
+ * when its output comes faster than the terminal takes it, for longer than
+ * the backlog holds.
+ *
+ * The backlogs are static, so the budget is fixed at SESSION_MAX of them;
+ * connections (mostly the WiFi101 client's buffer) are allocated while
+ * they're open.
+ */
+
+struct session {
+    // NULL when the slot is free
+    const struct session_ops *ops;
+    void *ctx;
+    char name[SESSION_NAME_MAX];
+    uint32_t bytes;
+    // The latest output: len bytes, ending just before head
+    uint8_t backlog[SESSION_BACKLOG];
+    uint16_t head;
+    uint16_t len;
+    // Bytes at the end of the backlog not drawn yet
+    uint16_t unshown;
+};
+
+static struct session _sessions[SESSION_MAX];
+static struct session *_front = NULL;
+static int _task = -1;
+
+// The hot key was typed, and its command is the next key
+static bool _hot = false;
+
+static struct session_stats _stats;
+
+extern "C" char *sbrk(int incr);
+
+// Between the top of the heap and the stack
+static size_t free_bytes() {
+    char top;
+    return (size_t) (&top - sbrk(0));
+}
+
+bool session_can_open() {
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if (_sessions[i].ops == NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool session_front(struct session *s) {
+    return s != NULL && s == _front;
+}
+
+bool session_behind(struct session *s) {
+    return s->unshown > 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Backlog
+//////////////////////////////////////////////////////////////////////////////
+
+static void restart(struct session *s);
+
+void session_output(struct session *s, const uint8_t *buf, size_t len) {
+    s->bytes += len;
+
+    // Only the newest SESSION_BACKLOG bytes are kept
+    const uint8_t *src = buf;
+    size_t left = len;
+    if (left > SESSION_BACKLOG) {
+        src += left - SESSION_BACKLOG;
+        left = SESSION_BACKLOG;
+    }
+    s->len = (uint16_t) min((size_t) SESSION_BACKLOG, s->len + left);
+    while (left > 0) {
+        size_t chunk = min(left, (size_t) (SESSION_BACKLOG - s->head));
+        memcpy(s->backlog + s->head, src, chunk);
+        s->head = (uint16_t) ((s->head + chunk) % SESSION_BACKLOG);
+        src += chunk;
+        left -= chunk;
+    }
+
+    if (s != _front) {
+        return;
+    }
+    // Nothing overtakes output that is still waiting
+    size_t unshown = s->unshown + len;
+    if (s->unshown == 0) {
+        unshown -= s->ops->render(buf, len);
+    }
+    if (unshown > s->len) {
+        restart(s);
+        return;
+    }
+    s->unshown = (uint16_t) unshown;
+}
+
+static bool is_line_end(uint8_t c) {
+    return c == '\r' || c == '\n';
+}
+
+// Index in the ring of the i'th oldest byte kept
+static uint16_t backlog_index(struct session *s, uint16_t i) {
+    return (uint16_t) ((s->head + SESSION_BACKLOG - s->len + i) % SESSION_BACKLOG);
+}
+
+// Draws what it can of the output still waiting
+static void show(struct session *s) {
+    while (s->unshown > 0) {
+        uint16_t from = backlog_index(s, (uint16_t) (s->len - s->unshown));
+        size_t chunk = min((size_t) s->unshown, (size_t) (SESSION_BACKLOG - from));
+        size_t shown = s->ops->render(s->backlog + from, chunk);
+        s->unshown = (uint16_t) (s->unshown - shown);
+        if (shown < chunk) {
+            return;
+        }
+    }
+}
+
+// Draws the tail of the backlog that fits on the screen
+static void replay(struct session *s) {
+    uint16_t start = s->len;
+    int lines = 0;
+    while (start > 0) {
+        if (s->backlog[backlog_index(s, start - 1)] == '\n' && ++lines == SCREEN_ROWS) {
+            break;
+        }
+        start--;
+    }
+
+    // Where older output was dropped the first line is cut, maybe in the
+    // middle of an escape sequence, so start after it
+    if (start == 0 && s->bytes > s->len) {
+        while (start < s->len && !is_line_end(s->backlog[backlog_index(s, start)])) {
+            start++;
+        }
+        while (start < s->len && is_line_end(s->backlog[backlog_index(s, start)])) {
+            start++;
+        }
+    }
+
+    s->unshown = (uint16_t) (s->len - start);
+    show(s);
+}
+
+// When output waiting to be drawn has been dropped from the backlog, what's
+// left starts in the middle of a line, maybe of a sequence, and whatever
+// the session's render was in the middle of is gone.  So the session starts
+// drawing afresh, as when it comes back to the front.
+static void restart(struct session *s) {
+    _stats.restarts++;
+    s->ops->focus(s->ctx, true);
+    term_clear();
+    replay(s);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Switching
+//////////////////////////////////////////////////////////////////////////////
+
+// Gives the terminal back to the command line
+static void to_back() {
+    if (_front == NULL) {
+        return;
+    }
+    _front->ops->focus(_front->ctx, false);
+    _front = NULL;
+    sched_set_flags(_task, 0);
+}
+
+static void to_front(struct session *s, bool redraw) {
+    if (s == _front) {
+        return;
+    }
+    to_back();
+    _front = s;
+    s->ops->focus(s->ctx, true);
+    sched_set_flags(_task, SCHED_TERMINAL);
+    _stats.switches++;
+    if (redraw) {
+        term_clear();
+        replay(s);
+    }
+}
+
+bool session_resume(int n) {
+    if (n < 1 || n > SESSION_MAX || _sessions[n - 1].ops == NULL) {
+        return false;
+    }
+    to_front(&_sessions[n - 1], true);
+    return true;
+}
+
+// The session after the one in front, or the first
+static int next_session() {
+    int from = _front != NULL ? (int) (_front - _sessions) + 1 : 0;
+    for (int i = 0; i < SESSION_MAX; i++) {
+        int n = (from + i) % SESSION_MAX;
+        if (_sessions[n].ops != NULL) {
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static void hot_key_command(int c) {
+    if (c >= '1' && c < '1' + SESSION_MAX && session_resume(c - '0')) {
+        return;
+    }
+    if (c == 'n' && session_resume(next_session())) {
+        return;
+    }
+    if (c == 'c') {
+        to_back();
+        term_writeln();
+        return;
+    }
+    // Not something we know
+    term_write((char) 0x07);
+}
+
+void session_hot_key() {
+    // Acted on between polls, never while a session is in the middle of one
+    _hot = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Polling
+//////////////////////////////////////////////////////////////////////////////
+
+static void close_session(struct session *s) {
+    bool front = s == _front;
+    if (front) {
+        to_back();
+    }
+    s->ops->close(s->ctx);
+    s->ops = NULL;
+    _stats.open--;
+
+    // Back to the command line, whatever else is open
+    if (front) {
+        _hot = false;
+        term_writeln();
+        term_writeln("connection closed");
+    }
+    if (_stats.open == 0) {
+        sched_remove(_task);
+        _task = -1;
+    }
+}
+
+// Keys, the hot key and output still to draw are seen to here; anything
+// else is up to each session
+static bool sessions_ready() {
+    if (_hot || term_available() > 0 || (_front != NULL && _front->unshown > 0)) {
+        return true;
+    }
+    for (int i = 0; i < SESSION_MAX; i++) {
+        struct session *s = &_sessions[i];
+        if (s->ops != NULL && (s->ops->ready == NULL || s->ops->ready(s->ctx))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void sessions_loop() {
+    if (_front != NULL) {
+        show(_front);
+    }
+
+    // Keys typed after the command are left for the session in front then
+    if (_hot) {
+        int c = term_read();
+        if (c >= 0) {
+            _hot = false;
+            hot_key_command(c);
+        }
+    }
+
+    for (int i = 0; i < SESSION_MAX; i++) {
+        struct session *s = &_sessions[i];
+        if (s->ops != NULL && !s->ops->poll(s->ctx, s == _front && !_hot)) {
+            close_session(s);
+        }
+    }
+}
+
+struct session *session_open(const char *name, const struct session_ops *ops, void *ctx) {
+    struct session *s = NULL;
+    for (int i = 0; i < SESSION_MAX && s == NULL; i++) {
+        if (_sessions[i].ops == NULL) {
+            s = &_sessions[i];
+        }
+    }
+    if (s == NULL) {
+        return NULL;
+    }
+
+    if (_task < 0) {
+        _task = sched_add("sessions", sessions_loop, sessions_ready, 0, RELAY_SLICE_MS * 1000U);
+        if (_task < 0) {
+            return NULL;
+        }
+    }
+
+    s->ops = ops;
+    s->ctx = ctx;
+    scopy(s->name, name, sizeof(s->name));
+    s->bytes = 0;
+    s->head = 0;
+    s->len = 0;
+    s->unshown = 0;
+    _stats.open++;
+    _stats.opens++;
+
+    to_front(s, false);
+    return s;
+}
+
+int session_list(struct session_info *info, int max) {
+    int count = 0;
+    for (int i = 0; i < SESSION_MAX && count < max; i++) {
+        struct session *s = &_sessions[i];
+        if (s->ops == NULL) {
+            continue;
+        }
+        info[count].number = (uint8_t) (i + 1);
+        scopy(info[count].name, s->name, sizeof(info[count].name));
+        info[count].front = s == _front;
+        info[count].size = s->ops->size;
+        info[count].bytes = s->bytes;
+        info[count].backlog = s->len;
+        count++;
+    }
+    return count;
+}
+
+void session_get_stats(struct session_stats *stats) {
+    *stats = _stats;
+    stats->backlog_bytes = sizeof(_sessions);
+    stats->connection_bytes = 0;
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if (_sessions[i].ops != NULL) {
+            stats->connection_bytes += _sessions[i].ops->size;
+        }
+    }
+    stats->free_bytes = free_bytes();
+}
@@ -0,0 +1,105 @@
+// Sessions: connections that stay open while another has the terminal.
+// The one in front reads keys and draws; the rest keep receiving into a
+// backlog, whose tail is drawn again when they come back to the front.
+
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include <Arduino.h>
+
+// Open at once.  With the weather's connection that's 4 of the ATWINC1500's
+// 7 TCP sockets; telnets sessions are also held to BUSYBOX_SESSIONS.
+#define SESSION_MAX         3
+
+// Output kept for each session, a screen's worth of plain text
+#define SESSION_BACKLOG     1024
+
+#define SESSION_NAME_MAX    24
+
+// Typed in a session (CTRL-\), it's followed by: 1 to SESSION_MAX for that
+// session, n for the next one, or c for the command line.  Sessions never
+// see it.
+#define SESSION_HOT_KEY     0x1c
+
+struct session_ops {
+    // Memory the connection takes while it's open, for the stats
+    size_t size;
+
+    // One turn.  Typed keys go to the server when keys is true; what comes
+    // back goes to session_output().  Returns false once the connection has
+    // closed.
+    bool (*poll)(void *ctx, bool keys);
+
+    // True when a turn has work besides keys and drawing, which the session
+    // manager looks for itself: news from the server, or something timed.
+    // NULL to take a turn on every pass.
+    bool (*ready)(void *ctx);
+
+    // Draws as much output as the terminal has room for without waiting and
+    // returns how much that was; the rest is offered again next turn
+    size_t (*render)(const uint8_t *buf, size_t len);
+
+    // The session comes to the front (before its backlog is drawn again)
+    // or goes to the back.  Also called while it's in front, when it has
+    // fallen so far behind that its backlog is drawn again.
+    void (*focus)(void *ctx, bool front);
+
+    // Closes the connection and frees it
+    void (*close)(void *ctx);
+};
+
+struct session;
+
+struct session_info {
+    // What the hot key and session_resume() know it as
+    uint8_t number;
+    char name[SESSION_NAME_MAX];
+    bool front;
+    size_t size;
+    // Output since it opened, and how much of the backlog is filled
+    uint32_t bytes;
+    uint16_t backlog;
+};
+
+struct session_stats {
+    uint8_t open;
+    // Sessions opened and switched to since boot
+    uint32_t opens;
+    uint32_t switches;
+    // Times the session in front fell a backlog behind and was drawn again
+    uint32_t restarts;
+    // Memory held for backlogs, taken by open connections, and free
+    size_t backlog_bytes;
+    size_t connection_bytes;
+    size_t free_bytes;
+};
+
+// True if another session can be opened; check before connecting.
+bool session_can_open();
+
+// Adds a connection as a session and brings it to the front.  NULL if
+// SESSION_MAX are open.
+struct session *session_open(const char *name, const struct session_ops *ops, void *ctx);
+
+// Keeps what a session received and, when it's in front, draws it.
+void session_output(struct session *s, const uint8_t *buf, size_t len);
+
+bool session_front(struct session *s);
+
+// True while output of the session in front is still waiting to be drawn;
+// it shouldn't read more from the network until it's caught up.
+bool session_behind(struct session *s);
+
+// Brings session n (from 1) to the front; false if it isn't open.
+bool session_resume(int n);
+
+// The hot key was typed; the key after it is the next one term_read() gives.
+void session_hot_key();
+
+// Fills info with up to max sessions, numbered from 1 in order, and returns
+// how many.
+int session_list(struct session_info *info, int max);
+
+void session_get_stats(struct session_stats *stats);
+
+#endif
@@ -1,30 +1,100 @@
 #include "tcp.h"
 #include "wifi.h"
 #include "term.h"
-#include "util.h"
+#include "relay.h"
+#include "line.h"
+#include "net.h"
+#include "session.h"
+#include "fmt.h"
 
 #define TCP_COPY_LIMIT 512
 #define BREAK_CHAR '\0'
 
-static WiFiClient _client;
+// One per session, allocated while it's open
+struct tcp_conn {
+    WiFiClient client;
+    int watch;
+    struct session *session;
+};
 
-void tcp_loop_cb() {
-    if (_client.connected()) {
-        if (stream_copy_breakable(term_serial, _client, TCP_COPY_LIMIT, BREAK_CHAR)) {
-            // User wants to stop connection
-            _client.stop();
-            return;
+static uint8_t _buf[RELAY_BUFSIZE];
+
+// A line from line mode goes out in one write; false if it has the break char
+static bool line_to_net(struct tcp_conn *conn) {
+    uint8_t line[LINE_MAX];
+    size_t len = relay_hot_key(line, line_read(line, sizeof(line)));
+    if (memchr(line, BREAK_CHAR, len) != NULL) {
+        return false;
+    }
+    if (len > 0) {
+        conn->client.write(line, len);
+    }
+    return true;
+}
+
+static bool tcp_poll(void *ctx, bool keys) {
+    struct tcp_conn *conn = (struct tcp_conn *) ctx;
+    if (!net_connected(conn->client, conn->watch)) {
+        return false;
+    }
+
+    if (keys) {
+        line_begin();
+        if (!(line_active() ? line_to_net(conn) : relay_term_to_net(conn->client, BREAK_CHAR))) {
+            // User wants to stop connection, and not to watch the rest of
+            // what it sent
+            term_discard_output();
+            return false;
         }
-        stream_copy(_client, term_serial, TCP_COPY_LIMIT);
+    }
+
+    if (session_front(conn->session)) {
+        // A quantum at most, leaving the rest with the server while keys wait
+        relay_net_to_term(conn->client, TCP_COPY_LIMIT, conn->session);
+    } else {
+        int len = relay_read_back(conn->client, _buf, sizeof(_buf));
+        if (len > 0) {
+            session_output(conn->session, _buf, (size_t) len);
+        }
+    }
+    return true;
+}
+
+static bool tcp_ready(void *ctx) {
+    return net_pending(((struct tcp_conn *) ctx)->watch);
+}
+
+static size_t tcp_render(const uint8_t *buf, size_t len) {
+    return term_write_some(buf, len);
+}
+
+static void tcp_focus(void *, bool front) {
+    if (front) {
+        relay_begin();
     } else {
-        term_writeln("");
-        term_writeln("connection closed");
-        wifi_set_loop_callback(NULL);
+        line_end();
     }
 }
 
+static void tcp_close(void *ctx) {
+    struct tcp_conn *conn = (struct tcp_conn *) ctx;
+    conn->client.stop();
+    net_unwatch(conn->watch);
+    delete conn;
+}
+
+static const struct session_ops _ops = {sizeof(struct tcp_conn), tcp_poll, tcp_ready, tcp_render, tcp_focus,
+                                        tcp_close};
+
 bool tcp_connect(const char *host, uint16_t port) {
-    if (!_client.connect(host, port)) {
+    if (!session_can_open()) {
+        term_writeln("tcp: too many sessions");
+        return false;
+    }
+
+    struct tcp_conn *conn = new tcp_conn();
+    if (!conn->client.connect(host, port)) {
+        delete conn;
         return false;
     }
 
@@ -33,6 +103,13 @@ bool tcp_connect(const char *host, uint16_t port) {
     term_write(":");
     term_println(port, DEC);
 
-    wifi_set_loop_callback(tcp_loop_cb);
+    conn->watch = net_watch(conn->client);
+    char name[SESSION_NAME_MAX];
+    fmt(name, sizeof(name), "tcp %s:%u", host, port);
+    conn->session = session_open(name, &_ops, conn);
+    if (conn->session == NULL) {
+        tcp_close(conn);
+        return false;
+    }
     return true;
 }
@@ -1,74 +1,261 @@
 #include "telnets.h"
 #include "wifi.h"
 #include "term.h"
-#include "util.h"
+#include "relay.h"
 #include "busybox.h"
+#include "ansi.h"
+#include "predict.h"
+#include "line.h"
+#include "net.h"
+#include "session.h"
+#include "fmt.h"
 
-#define WIDTH 80
 #define HEIGHT 24
-#define TERM "tvipt"
+#define TERM ANSI_TERM
 
 #define BUFSIZE 128
-#define BREAK_CHAR '\0'
 
-static WiFiSSLClient _client;
+// Keys that go out at once whatever the budget: Enter, ^C, break and
+// busybox's console escape (CTRL ])
+#define ENTER_CHAR  '\r'
+#define INTR_CHAR   0x03
+#define BREAK_CHAR  '\0'
+#define ESCAPE_CHAR 0x1d
+
+// One per session, allocated while it's open
+struct telnets_conn {
+    WiFiSSLClient client;
+    int watch;
+    struct busybox *bb;
+    struct session *session;
+    uint8_t coalesce_ms;
+    size_t coalesce_max;
+};
+
 static byte _buf[BUFSIZE];
 
-// Read up to max bytes from stream and store in buf
-size_t read(Stream &stream, byte *buf, size_t max, const char * stream_name) {
-    size_t count = 0;
-    while (count < max) {
-        int c = stream.read();
-        if (c < 0) {
-            // No more bytes to read now
-            break;
-        }
-        *buf++ = (byte) c;
-        count++;
-    }
+static void log_read(int count, const char *stream_name) {
     dbg_serial.write("telnets: read ");
     dbg_serial.print(count, DEC);
     dbg_serial.write(" from ");
     dbg_serial.println(stream_name);
-    return count;
 }
 
-void telnets_loop_cb() {
-    if (_client.connected()) {
-        size_t len;
-
-        if (term_serial.available()) {
-            len = read(term_serial, _buf, BUFSIZE, "term");
-            if (len <= 0) {
-                _client.stop();
-                return;
-            }
-            busybox_handle_net_output(_buf, len);
+//////////////////////////////////////////////////////////////////////////////
+// Coalescing
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Every write to the client is its own TLS record, around 30 bytes of
+ * header and MAC, so typing one key per record is mostly overhead and a
+ * paste is a storm of tiny records.  Bytes that come faster than anyone
+ * types wait in _out until the oldest has waited coalesce_ms, the batch
+ * reaches coalesce_max, or Enter is typed, and then go out together.  A
+ * batch that starts more than coalesce_ms after the key before it is
+ * typing, and goes at once: typed keys come a tenth of a second or more
+ * apart, so they go a key a record whatever the window, and would only
+ * wait.  Only the session in front
+ * reads keys, so they all share _out, and it's flushed when the session
+ * goes to the back.
+ */
+
+static byte _out[TELNETS_BATCH_MAX];
+static size_t _out_len = 0;
+static unsigned long _out_since;
+// How long the terminal was quiet before the batch, and when it last sent
+static unsigned long _out_quiet;
+static unsigned long _last_key = 0;
+
+static struct telnets_stats _stats;
+
+static void flush_out(struct telnets_conn *conn) {
+    if (_out_len == 0) {
+        return;
+    }
+    _stats.records++;
+    _stats.payload_bytes += _out_len;
+    busybox_handle_net_output(conn->bb, _out, (int) _out_len);
+    _out_len = 0;
+}
+
+// A line from line mode goes out as it is
+static void line_out(struct telnets_conn *conn) {
+    byte line[LINE_MAX];
+    size_t len = relay_hot_key(line, line_read(line, sizeof(line)));
+    if (len > 0) {
+        log_read((int) len, "line");
+        _stats.records++;
+        _stats.payload_bytes += len;
+        busybox_send_line(conn->bb, line, (int) len);
+    }
+}
+
+bool telnets_flush_due(const uint8_t *added, size_t added_len, size_t waiting, unsigned long waited_ms,
+                       unsigned long quiet_ms, uint8_t coalesce_ms, size_t coalesce_max) {
+    if (memchr(added, ENTER_CHAR, added_len) != NULL || memchr(added, INTR_CHAR, added_len) != NULL ||
+        memchr(added, BREAK_CHAR, added_len) != NULL || memchr(added, ESCAPE_CHAR, added_len) != NULL) {
+        return true;
+    }
+    return quiet_ms > coalesce_ms || waiting >= coalesce_max || waited_ms >= coalesce_ms;
+}
+
+static void coalesce_out(struct telnets_conn *conn) {
+    byte *added = _out + _out_len;
+    int len = relay_read_term(added, conn->coalesce_max - _out_len, -1);
+    unsigned long now = millis();
+    if (len > 0) {
+        log_read(len, "term");
+        if (_out_len == 0) {
+            _out_since = now;
+            _out_quiet = now - _last_key;
         }
+        _last_key = now;
+        _out_len += len;
+    }
+
+    if (_out_len > 0 && telnets_flush_due(added, len > 0 ? (size_t) len : 0, _out_len, now - _out_since,
+                                          _out_quiet, conn->coalesce_ms, conn->coalesce_max)) {
+        flush_out(conn);
+    }
+}
+
+void telnets_get_stats(struct telnets_stats *stats) {
+    *stats = _stats;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Session
+//////////////////////////////////////////////////////////////////////////////
+
+// What the server sends, with Telnet taken out, goes to the session
+static int term_sink_write(void *ctx, const uint8_t *buf, size_t len) {
+    session_output(((struct telnets_conn *) ctx)->session, buf, len);
+    return (int) len;
+}
+
+// The emulation's answers go to the server as data
+static int reply_sink_write(void *ctx, const uint8_t *buf, size_t len) {
+    busybox_reply(((struct telnets_conn *) ctx)->bb, buf, len);
+    return (int) len;
+}
+
+static bool telnets_poll(void *ctx, bool keys) {
+    struct telnets_conn *conn = (struct telnets_conn *) ctx;
+    if (busybox_exited(conn->bb)) {
+        return false;
+    }
+    if (!net_connected(conn->client, conn->watch)) {
+        return false;
+    }
 
-        if (_client.available()) {
-            len = read(_client, _buf, BUFSIZE, "net");
-            if (len <= 0) {
-                _client.stop();
-                return;
-            }
-            busybox_handle_net_input(_buf, len);
+    if (keys) {
+        // Lines can be edited on the terminal unless the server wants keys
+        if (busybox_local_edit(conn->bb)) {
+            line_begin();
+        } else {
+            line_end();
+        }
+        if (line_active()) {
+            flush_out(conn);
+            line_out(conn);
+        } else {
+            coalesce_out(conn);
         }
+        predict_loop();
+    }
+
+    // In front, only a quantum, so the rest waits at the server and keys
+    // come first, and nothing until what came before has been drawn; after
+    // an abort it's all dropped, so read as fast as it comes.  In the back
+    // it only goes to the backlog.
+    int len = 0;
+    if (!session_front(conn->session)) {
+        len = relay_read_back(conn->client, _buf, BUFSIZE);
+    } else if (busybox_discarding(conn->bb)) {
+        len = relay_drain_net(conn->client, _buf, BUFSIZE);
+    } else if (!session_behind(conn->session)) {
+        len = relay_read_net(conn->client, _buf, relay_quantum(BUFSIZE));
+    }
+    if (len > 0) {
+        log_read(len, "net");
+        busybox_handle_net_input(conn->bb, _buf, len);
+    }
+    return true;
+}
+
+// Besides the server, batched keys and predictions wait on the clock
+static bool telnets_ready(void *ctx) {
+    struct telnets_conn *conn = (struct telnets_conn *) ctx;
+    bool front = session_front(conn->session);
+    return net_pending(conn->watch) || (front && (_out_len > 0 || predict_waiting()));
+}
+
+// Output goes through the ANSI emulation
+static size_t telnets_render(const uint8_t *buf, size_t len) {
+    return ansi_write(buf, len);
+}
+
+static void telnets_focus(void *ctx, bool front) {
+    struct telnets_conn *conn = (struct telnets_conn *) ctx;
+    if (front) {
+        struct busybox_sink reply = {conn, reply_sink_write};
+        ansi_init(reply);
+        relay_begin();
     } else {
-        term_write("");
-        term_writeln("connection closed");
-        wifi_set_loop_callback(NULL);
+        flush_out(conn);
+        predict_reset();
+        line_end();
     }
+    busybox_set_foreground(conn->bb, front);
 }
 
-bool telnets_connect(const char *host, uint16_t port, const char *username) {
-    if (!_client.connectSSL(host, port)) {
-        term_writeln("telnets: connection failed");
+static void telnets_close(void *ctx) {
+    struct telnets_conn *conn = (struct telnets_conn *) ctx;
+    busybox_close(conn->bb);
+    conn->client.stop();
+    net_unwatch(conn->watch);
+    delete conn;
+}
+
+static const struct session_ops _ops = {sizeof(struct telnets_conn), telnets_poll, telnets_ready, telnets_render,
+                                        telnets_focus, telnets_close};
+
+bool telnets_connect(const char *host, uint16_t port, const char *username, uint8_t coalesce_ms,
+                     uint8_t coalesce_max) {
+    if (coalesce_ms > TELNETS_COALESCE_MAX_MS || coalesce_max == 0 || coalesce_max > TELNETS_BATCH_MAX) {
+        return false;
+    }
+    if (!session_can_open()) {
+        term_writeln("telnets: too many sessions");
         return false;
     }
 
-    busybox_init(WIDTH, HEIGHT, TERM, &_client, username);
+    struct telnets_conn *conn = new telnets_conn();
+    conn->watch = NET_NO_WATCH;
+    conn->coalesce_ms = coalesce_ms;
+    conn->coalesce_max = coalesce_max;
 
-    wifi_set_loop_callback(telnets_loop_cb);
+    struct busybox_sink term = {conn, term_sink_write};
+    conn->bb = busybox_open(term_columns(), HEIGHT, (char *) TERM, busybox_sink_to(conn->client), term, username);
+    if (conn->bb == NULL) {
+        delete conn;
+        term_writeln("telnets: too many sessions");
+        return false;
+    }
+
+    if (!conn->client.connectSSL(host, port)) {
+        telnets_close(conn);
+        term_writeln("telnets: connection failed");
+        return false;
+    }
+
+    conn->watch = net_watch(conn->client);
+    char name[SESSION_NAME_MAX];
+    fmt(name, sizeof(name), "tel %s:%u", host, port);
+    conn->session = session_open(name, &_ops, conn);
+    if (conn->session == NULL) {
+        telnets_close(conn);
+        return false;
+    }
     return true;
 }
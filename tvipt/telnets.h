@@ -2,7 +2,34 @@
 #define _TELNETS_H
 
 #include <stdint.h>
+#include <stddef.h>
 
-bool telnets_connect(const char *host, uint16_t port, const char *username);
+// How long typed bytes may wait to share a TLS record, by default and at
+// most, in ms; and the largest batch
+#define TELNETS_COALESCE_MS     5
+#define TELNETS_COALESCE_MAX_MS 20
+#define TELNETS_BATCH_MAX       128
+
+struct telnets_stats {
+    // Writes of typed bytes to the server (each its own TLS record), and
+    // the bytes in them
+    uint32_t records;
+    uint32_t payload_bytes;
+};
+
+// Typed bytes that come faster than typing, like a paste, are held up to
+// coalesce_ms (0 sends every read at once) or until coalesce_max of them
+// are waiting.  Fails without trying if either is out of range.
+bool telnets_connect(const char *host, uint16_t port, const char *username,
+                     uint8_t coalesce_ms = TELNETS_COALESCE_MS, uint8_t coalesce_max = TELNETS_BATCH_MAX);
+
+// Whether the batch of typed bytes should go to the server now: waiting
+// bytes, the last added_len of them just read, the oldest for waited_ms,
+// after the terminal had been quiet for quiet_ms.  Enter and the other keys
+// that can't wait send it, and so does a key typed after a pause.
+bool telnets_flush_due(const uint8_t *added, size_t added_len, size_t waiting, unsigned long waited_ms,
+                       unsigned long quiet_ms, uint8_t coalesce_ms, size_t coalesce_max);
+
+void telnets_get_stats(struct telnets_stats *stats);
 
 #endif
@@ -1,6 +1,12 @@
 #include "Print.h"
+#include <FlashStorage.h>
 
 #include "term.h"
+#include "screen.h"
+#include "fmt.h"
+#include "motion.h"
+#include "catchup.h"
+#include "sched.h"
 
 /*
  * The TeleVideo Personal Terminal (PT) is a typical RS-232 serial terminal 
@@ -149,61 +155,1224 @@
 // is actually capable of resetting the PT from any weird state.
 #define TVIPT_INIT "\x0D\x1B\x33\x0D\x20\x20\x20\x20\x20\x20\x20\x20\x1B\x31\x20\x20\x20\x20\x20\x20\x20\x20\x1B\x31\x20\x20\x20\x20\x20\x20\x20\x20\x1B\x31\x20\x20\x20\x20\x20\x20\x20\x20\x1B\x31\x20\x20\x20\x20\x20\x20\x20\x20\x1B\x31\x20\x20\x20\x20\x20\x20\x20\x20\x1B\x31\x20\x20\x20\x20\x20\x20\x20\x20\x1B\x31\x20\x20\x20\x20\x20\x20\x20\x20\x1B\x31\x20\x20\x20\x20\x20\x20\x20\x20\x1B\x31\x0D"
 #define TVIPT_CLEAR "\x1a"
+// The screen model expects the cursor to wrap after the last column
+#define TVIPT_AUTOWRAP "\x1bv"
+// ESC u: 80 columns, which is where the screen model starts
+#define TVIPT_80_COLUMNS "\x1bu"
+// CTRL O: use XON/XOFF rather than DTR for flow control
+#define TVIPT_FLOW "\x0f"
+// CTRL N: DTR flow control, which goes nowhere with our three-wire cable
+#define TVIPT_NO_FLOW "\x0e"
+// ESC 7: send the screen from home to the cursor
+#define TVIPT_SEND_TO_CURSOR "\x1b\x37"
 
-void term_init() {
-    dbg_serial.begin(115200);
+//////////////////////////////////////////////////////////////////////////////
+// DMA
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Both directions of the terminal UART are moved by the DMA controller.
+ *
+ * The Adafruit SAMD core owns SERCOM0_Handler and services receive with
+ * a 64-byte buffer, which overflows whenever the main loop is stuck in an
+ * SSL connect or HTTP request.  We turn off the SERCOM receive and error
+ * interrupts and let the DMAC copy every received byte into _rx_buf, a
+ * ring made of two linked half-buffer descriptors.  The DMAC interrupt
+ * counts completed halves so readers can tell how far the writer is
+ * ahead of them, and a reader that falls a whole ring behind counts the
+ * bytes it lost as overruns.
+ *
+ * Output for the terminal is queued in _tx_buf and paced into the UART
+ * by the SERCOM's "data register empty" trigger, so writers only wait
+ * when the ring is full.  The DMAC transfer-complete interrupt starts
+ * the next chunk of the ring.  Chunks are kept short so an XOFF from the
+ * terminal stops output within a few characters (see Flow Control).
+ */
+
+// Serial1 is SERCOM0 on the Feather M0.
+#define TERM_SERCOM             SERCOM0
+#define TERM_DMA_TX_TRIGGER     SERCOM0_DMAC_ID_TX
+#define TERM_DMA_RX_TRIGGER     SERCOM0_DMAC_ID_RX
+
+// DMA channels used for the terminal UART
+#define TERM_DMA_TX             0
+#define TERM_DMA_RX             1
+#define TERM_DMA_CHANNELS       2
+
+#define TERM_RX_HALF            (TERM_RX_BUFSIZE / 2)
+// Unread bytes within this distance of being overwritten are given up, so
+// the DMA can't change them while they're being read.
+#define TERM_RX_MARGIN          32
+
+// Most bytes the DMA sends before we look for XOFF again
+#define TERM_TX_CHUNK           32
+
+// The DMAC reads descriptors from these; all must be 128-bit aligned.
+static volatile DmacDescriptor _dma_desc[TERM_DMA_CHANNELS] __attribute__ ((aligned (16)));
+static volatile DmacDescriptor _dma_wb[TERM_DMA_CHANNELS] __attribute__ ((aligned (16)));
+static volatile DmacDescriptor _rx_desc_upper __attribute__ ((aligned (16)));
+
+static uint8_t _tx_buf[TERM_TX_BUFSIZE];
+// Next free slot; only moved by writers
+static volatile uint16_t _tx_head = 0;
+// Oldest queued byte; only moved by the DMA interrupt
+static volatile uint16_t _tx_tail = 0;
+// Length of the run the DMA is sending from _tx_tail, 0 when idle
+static volatile uint16_t _tx_dma_len = 0;
+
+static uint32_t _tx_bytes = 0;
+static uint64_t _tx_blocked_us = 0;
+static uint32_t _tx_bytes_per_sec = 0;
+static uint32_t _tx_window_bytes = 0;
+static unsigned long _tx_window_start = 0;
+
+static uint32_t _pad_bytes = 0;
+static uint32_t _discards = 0;
+static uint32_t _discarded_bytes = 0;
+
+// Rate of the terminal UART, 0 until it's started
+static unsigned long _baud = 0;
+
+// Set between XOFF and XON from the terminal
+static volatile bool _tx_paused = false;
+// Off while changing rates, when XOFF is as likely to be line noise
+static bool _flow_enabled = true;
+// Total received bytes checked for XOFF/XON since boot
+static uint32_t _rx_scanned = 0;
+static uint32_t _xoffs = 0;
+static uint32_t _paused_ms = 0;
+static unsigned long _pause_start = 0;
+
+static void flow_scan();
+static void flow_poll();
+
+// Interrupt masking that nests (noInterrupts() and interrupts() don't)
+static inline uint32_t irq_save() {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+static inline void irq_restore(uint32_t primask) {
+    if (!primask) {
+        __enable_irq();
+    }
+}
+
+static uint8_t _rx_buf[TERM_RX_BUFSIZE];
+// Half-buffers the DMA has filled since boot; only moved by the DMA interrupt
+static volatile uint32_t _rx_halves = 0;
+// Total bytes consumed by readers since boot
+static uint32_t _rx_read = 0;
+
+// Keys put back by term_unread(), read before the ring
+static uint8_t _rx_again[TERM_UNREAD_MAX];
+static size_t _rx_again_len = 0;
+static size_t _rx_again_read = 0;
+
+static uint32_t _rx_overruns = 0;
+static uint32_t _rx_uart_overruns = 0;
+static uint32_t _rx_framing_errors = 0;
+
+static void dma_channel_reset(uint8_t channel, uint8_t trigger) {
+    DMAC->CHID.reg = DMAC_CHID_ID(channel);
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    while (DMAC->CHCTRLA.reg & DMAC_CHCTRLA_SWRST) {}
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) |
+                        DMAC_CHCTRLB_TRIGSRC(trigger) |
+                        DMAC_CHCTRLB_TRIGACT_BEAT;
+    DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL;
+}
+
+static void rx_desc_init(volatile DmacDescriptor *desc, uint8_t *end, volatile DmacDescriptor *next) {
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_DSTINC |
+                       DMAC_BTCTRL_BLOCKACT_INT;
+    desc->BTCNT.reg = TERM_RX_HALF;
+    desc->SRCADDR.reg = (uint32_t) &TERM_SERCOM->USART.DATA.reg;
+    // An incrementing destination address points to the end of the block
+    desc->DSTADDR.reg = (uint32_t) end;
+    desc->DESCADDR.reg = (uint32_t) next;
+}
+
+static void dma_init() {
+    PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+    PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+    DMAC->CTRL.bit.DMAENABLE = 0;
+    DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+    while (DMAC->CTRL.reg & DMAC_CTRL_SWRST) {}
+
+    DMAC->BASEADDR.reg = (uint32_t) _dma_desc;
+    DMAC->WRBADDR.reg = (uint32_t) _dma_wb;
+    DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+
+    dma_channel_reset(TERM_DMA_TX, TERM_DMA_TX_TRIGGER);
+
+    // The receive ring is two half-buffer descriptors linked into a loop
+    rx_desc_init(&_dma_desc[TERM_DMA_RX], _rx_buf + TERM_RX_HALF, &_rx_desc_upper);
+    rx_desc_init(&_rx_desc_upper, _rx_buf + TERM_RX_BUFSIZE, &_dma_desc[TERM_DMA_RX]);
+    // Until the first byte arrives the write-back copy reads as "nothing written"
+    _dma_wb[TERM_DMA_RX].DSTADDR.reg = (uint32_t) (_rx_buf + TERM_RX_HALF);
+    _dma_wb[TERM_DMA_RX].BTCNT.reg = TERM_RX_HALF;
+    dma_channel_reset(TERM_DMA_RX, TERM_DMA_RX_TRIGGER);
+    DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+
+    NVIC_EnableIRQ(DMAC_IRQn);
+}
+
+// Starts sending the next chunk of the ring if the DMA is idle and the
+// terminal hasn't paused us.  Call with interrupts disabled.
+static void tx_dma_start() {
+    if (_tx_dma_len != 0 || _tx_head == _tx_tail || _tx_paused) {
+        return;
+    }
+
+    uint16_t tail = _tx_tail;
+    uint16_t len = (_tx_head > tail ? _tx_head : TERM_TX_BUFSIZE) - tail;
+    if (len > TERM_TX_CHUNK) {
+        len = TERM_TX_CHUNK;
+    }
+
+    volatile DmacDescriptor *desc = &_dma_desc[TERM_DMA_TX];
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_SRCINC |
+                       DMAC_BTCTRL_BLOCKACT_NOACT;
+    desc->BTCNT.reg = len;
+    // An incrementing source address points to the end of the block
+    desc->SRCADDR.reg = (uint32_t) &_tx_buf[tail + len];
+    desc->DSTADDR.reg = (uint32_t) &TERM_SERCOM->USART.DATA.reg;
+    desc->DESCADDR.reg = 0;
+    _tx_dma_len = len;
+
+    uint8_t chid = DMAC->CHID.reg;
+    DMAC->CHID.reg = DMAC_CHID_ID(TERM_DMA_TX);
+    DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+    DMAC->CHID.reg = chid;
+}
+
+extern "C" void DMAC_Handler() {
+    uint8_t chid = DMAC->CHID.reg;
+    uint8_t flags;
+
+    DMAC->CHID.reg = DMAC_CHID_ID(TERM_DMA_RX);
+    flags = DMAC->CHINTFLAG.reg;
+    if (flags & DMAC_CHINTFLAG_TCMPL) {
+        DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+        _rx_halves++;
+    }
+
+    DMAC->CHID.reg = DMAC_CHID_ID(TERM_DMA_TX);
+    flags = DMAC->CHINTFLAG.reg;
+    if (flags & (DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR)) {
+        DMAC->CHINTFLAG.reg = flags;
+        _tx_tail = (_tx_tail + _tx_dma_len) % TERM_TX_BUFSIZE;
+        _tx_dma_len = 0;
+        // Pick up an XOFF even if the main loop is stuck somewhere
+        flow_scan();
+        tx_dma_start();
+    }
+
+    DMAC->CHID.reg = chid;
+}
+
+// Starts the UART at the given rate with receive handed to the DMA.
+static void uart_begin(unsigned long baud) {
     term_serial.end();
-    term_serial.begin(19200);
+    term_serial.begin(baud);
 
     while (!term_serial) {}
 
-    term_serial.setTimeout(-1);
-    term_serial.write(TVIPT_INIT);
-    term_serial.write(TVIPT_CLEAR);
+    // The core's interrupt handler would race the DMA for received bytes
+    // and clear the error flags before we could count them.
+    TERM_SERCOM->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_RXC | SERCOM_USART_INTENCLR_ERROR;
+}
+
+// Counts (and clears) receive errors the UART has flagged since the last poll.
+static void uart_poll_errors() {
+    uint16_t status = TERM_SERCOM->USART.STATUS.reg;
+    if (status & SERCOM_USART_STATUS_BUFOVF) {
+        _rx_uart_overruns++;
+    }
+    if (status & SERCOM_USART_STATUS_FERR) {
+        _rx_framing_errors++;
+    }
+    if (status & (SERCOM_USART_STATUS_BUFOVF | SERCOM_USART_STATUS_FERR | SERCOM_USART_STATUS_PERR)) {
+        TERM_SERCOM->USART.STATUS.reg = status;
+        TERM_SERCOM->USART.INTFLAG.reg = SERCOM_USART_INTFLAG_ERROR;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Receive Ring
+//////////////////////////////////////////////////////////////////////////////
+
+// Total bytes the DMA has written into the receive ring since boot.
+static uint32_t rx_written() {
+    uint32_t primask = irq_save();
+    uint32_t halves = _rx_halves;
+    uint32_t dst = _dma_wb[TERM_DMA_RX].DSTADDR.reg;
+    uint16_t remaining = _dma_wb[TERM_DMA_RX].BTCNT.reg;
+    irq_restore(primask);
+
+    // Where the next byte goes, from the active descriptor's write-back copy
+    uint32_t pos = (dst - (uint32_t) _rx_buf - remaining) % TERM_RX_BUFSIZE;
+
+    // The write position is at most a half ahead of the last completed half;
+    // taking it relative to that keeps us right when the interrupt hasn't
+    // run yet (or the write-back copy hasn't caught up with it).
+    uint32_t base = halves * TERM_RX_HALF;
+    return base + ((pos + TERM_RX_BUFSIZE - base % TERM_RX_BUFSIZE) % TERM_RX_BUFSIZE);
+}
+
+static bool is_flow_char(uint8_t c) {
+    return c == TERM_XOFF || c == TERM_XON;
+}
+
+// What the ring has, not counting keys put back
+static size_t rx_available() {
+    flow_poll();
+
+    uint32_t written = rx_written();
+
+    if (written - _rx_read > TERM_RX_BUFSIZE - TERM_RX_MARGIN) {
+        // The DMA has lapped us (or is about to); skip to the oldest safe byte
+        uint32_t keep_from = written - (TERM_RX_BUFSIZE - TERM_RX_MARGIN);
+        _rx_overruns += keep_from - _rx_read;
+        _rx_read = keep_from;
+    }
+
+    // Flow control is handled here; readers never see XOFF or XON
+    while (_rx_read != written && is_flow_char(_rx_buf[_rx_read % TERM_RX_BUFSIZE])) {
+        _rx_read++;
+    }
+
+    return written - _rx_read;
+}
+
+size_t term_available() {
+    return _rx_again_len - _rx_again_read + rx_available();
+}
+
+static int again_read() {
+    int c = _rx_again[_rx_again_read++];
+    if (_rx_again_read == _rx_again_len) {
+        _rx_again_len = 0;
+        _rx_again_read = 0;
+    }
+    return c;
+}
+
+int term_read() {
+    if (_rx_again_len > 0) {
+        return again_read();
+    }
+    if (rx_available() == 0) {
+        return -1;
+    }
+    return _rx_buf[_rx_read++ % TERM_RX_BUFSIZE];
+}
+
+size_t term_read(uint8_t *buf, size_t max) {
+    size_t count = 0;
+    while (_rx_again_len > 0 && count < max) {
+        buf[count++] = (uint8_t) again_read();
+    }
+    uint32_t end = _rx_read + rx_available();
+    while (_rx_read != end && count < max) {
+        uint8_t c = _rx_buf[_rx_read++ % TERM_RX_BUFSIZE];
+        if (!is_flow_char(c)) {
+            buf[count++] = c;
+        }
+    }
+    return count;
+}
+
+void term_unread(const uint8_t *buf, size_t len) {
+    // Ahead of any put back before and not read yet
+    size_t left = _rx_again_len - _rx_again_read;
+    size_t keep = min(len, (size_t) TERM_UNREAD_MAX - left);
+    memmove(_rx_again + keep, _rx_again + _rx_again_read, left);
+    memcpy(_rx_again, buf, keep);
+    _rx_again_len = keep + left;
+    _rx_again_read = 0;
+    _rx_overruns += len - keep;
+}
+
+void term_discard_input() {
+    _rx_again_len = 0;
+    _rx_again_read = 0;
+    _rx_read = rx_written();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Flow Control
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * The terminal sends XOFF when its input buffer is nearly full and XON when
+ * it has caught up (CTRL O in term_init() selects XON/XOFF over DTR).  We
+ * scan received bytes for them from the main loop, from writers waiting on
+ * a full ring and from the DMA interrupt between transmit chunks, so a
+ * pause takes effect within a chunk even while the main loop is blocked.
+ * While paused the transmit ring fills, term_writable() drops to zero, and
+ * sessions stop reading their sockets, so the backlog piles up in the
+ * server's TCP window instead of being dropped by the terminal.
+ */
+
+// Call with interrupts disabled.
+static void flow_scan() {
+    uint32_t written = rx_written();
+    if (written - _rx_scanned > TERM_RX_BUFSIZE) {
+        // Lost in an overrun
+        _rx_scanned = written - TERM_RX_BUFSIZE;
+    }
+
+    while (_rx_scanned != written) {
+        uint8_t c = _rx_buf[_rx_scanned++ % TERM_RX_BUFSIZE];
+        if (!_flow_enabled) {
+            continue;
+        } else if (c == TERM_XOFF && !_tx_paused) {
+            _tx_paused = true;
+            _xoffs++;
+            _pause_start = millis();
+        } else if (c == TERM_XON && _tx_paused) {
+            _tx_paused = false;
+            _paused_ms += millis() - _pause_start;
+        }
+    }
+
+    tx_dma_start();
+}
+
+static void flow_poll() {
+    uint32_t primask = irq_save();
+    flow_scan();
+    irq_restore(primask);
+}
+
+// Returns whether flow control was enabled before.
+static bool flow_enable(bool enable) {
+    uint32_t primask = irq_save();
+    bool was_enabled = _flow_enabled;
+    _flow_enabled = enable;
+    if (!enable && _tx_paused) {
+        _tx_paused = false;
+        _paused_ms += millis() - _pause_start;
+        tx_dma_start();
+    }
+    irq_restore(primask);
+    return was_enabled;
+}
+
+bool term_paused() {
+    return _tx_paused;
+}
+
+size_t term_writable() {
+    return _tx_paused ? 0 : term_tx_free();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Padding
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Some operations keep the PT busy long enough that characters arriving
+ * right after them are dropped unless it can XOFF us.  Like terminfo's
+ * $<n>, each one here is followed by enough NULs (which the PT ignores)
+ * to cover its delay at the current rate.  The delays can be measured on
+ * the attached terminal with term_calibrate_padding().
+ */
+
+struct term_padding term_paddings[] = {
+        {"clear",       false, TERM_CLEAR,           10},
+        {"clear (esc)", true,  TERM_CLEAR_TO_SPACES, 10},
+        {"erase page",  true,  TERM_ERASE_TO_EOP,    10},
+        {"insert line", true,  'E',                  5},
+        {"delete line", true,  'R',                  5},
+        {NULL,          false, 0,                    0},
+};
+
+// The previous byte queued was an ESC
+static bool _pad_escape = false;
+
+// Milliseconds of padding needed after c, which follows an ESC if escape.
+static uint8_t pad_ms(bool escape, uint8_t c) {
+    if (!escape && c == TERM_ESCAPE) {
+        return 0;
+    }
+
+    for (struct term_padding *pad = term_paddings; pad->name != NULL; pad++) {
+        if (pad->escape == escape && pad->code == c) {
+            return pad->ms;
+        }
+    }
+    return 0;
+}
+
+// Milliseconds of padding needed after queueing c.
+static uint8_t pad_after(uint8_t c) {
+    bool escape = _pad_escape;
+    _pad_escape = !escape && c == TERM_ESCAPE;
+    return pad_ms(escape, c);
+}
+
+// NULs that take ms to send; 8N1 is ten bits per byte.
+static size_t pad_bytes(uint8_t ms) {
+    return (ms * _baud + 9999) / 10000;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Transmit Ring
+//////////////////////////////////////////////////////////////////////////////
+
+size_t term_queued() {
+    uint16_t head = _tx_head;
+    uint16_t tail = _tx_tail;
+    return (head + TERM_TX_BUFSIZE - tail) % TERM_TX_BUFSIZE;
+}
+
+size_t term_tx_free() {
+    return TERM_TX_BUFSIZE - 1 - term_queued();
+}
+
+// Copies buf into the ring, waiting for the DMA only when the ring is full.
+// Only term_write() and friends get here with more than there's room for;
+// sessions size what they write with term_write_some().
+static void tx_copy(const uint8_t *buf, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        size_t room = term_tx_free();
+        if (room == 0) {
+            unsigned long start = micros();
+            while (term_tx_free() == 0) {
+                // Nothing drains the ring while paused; watch for XON
+                flow_poll();
+            }
+            _tx_blocked_us += micros() - start;
+            continue;
+        }
+
+        uint16_t head = _tx_head;
+        size_t n = min(size - written, min(room, (size_t) (TERM_TX_BUFSIZE - head)));
+        memcpy(&_tx_buf[head], buf + written, n);
+        _tx_head = (uint16_t) ((head + n) % TERM_TX_BUFSIZE);
+        written += n;
+
+        uint32_t primask = irq_save();
+        tx_dma_start();
+        irq_restore(primask);
+    }
+
+    _tx_bytes += written;
+    _tx_window_bytes += written;
+}
+
+static void tx_pad(uint8_t ms) {
+    static const uint8_t nuls[16] = {0};
+    size_t count = pad_bytes(ms);
+    _pad_bytes += count;
+    while (count > 0) {
+        size_t n = min(count, sizeof(nuls));
+        tx_copy(nuls, n);
+        count -= n;
+    }
+}
+
+static size_t tx_queue(const uint8_t *buf, size_t size) {
+    if (catchup_hold(term_queued())) {
+        catchup_keep(buf, size);
+        return size;
+    }
+
+    size_t start = 0;
+    for (size_t i = 0; i < size; i++) {
+        screen_apply(&screen_shown, buf[i]);
+        uint8_t ms = pad_after(buf[i]);
+        if (ms > 0) {
+            tx_copy(buf + start, i + 1 - start);
+            tx_pad(ms);
+            start = i + 1;
+        }
+    }
+    tx_copy(buf + start, size - start);
+    return size;
+}
+
+class term_stream_adapter : public Stream {
+public:
+    int available() {
+        return term_available();
+    }
+
+    int read() {
+        return term_read();
+    }
+
+    int peek() {
+        if (term_available() == 0) {
+            return -1;
+        }
+        if (_rx_again_len > 0) {
+            return _rx_again[_rx_again_read];
+        }
+        return _rx_buf[_rx_read % TERM_RX_BUFSIZE];
+    }
+
+    void flush() {
+        term_flush();
+    }
+
+    size_t write(uint8_t c) {
+        return tx_queue(&c, 1);
+    }
+
+    size_t write(const uint8_t *buf, size_t size) {
+        return tx_queue(buf, size);
+    }
+
+    using Print::write;
+};
+
+static term_stream_adapter _term_stream;
+
+Stream &term_stream = _term_stream;
+
+static void catchup_finish();
+
+void term_flush() {
+    catchup_finish();
+    while (term_queued() > 0) {
+        flow_poll();
+    }
+    // Wait for the last byte to leave the shift register
+    term_serial.flush();
+}
+
+void term_get_stats(struct term_stats *stats) {
+    stats->tx_bytes = _tx_bytes;
+    stats->tx_bytes_per_sec = _tx_bytes_per_sec;
+    stats->tx_blocked_ms = (uint32_t) (_tx_blocked_us / 1000);
+    stats->rx_bytes = rx_written();
+    stats->rx_overruns = _rx_overruns;
+    stats->rx_uart_overruns = _rx_uart_overruns;
+    stats->rx_framing_errors = _rx_framing_errors;
+    stats->xoffs = _xoffs;
+    stats->paused_ms = _paused_ms + (_tx_paused ? millis() - _pause_start : 0);
+    motion_get_stats(stats);
+    stats->pad_bytes = _pad_bytes;
+    catchup_get_stats(stats);
+    stats->discards = _discards;
+    stats->discarded_bytes = _discarded_bytes;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Catch-up
+//////////////////////////////////////////////////////////////////////////////
+
+// Catch-up's policy is catchup.cpp's: tx_queue() and term_write_some()
+// ask it whether to hold output, and term_loop() releases it in pieces.
+
+// Sends everything held, waiting for the ring to drain as it goes
+static void catchup_finish() {
+    while (catchup_holding() && !screen_in_sequence(&screen_shown)) {
+        flow_poll();
+        if (term_queued() < TERM_CATCHUP_LOW) {
+            catchup_release(term_queued());
+        }
+    }
+}
+
+void term_discard_output() {
+    uint32_t primask = irq_save();
+    // The chunk the DMA is sending can't be called back
+    uint16_t keep = (uint16_t) ((_tx_tail + _tx_dma_len) % TERM_TX_BUFSIZE);
+    size_t dropped = (_tx_head + TERM_TX_BUFSIZE - keep) % TERM_TX_BUFSIZE;
+    _tx_head = keep;
+    irq_restore(primask);
+
+    if (dropped == 0 && !catchup_holding()) {
+        return;
+    }
+    catchup_discard();
+    _discards++;
+    _discarded_bytes += dropped;
+
+    // The cut may have come in the middle of a sequence; NULs (no action
+    // otherwise) use up what's left of it before the redraw
+    static const uint8_t nuls[3] = {0};
+    tx_copy(nuls, sizeof(nuls));
+    screen_redraw();
+}
+
+void term_set_catchup(bool enable) {
+    catchup_enable(enable);
+    if (!enable) {
+        catchup_finish();
+    }
+}
+
+bool term_catchup() {
+    return catchup_enabled();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Baud Rate
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * The PT's rate can only be changed from its SETUP menu, so we can't move
+ * it ourselves.  Instead we find it: term_probe() sends CTRL E (send
+ * terminal ID) and a rate is right when the answer comes back as clean
+ * text, with no framing errors.  At boot the saved rate is probed first,
+ * then every rate from fastest to slowest.  The baud command switches our
+ * end and waits for the user to change the terminal to match, going back
+ * to the old rate if the terminal doesn't answer in time.
+ *
+ * Searches are a state machine stepped by term_loop(), so the rest of the
+ * loop runs while probes wait for queued output to drain and for the
+ * answer; only term_init() waits for one, since nothing else runs yet.
+ *
+ * A burst of framing errors while running means the terminal has been
+ * moved to another rate, and term_loop() goes looking for it once no
+ * session has the terminal.
+ */
+
+const unsigned long term_bauds[] = {115200, 57600, 38400, 19200, 9600, 4800, 2400, 1200, 300, 0};
+
+#define TERM_DEFAULT_BAUD       19200
+// Framing errors within a second that mean we've lost the terminal
+#define TERM_BAUD_LOST_ERRORS   8
+
+struct saved_baud {
+    uint32_t magic;
+    uint32_t baud;
+};
+
+#define SAVED_BAUD_MAGIC        0x7B617564
+
+FlashStorage(_saved_baud, struct saved_baud);
+
+static uint32_t _baud_window_errors = 0;
+
+static unsigned long saved_baud() {
+    struct saved_baud saved = _saved_baud.read();
+    return saved.magic == SAVED_BAUD_MAGIC ? saved.baud : 0;
+}
+
+static void save_baud(unsigned long baud) {
+    if (saved_baud() != baud) {
+        struct saved_baud saved = {SAVED_BAUD_MAGIC, (uint32_t) baud};
+        _saved_baud.write(saved);
+    }
+}
+
+// Reads what the terminal sends until it goes quiet or timeout_ms passes,
+// keeping the first max bytes.  Returns the number of bytes received.
+static size_t read_answer(uint8_t *buf, size_t max, unsigned long timeout_ms) {
+    unsigned long start = millis();
+    unsigned long last = start;
+    size_t got = 0;
+    while (millis() - start < timeout_ms) {
+        int c = term_read();
+        if (c >= 0) {
+            if (got < max) {
+                buf[got] = (uint8_t) c;
+            }
+            got++;
+            last = millis();
+        } else if (got > 0 && millis() - last > 20) {
+            break;
+        }
+    }
+    return got;
+}
+
+unsigned long term_baud() {
+    return _baud;
+}
+
+bool term_probe() {
+    bool flow = flow_enable(false);
+    term_flush();
+    uart_poll_errors();
+    uint32_t errors = _rx_framing_errors;
+    term_discard_input();
+
+    term_write((char) TERM_SEND_ID);
+
+    // Long enough for a 20 character answer at the current rate
+    uint8_t answer[20];
+    size_t got = read_answer(answer, sizeof(answer), 100 + 20 * 10000 / _baud);
+    bool clean = got > 0 && got <= sizeof(answer);
+    for (size_t i = 0; clean && i < got; i++) {
+        clean = (answer[i] >= 0x20 && answer[i] < 0x7F) || answer[i] == TERM_RETURN;
+    }
+
+    uart_poll_errors();
+    term_discard_input();
+    flow_enable(flow);
+    bool answered = clean && _rx_framing_errors == errors;
+    // Errors from probing aren't a sign we've lost the terminal
+    _baud_window_errors = _rx_framing_errors;
+    return answered;
+}
+
+// Asking again while waiting for the user to change the terminal's rate
+#define BAUD_RETRY_MS           250
+
+enum baud_search_state {
+    BAUD_IDLE,
+    // Waiting for queued output to go out at the old rate
+    BAUD_DRAIN,
+    // Waiting for the answer to CTRL E
+    BAUD_ANSWER,
+    // Waiting to ask again
+    BAUD_RETRY,
+};
+
+// A search for the terminal's rate, stepped by term_loop()
+struct baud_search {
+    byte state;
+    // Trying every rate (autobaud) rather than waiting for one
+    bool every;
+    bool found;
+    bool flow;
+    // The rate being probed, and the one to go back to
+    unsigned long baud;
+    unsigned long fallback;
+    // Autobaud: the saved rate, tried first, and the next of term_bauds
+    unsigned long saved;
+    const unsigned long *next;
+    // When the search gives up, and when the current step does
+    unsigned long deadline;
+    unsigned long step_deadline;
+    unsigned long last_byte;
+    uint32_t errors;
+    uint8_t answer[20];
+    size_t got;
+};
+
+static struct baud_search _search;
+
+// Framing errors say the terminal has moved; look for it when we can
+static bool _baud_lost = false;
+
+static void search_probe(unsigned long baud) {
+    _search.baud = baud;
+    _search.state = BAUD_DRAIN;
+}
+
+// The next rate an autobaud search should try, or 0 when it's out of them
+static unsigned long search_next_rate() {
+    while (*_search.next != 0 && *_search.next == _search.saved) {
+        _search.next++;
+    }
+    return *_search.next != 0 ? *_search.next++ : 0;
+}
+
+static void search_end(bool found) {
+    if (found) {
+        save_baud(_baud);
+    } else if (_baud != _search.fallback) {
+        // Nothing is queued but the probe's CTRL E
+        uart_begin(_search.fallback);
+        _baud = _search.fallback;
+        term_discard_input();
+    }
+    flow_enable(_search.flow);
+    _search.found = found;
+    _search.state = BAUD_IDLE;
+}
+
+// The answer is in (or isn't coming): was it clean text?
+static void search_answered() {
+    bool clean = _search.got > 0 && _search.got <= sizeof(_search.answer);
+    for (size_t i = 0; clean && i < _search.got; i++) {
+        uint8_t c = _search.answer[i];
+        clean = (c >= 0x20 && c < 0x7F) || c == TERM_RETURN;
+    }
+    uart_poll_errors();
+    term_discard_input();
+    bool answered = clean && _rx_framing_errors == _search.errors;
+    // Errors from probing aren't a sign we've lost the terminal
+    _baud_window_errors = _rx_framing_errors;
+
+    if (answered) {
+        search_end(true);
+        return;
+    }
+    if (!_search.every) {
+        if (PT_PASSED(_search.deadline)) {
+            search_end(false);
+        } else {
+            _search.state = BAUD_RETRY;
+            _search.step_deadline = millis() + BAUD_RETRY_MS;
+        }
+        return;
+    }
+    unsigned long next = search_next_rate();
+    if (next != 0) {
+        search_probe(next);
+    } else {
+        search_end(false);
+    }
+}
+
+static void baud_step() {
+    switch (_search.state) {
+        case BAUD_DRAIN:
+            if (term_queued() > 0) {
+                return;
+            }
+            // The last byte has at most a character time to go
+            if (_baud != 0) {
+                term_serial.flush();
+            }
+            if (_search.baud != _baud) {
+                uart_begin(_search.baud);
+                _baud = _search.baud;
+            }
+            uart_poll_errors();
+            _search.errors = _rx_framing_errors;
+            term_discard_input();
+            term_write((char) TERM_SEND_ID);
+            // Long enough for a 20 character answer at this rate
+            _search.step_deadline = millis() + 100 + 20 * 10000 / _baud;
+            _search.got = 0;
+            _search.state = BAUD_ANSWER;
+            return;
+
+        case BAUD_ANSWER: {
+            int c;
+            while ((c = term_read()) >= 0) {
+                if (_search.got < sizeof(_search.answer)) {
+                    _search.answer[_search.got] = (uint8_t) c;
+                }
+                _search.got++;
+                _search.last_byte = millis();
+            }
+            bool quiet = _search.got > 0 && millis() - _search.last_byte > 20;
+            if (quiet || PT_PASSED(_search.step_deadline)) {
+                search_answered();
+            }
+            return;
+        }
+
+        case BAUD_RETRY:
+            if (PT_PASSED(_search.step_deadline)) {
+                search_probe(_search.baud);
+            }
+            return;
+    }
+}
+
+static void search_begin(bool every, unsigned long baud, unsigned long fallback, unsigned long timeout_ms) {
+    _search.every = every;
+    _search.fallback = fallback;
+    _search.deadline = millis() + timeout_ms;
+    _search.found = false;
+    _search.flow = flow_enable(false);
+    _baud_lost = false;
+    search_probe(baud);
+}
+
+void term_autobaud_begin() {
+    if (_search.state != BAUD_IDLE) {
+        return;
+    }
+    _search.saved = saved_baud();
+    _search.next = term_bauds;
+    unsigned long first = _search.saved != 0 ? _search.saved : search_next_rate();
+    // Nobody's listening (the terminal may be off); use what worked last
+    search_begin(true, first, _search.saved != 0 ? _search.saved : TERM_DEFAULT_BAUD, 0);
+}
+
+void term_set_baud_begin(unsigned long baud, unsigned long timeout_ms) {
+    if (_search.state != BAUD_IDLE) {
+        return;
+    }
+    search_begin(false, baud, _baud, timeout_ms);
+}
+
+bool term_baud_searching() {
+    return _search.state != BAUD_IDLE;
+}
+
+bool term_baud_found() {
+    return _search.found;
+}
+
+unsigned long term_autobaud() {
+    term_autobaud_begin();
+    while (term_baud_searching()) {
+        flow_poll();
+        baud_step();
+    }
+    return term_baud_found() ? _baud : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Padding Calibration
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * A trial fills the screen (so line and page operations have the most
+ * to do), sends the sequence with the padding under test, writes a line
+ * at home and asks the terminal to send it back with ESC 7.  If the
+ * terminal was still busy, part of the line is missing.  The terminal is
+ * switched off XON/XOFF for the duration, since it would otherwise just
+ * pause us and every trial would pass.
+ */
+
+#define PAD_MAX_MS              50
+
+struct saved_padding {
+    uint32_t magic;
+    uint8_t ms[sizeof(term_paddings) / sizeof(term_paddings[0])];
+};
+
+#define SAVED_PADDING_MAGIC     0x7061640A
+
+FlashStorage(_saved_padding, struct saved_padding);
+
+static const char *_pad_test = "tvipt padding test";
+
+static void load_padding() {
+    struct saved_padding saved = _saved_padding.read();
+    if (saved.magic != SAVED_PADDING_MAGIC) {
+        return;
+    }
+    for (size_t i = 0; term_paddings[i].name != NULL; i++) {
+        term_paddings[i].ms = saved.ms[i];
+    }
+}
+
+void term_save_padding() {
+    struct saved_padding saved;
+    memset(&saved, 0, sizeof(saved));
+    saved.magic = SAVED_PADDING_MAGIC;
+    for (size_t i = 0; term_paddings[i].name != NULL; i++) {
+        saved.ms[i] = term_paddings[i].ms;
+    }
+    _saved_padding.write(saved);
+}
+
+static bool pad_trial(const struct term_padding *pad) {
+    term_write((char) TERM_HOME);
+    for (int i = 0; i < SCREEN_ROWS * term_columns() - 1; i++) {
+        term_write((char) ('a' + i % 26));
+    }
+    // The terminal answers once it has drawn all that
+    if (!term_probe()) {
+        return false;
+    }
+
+    term_write((char) TERM_HOME);
+    if (pad->escape) {
+        term_write((char) TERM_ESCAPE);
+    }
+    term_write((char) pad->code);
+    term_write((char) TERM_HOME);
+    term_write(_pad_test);
+    term_write(TVIPT_SEND_TO_CURSOR);
+
+    size_t len = strlen(_pad_test);
+    uint8_t answer[32];
+    size_t got = read_answer(answer, sizeof(answer), 100 + 2 * sizeof(answer) * 10000 / _baud);
+    return got >= len && memcmp(answer, _pad_test, len) == 0;
+}
+
+bool term_calibrate_padding(struct term_padding *pad) {
+    uint8_t old_ms = pad->ms;
+    term_write(TVIPT_NO_FLOW);
+    bool flow = flow_enable(false);
+
+    // Find the least padding that works, if any does
+    pad->ms = PAD_MAX_MS;
+    bool found = pad_trial(pad);
+    if (found) {
+        uint8_t lo = 0;
+        uint8_t hi = PAD_MAX_MS;
+        while (lo < hi) {
+            pad->ms = (uint8_t) ((lo + hi) / 2);
+            if (pad_trial(pad)) {
+                hi = pad->ms;
+            } else {
+                lo = (uint8_t) (pad->ms + 1);
+            }
+        }
+        // One more for the trials we were lucky in
+        pad->ms = (uint8_t) (hi > 0 ? hi + 1 : 0);
+    } else {
+        pad->ms = old_ms;
+    }
+
+    flow_enable(flow);
+    term_write(TVIPT_FLOW);
+    term_clear();
+    term_discard_input();
+    return found;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Terminal Functions
+//////////////////////////////////////////////////////////////////////////////
+
+void term_init() {
+    dbg_serial.begin(115200);
+
+    dma_init();
+    load_padding();
+    term_autobaud();
+    _tx_window_start = millis();
+
+    term_write(TVIPT_FLOW);
+    term_write(TVIPT_INIT);
+    term_write(TVIPT_80_COLUMNS);
+    term_write(TVIPT_AUTOWRAP);
+    term_write(TVIPT_CLEAR);
+}
+
+// What had been received when term_loop() last ran
+static uint32_t _rx_looked = 0;
+
+bool term_ready() {
+    // Line errors come with a received byte, so they wait for one too
+    return rx_written() != _rx_looked || _rx_again_len > 0 || term_queued() > 0 || catchup_holding() || _baud_lost || term_baud_searching() ||
+           millis() - _tx_window_start >= 1000;
+}
+
+void term_loop() {
+    _rx_looked = rx_written();
+    uart_poll_errors();
+
+    flow_poll();
+
+    if (term_queued() < TERM_CATCHUP_LOW) {
+        catchup_release(term_queued());
+    }
+
+    unsigned long now = millis();
+    if (now - _tx_window_start >= 1000) {
+        _tx_bytes_per_sec = _tx_window_bytes * 1000 / (now - _tx_window_start);
+        _tx_window_bytes = 0;
+        _tx_window_start = now;
+
+        if (!term_baud_searching() && _rx_framing_errors - _baud_window_errors >= TERM_BAUD_LOST_ERRORS) {
+            _baud_lost = true;
+        }
+        _baud_window_errors = _rx_framing_errors;
+    }
+
+    // Probing would put CTRL E and garbage in the middle of a session, so
+    // the search waits until the terminal is back with the command line
+    if (_baud_lost && !sched_terminal_taken()) {
+        dbg_serial.println("term: lost the terminal, looking for its rate");
+        term_autobaud_begin();
+    }
+    baud_step();
 }
 
 void term_clear() {
-    term_serial.write(TVIPT_CLEAR);
+    term_write(TVIPT_CLEAR);
+}
+
+bool term_set_columns(int cols) {
+    if (cols != SCREEN_COLS && cols != SCREEN_NARROW_COLS) {
+        return false;
+    }
+    // What's on the screen doesn't survive the switch in any useful shape
+    char seq[] = {TERM_ESCAPE, cols == SCREEN_COLS ? TERM_80_COLUMNS : TERM_40_COLUMNS, TERM_CLEAR};
+    term_write(seq, sizeof(seq));
+    return true;
+}
+
+byte term_columns() {
+    return screen_cols(&screen_shown);
 }
 
 size_t term_write(const char c) {
-    return term_serial.write(c);
+    return tx_queue((const uint8_t *) &c, 1);
 }
 
 size_t term_write(const uint8_t *buf, size_t size) {
-    return term_serial.write(buf, size);
+    return tx_queue(buf, size);
 }
 
 size_t term_write(const char *buf, size_t size) {
-    return term_serial.write(buf, size);
+    return tx_queue((const uint8_t *) buf, size);
+}
+
+size_t term_write_some(const uint8_t *buf, size_t size) {
+    if (catchup_hold(term_queued())) {
+        return tx_queue(buf, size);
+    }
+
+    // Whole bytes only, each with the padding it needs
+    size_t room = term_writable();
+    bool escape = _pad_escape;
+    size_t count = 0;
+    while (count < size) {
+        size_t need = 1 + pad_bytes(pad_ms(escape, buf[count]));
+        if (need > room) {
+            break;
+        }
+        room -= need;
+        escape = !escape && buf[count] == TERM_ESCAPE;
+        count++;
+    }
+    return tx_queue(buf, count);
 }
 
 void term_write(const char *val) {
-    term_serial.write(val);
+    tx_queue((const uint8_t *) val, strlen(val));
 }
 
 void term_writeln(const char *val) {
-    term_serial.write(val);
-    term_serial.write("\r\n");
+    term_write(val);
+    term_writeln();
 }
 
 void term_writeln() {
-    term_serial.write("\r\n");
+    term_write("\r\n");
 }
 
 void term_write_masked(const char *val) {
     while (*val++ != '\0') {
-        term_serial.write("*");
+        term_write('*');
     }
 }
 
 void term_writeln_masked(const char *val) {
     term_write_masked(val);
-    term_serial.write("\r\n");
+    term_writeln();
+}
+
+static void printf_flush(struct fmt_out *out) {
+    tx_queue((const uint8_t *) out->buf, out->len);
+    out->len = 0;
+}
+
+size_t term_printf(const char *format, ...) {
+    char buf[TERM_PRINTF_BUFSIZE];
+    struct fmt_out out;
+    fmt_init(&out, buf, sizeof(buf), printf_flush);
+
+    va_list args;
+    va_start(args, format);
+    fmt_vformat(&out, format, args);
+    va_end(args);
+
+    printf_flush(&out);
+    return out.total;
 }
 
 void term_print(long val, int format) {
-    term_serial.print(val, format);
+    _term_stream.print(val, format);
+}
+
+void term_print(const Printable &val) {
+    val.printTo(_term_stream);
 }
 
 void term_print(byte row, byte col, char *value) {
@@ -213,53 +1382,32 @@ void term_print(byte row, byte col, char *value) {
 void term_print(byte row, byte col, char *value, size_t width) {
     term_move(row, col);
     if (width > 0) {
-        const char * start = value;
-        while (*value != '\0' && value - start < width) {
-            term_serial.write(*value++);
-        }
+        term_write(value, strnlen(value, width));
     } else {
         term_write(value);
     }
 }
 
 void term_println(long val, int format) {
-    term_serial.print(val, format);
-    term_serial.write("\r\n");
-}
-
-int term_readln(char *buf, int max, readln_echo echo) {
-    char *start = buf;
-    char *end = start + max;
-    while (buf < end) {
-        int c = term_serial.read();
-        if (c != -1) {
-            if (c == '\0' || c == '\r' || c == '\n') {
-                break;
-            }
-            if (echo == READLN_ECHO) {
-                term_write(c);
-            } else if (echo = READLN_MASKED) {
-                term_write('*');
-            }
-            *buf++ = c;
-        }
-    }
-    return buf - start;
+    term_print(val, format);
+    term_writeln();
 }
 
-
-// Row is 1-24, col is 1-80
-void term_move(byte row, byte col) {
-    if (row < 1) { row = 1; }
-    if (row > 24) { row = 24; }
-    if (col < 1) { col = 1; }
-    if (col > 80) { col = 80; }
-
-    term_serial.write(TERM_ESCAPE);
-    term_serial.write(TERM_MOVE_TO_POS);
-    // ASCII 0x20 (SPACE) is row/column value 1, and subsequent ASCII values
-    // enumerate the row/column value space up to ASCII 0x6F ('o') for value
-    // 80.
-    term_serial.write(row + 0x1F);
-    term_serial.write(col + 0x1F);
+PT_THREAD(term_readln(struct pt *pt, struct term_line *line)) {
+    PT_BEGIN(pt);
+    line->len = 0;
+    while (line->len < line->max) {
+        PT_AWAIT_READABLE(pt, term_available());
+        int c = term_read();
+        if (c == '\0' || c == '\r' || c == '\n') {
+            break;
+        }
+        if (line->echo == READLN_ECHO) {
+            term_write((char) c);
+        } else if (line->echo == READLN_MASKED) {
+            term_write('*');
+        }
+        line->buf[line->len++] = (char) c;
+    }
+    PT_END(pt);
 }
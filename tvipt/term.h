@@ -5,6 +5,7 @@
 
 #include <Print.h>
 #include <Arduino.h>
+#include "pt.h"
 
 #define TERM_BREAK    0
 // https://en.wikipedia.org/wiki/Software_flow_control
@@ -12,26 +13,211 @@
 #define TERM_XON                0x11
 #define TERM_ESCAPE             0x1B
 
+// Control characters (see table B-1 in term.cpp)
+#define TERM_SEND_ID            0x05
+#define TERM_CURSOR_LEFT        0x08
+#define TERM_CURSOR_DOWN        0x0A
+#define TERM_CURSOR_UP          0x0B
+#define TERM_CURSOR_RIGHT       0x0C
+#define TERM_RETURN             0x0D
+#define TERM_CLEAR              0x1A
+#define TERM_HOME               0x1E
+#define TERM_NEW_LINE           0x1F
+
+// Escape sequences (see table B-2 in term.cpp)
 #define TERM_CLEAR_TO_SPACES    '+'
 #define TERM_ENABLE_ALT_CHAR    'J'
 #define TERM_DISABLE_ALT_CHAR   'K'
 #define TERM_MOVE_TO_POS        '=' // r c
+#define TERM_ERASE_TO_EOL       'T'
+#define TERM_ERASE_TO_EOP       'Y'
+#define TERM_40_COLUMNS         'p'
+#define TERM_80_COLUMNS         'u'
 
 #define dbg_serial    Serial
 #define term_serial   Serial1
 
+// Size of the ring that queues output for the terminal.  Writes that fit
+// return immediately; the DMA controller drains the ring into the UART.
+#define TERM_TX_BUFSIZE         1024
+
+// Longest term_printf() output that goes to the ring in one write
+#define TERM_PRINTF_BUFSIZE     128
+
+// Size of the ring the DMA controller fills with bytes from the terminal.
+// At 19200 baud this holds about half a second of continuous input, and
+// minutes of typing, while the main loop is stuck in a blocking call.
+#define TERM_RX_BUFSIZE         1024
+
+// Most keys term_unread() can put back
+#define TERM_UNREAD_MAX         64
+
 enum readln_echo {
     READLN_ECHO,
     READLN_NO_ECHO,
     READLN_MASKED,
 };
 
+// A line being read by term_readln()
+struct term_line {
+    char *buf;
+    int max;
+    readln_echo echo;
+    // Chars read so far; buf isn't terminated
+    int len;
+};
+
+struct term_stats {
+    // Bytes queued for the terminal since boot
+    uint32_t tx_bytes;
+    // Transmit rate over the last full second
+    uint32_t tx_bytes_per_sec;
+    // Total time writers waited for room in the transmit ring
+    uint32_t tx_blocked_ms;
+    // Bytes received from the terminal since boot
+    uint32_t rx_bytes;
+    // Bytes lost because the receive ring was full
+    uint32_t rx_overruns;
+    // UART receive errors (polled, so a burst may count once)
+    uint32_t rx_uart_overruns;
+    uint32_t rx_framing_errors;
+    // XOFFs from the terminal, and total time output was paused by them
+    uint32_t xoffs;
+    uint32_t paused_ms;
+    // Bytes term_move() and term_pad() sent, and what ESC = r c and
+    // literal spaces would have sent instead
+    uint32_t motion_bytes;
+    uint32_t motion_naive_bytes;
+    // NULs sent as padding after slow operations
+    uint32_t pad_bytes;
+    // Times catch-up mode skipped ahead, the output it held back, and the
+    // bytes it sent instead
+    uint32_t catchups;
+    uint32_t catchup_held_bytes;
+    uint32_t catchup_sent_bytes;
+    // Times queued output was thrown away (see term_discard_output()), and
+    // the bytes that never went out
+    uint32_t discards;
+    uint32_t discarded_bytes;
+};
+
 void term_init();
 
 void term_loop();
 
+// True when term_loop() has work: received bytes to scan for flow control,
+// output queued or held, a baud search, or the once-a-second stats.
+bool term_ready();
+
+size_t term_queued();
+
+size_t term_tx_free();
+
+void term_flush();
+
+// Throws away output still queued for the terminal (and any catch-up mode
+// is holding), then redraws the screen as the model has it, since the
+// terminal may have been left anywhere.  For aborting floods of output.
+void term_discard_output();
+
+bool term_paused();
+
+// Bytes that can be queued without waiting; 0 while the terminal has paused
+// output with XOFF.  Sessions size network reads with this.
+size_t term_writable();
+
+void term_get_stats(struct term_stats *stats);
+
+// Rates the terminal link can run at, fastest first, ending with 0
+extern const unsigned long term_bauds[];
+
+unsigned long term_baud();
+
+// Asks the terminal for its ID; true if it answered at the current rate.
+bool term_probe();
+
+// Starts looking for the rate the terminal is set to; term_loop() carries
+// the search on, and a rate that answers is remembered for the next boot.
+// If none does, the last good rate is kept.
+void term_autobaud_begin();
+
+// Starts waiting for the terminal to be set to baud: switches to it and asks
+// for the terminal's ID until it answers or timeout_ms passes, then goes
+// back to the old rate.
+void term_set_baud_begin(unsigned long baud, unsigned long timeout_ms);
+
+// True until the search started last is over; write nothing meanwhile
+bool term_baud_searching();
+
+// Whether the last search found the terminal (at term_baud())
+bool term_baud_found();
+
+// A whole autobaud search, waiting for it, for term_init().  Returns 0 if
+// the terminal doesn't answer.
+unsigned long term_autobaud();
+
+// Catch-up holds output from HIGH bytes queued (about an eighth of a second
+// at 19200 baud) until the ring drains below LOW, and replays a burst of
+// up to REPLAY bytes as it is
+#define TERM_CATCHUP_HIGH       256
+#define TERM_CATCHUP_LOW        64
+#define TERM_CATCHUP_REPLAY     512
+
+// In catch-up mode, output that arrives faster than the terminal can show
+// it is collapsed into the difference to the latest screen (see catchup.cpp).
+void term_set_catchup(bool enable);
+
+bool term_catchup();
+
+// A slow terminal operation and how long the terminal needs after it
+struct term_padding {
+    const char *name;
+    // code follows an ESC
+    bool escape;
+    uint8_t code;
+    uint8_t ms;
+};
+
+// Ends with an entry whose name is NULL
+extern struct term_padding term_paddings[];
+
+// Measures the least padding pad needs on the attached terminal and stores
+// it in pad->ms.  Returns false (leaving pad alone) if no padding works.
+bool term_calibrate_padding(struct term_padding *pad);
+
+// Keeps term_paddings for the next boot
+void term_save_padding();
+
+size_t term_available();
+
+int term_read();
+
+size_t term_read(uint8_t *buf, size_t max);
+
+// Puts len keys back to be read again before anything else, for keys read
+// by whoever had the terminal that belong to whoever has it next.  Keeps
+// TERM_UNREAD_MAX at most; the rest count as overruns.
+void term_unread(const uint8_t *buf, size_t len);
+
+void term_discard_input();
+
 void term_clear();
 
+// Switches the terminal to 80 or 40 columns (any other width returns false)
+// and clears it.
+bool term_set_columns(int cols);
+
+byte term_columns();
+
+// The term_write() family (term_print(), term_printf(), term_move() and
+// term_pad() too) waits for room in the transmit ring, which holds up the
+// whole loop behind a slow terminal.  Sessions' own output goes through
+// term_write_some(); what still waits is:
+// - the command line's replies and notices, and the weather display
+// - screen_commit() and screen_redraw(), so term_discard_output()
+// - line mode entering and leaving, and predict.cpp's echo and erase
+// - an ANSI command stepped with less than ANSI_STEP_ROOM left, and the
+//   session manager's own messages
 size_t term_write(const char c);
 
 size_t term_write(const uint8_t *buf, size_t size);
@@ -40,6 +226,10 @@ size_t term_write(const char *buf, size_t size);
 
 void term_write(const char *val);
 
+// Queues as much of buf as fits without waiting and returns how much that
+// was, maybe 0 (always while paused).  Catch-up mode takes all of it.
+size_t term_write_some(const uint8_t *buf, size_t size);
+
 void term_writeln(const char *val);
 
 void term_writeln();
@@ -50,15 +240,27 @@ void term_writeln_masked(const char *val);
 
 void term_print(long val, int format = DEC);
 
+// Formats (see fmt.h) and queues the result with a single write.
+size_t term_printf(const char *format, ...);
+
+void term_print(const Printable &val);
+
 void term_print(byte row, byte col, char *value);
 
 void term_print(byte row, byte col, char *value, size_t width);
 
 void term_println(long val, int format = DEC);
 
-int term_readln(char *buf, int max, readln_echo echo);
+// Reads up to line->max chars into line->buf, echoing them as asked, until
+// RETURN, LF or break.  Waits for keys without holding up the loop.
+PT_THREAD(term_readln(struct pt *pt, struct term_line *line));
 
 void term_move(byte row, byte col);
 
+void term_pad(size_t count);
+
+// Stream adapter over the receive and transmit rings, for code that needs a Stream.
+extern Stream &term_stream;
+
 #endif
 
@@ -0,0 +1,224 @@
+// VT100 output translated for the PT: checked against what the glass ends
+// up showing, and what goes back to the host.
+
+#include "check.h"
+#include "fake_term.h"
+#include "../ansi.h"
+
+// Answers to status requests
+struct reply_buffer {
+    char buf[64];
+    size_t len;
+};
+
+static reply_buffer _reply;
+
+static int reply_write(void *ctx, const uint8_t *buf, size_t len) {
+    struct reply_buffer *reply = (struct reply_buffer *) ctx;
+    for (size_t i = 0; i < len && reply->len < sizeof(reply->buf) - 1; i++) {
+        reply->buf[reply->len++] = (char) buf[i];
+        reply->buf[reply->len] = '\0';
+    }
+    return (int) len;
+}
+
+static void start() {
+    fake_term_reset();
+    _reply.len = 0;
+    _reply.buf[0] = '\0';
+    struct busybox_sink reply = {&_reply, reply_write};
+    ansi_init(reply);
+}
+
+static void host(const char *val) {
+    size_t len = strlen(val);
+    CHECK_EQ(ansi_write((const uint8_t *) val, len), len);
+}
+
+static bool glass_at(int row, int col, const char *text) {
+    return memcmp(&fake_glass.cells[row][col], text, strlen(text)) == 0;
+}
+
+static void test_text() {
+    start();
+    host("hello\r\nworld");
+    CHECK(glass_at(0, 0, "hello"));
+    CHECK(glass_at(1, 0, "world"));
+    CHECK_EQ(fake_glass.row, 1);
+    CHECK_EQ(fake_glass.col, 5);
+}
+
+static void test_position() {
+    start();
+    host("\x1b[5;10HX");
+    CHECK(glass_at(4, 9, "X"));
+    host("\x1b[HY");
+    CHECK(glass_at(0, 0, "Y"));
+    // Out of range is clamped, as on a VT100
+    host("\x1b[99;99H");
+    CHECK_EQ(fake_glass.row, SCREEN_ROWS - 1);
+    CHECK_EQ(fake_glass.col, SCREEN_COLS - 1);
+    host("\x1b[10;1H\x1b[3A\x1b[4C");
+    CHECK_EQ(fake_glass.row, 6);
+    CHECK_EQ(fake_glass.col, 4);
+}
+
+static void test_erase() {
+    start();
+    host("0123456789\x1b[1;5H\x1b[K");
+    CHECK(glass_at(0, 0, "0123      "));
+    host("\x1b[1;10H0123456789\x1b[1;12H\x1b[1K");
+    CHECK(glass_at(0, 0, "            3456789"));
+
+    host("\x1b[2J\x1b[Htop\r\nmiddle\r\nbottom\x1b[2;1H\x1b[J");
+    CHECK(glass_at(0, 0, "top"));
+    CHECK(glass_at(1, 0, "      "));
+    CHECK(glass_at(2, 0, "      "));
+    host("\x1b[2J");
+    CHECK(glass_at(0, 0, "   "));
+    // ED 2 leaves the cursor where it was
+    CHECK_EQ(fake_glass.row, 1);
+}
+
+static void test_lines() {
+    start();
+    host("one\r\ntwo\r\nthree\x1b[2;1H\x1b[L");
+    CHECK(glass_at(1, 0, "   "));
+    CHECK(glass_at(2, 0, "two"));
+    CHECK(glass_at(3, 0, "three"));
+    host("\x1b[2M");
+    CHECK(glass_at(1, 0, "three"));
+}
+
+// The PT has no insert or delete character; the line is redrawn
+static void test_chars() {
+    start();
+    host("abcdef\x1b[1;3H\x1b[2P");
+    CHECK(glass_at(0, 0, "abef  "));
+    CHECK_EQ(fake_glass.col, 2);
+    host("\x1b[3@");
+    CHECK(glass_at(0, 0, "ab   ef"));
+    host("\x1b[2X");
+    CHECK(glass_at(0, 0, "ab   ef"));
+}
+
+// A VT100 waits for the next character to wrap; the PT wraps at once
+static void test_wrap() {
+    start();
+    char line[SCREEN_COLS + 1];
+    memset(line, 'x', SCREEN_COLS);
+    line[SCREEN_COLS] = '\0';
+    host(line);
+    host("\r\nnext");
+    CHECK(glass_at(1, 0, "next"));
+    host("\x1b[1;1H");
+    host(line);
+    host("y");
+    CHECK(glass_at(1, 0, "yext"));
+    // Text up to the bottom-right corner doesn't scroll, and the cursor
+    // stays there for a following move
+    host("\x1b[24;1H");
+    host(line);
+    CHECK(glass_at(0, 0, "xxx"));
+    host("\x1b[D!");
+    CHECK(glass_at(SCREEN_ROWS - 1, SCREEN_COLS - 2, "!"));
+    // A character after it scrolls
+    host("xz");
+    CHECK(glass_at(SCREEN_ROWS - 1, 0, "z"));
+    CHECK(glass_at(SCREEN_ROWS - 2, 0, "xxx"));
+    CHECK(glass_at(0, 0, "yext"));
+}
+
+static void test_dropped() {
+    start();
+    struct ansi_stats before;
+    ansi_get_stats(&before);
+    // Attributes, modes, a title and a DCS string draw nothing
+    host("\x1b[1;31mred\x1b[0m\x1b[?25l\x1b]0;title\x07\x1bPq#0\x1b\\!");
+    CHECK(glass_at(0, 0, "red!"));
+    struct ansi_stats after;
+    ansi_get_stats(&after);
+    CHECK_EQ(after.unsupported, before.unsupported);
+
+    // CAN cancels a sequence
+    host("\x1b[3\x18x");
+    CHECK(glass_at(0, 4, "x"));
+    // UTF-8 becomes one ? a character
+    host("\xc3\xa9");
+    CHECK(glass_at(0, 5, "?"));
+}
+
+static void test_graphics() {
+    start();
+    host("\x1b)0a\x0eq\x0f" "b");
+    CHECK(fake_glass.cells[0][0] == 'a');
+    CHECK(fake_glass.cells[0][1] == (char) ('q' | SCREEN_ALT));
+    CHECK(fake_glass.cells[0][2] == 'b');
+    CHECK(!fake_glass.alt);
+}
+
+static void test_replies() {
+    start();
+    host("\x1b[5;10H\x1b[6n");
+    CHECK_STR(_reply.buf, "\x1b[5;10R");
+
+    _reply.len = 0;
+    host("\x1b[c");
+    CHECK_STR(_reply.buf, "\x1b[?1;0c");
+
+    _reply.len = 0;
+    host("\x1b[5n");
+    CHECK_STR(_reply.buf, "\x1b[0n");
+}
+
+// Bits of a full-screen program's output
+static const char *const _pieces[] = {
+        "\x1b[H\x1b[2J", "\x1b[%d;%dH", "status line", "\r\n", "\x1b[K", "\x1b[J", "\x1b[2L", "\x1b[M",
+        "\x1b[3P", "\x1b[2@", "\x1b[7m", "\x1b[0m", "\x1b(0lqqk\x1b(B", "\x1bM", "\x1b" "7", "\x1b" "8",
+        "the quick brown fox jumps over the lazy dog", "\t", "\b\b", "\x1b[%dC", "\x1b[%dA",
+};
+
+// However little room the terminal has, output translated a bit at a time
+// ends up the same as output translated all at once
+static void test_short_room() {
+    srand(2);
+    for (int round = 0; round < 50; round++) {
+        char out[4096];
+        size_t len = 0;
+        while (len < sizeof(out) - 64) {
+            const char *piece = _pieces[rand() % (sizeof(_pieces) / sizeof(_pieces[0]))];
+            len += (size_t) snprintf(out + len, sizeof(out) - len, piece, 1 + rand() % SCREEN_ROWS,
+                                     1 + rand() % SCREEN_COLS);
+        }
+
+        start();
+        fake_term_room = (size_t) -1;
+        CHECK_EQ(ansi_write((const uint8_t *) out, len), len);
+        struct screen whole = fake_glass;
+
+        start();
+        size_t done = 0;
+        int turns = 0;
+        while (done < len && turns++ < 100000) {
+            fake_term_room = (size_t) (rand() % 200);
+            done += ansi_write((const uint8_t *) out + done, len - done);
+        }
+        CHECK_EQ(done, len);
+        CHECK(memcmp(whole.cells, fake_glass.cells, sizeof(whole.cells)) == 0);
+        CHECK(whole.row == fake_glass.row && whole.col == fake_glass.col);
+    }
+}
+
+int main() {
+    test_text();
+    test_position();
+    test_erase();
+    test_lines();
+    test_chars();
+    test_wrap();
+    test_dropped();
+    test_graphics();
+    test_replies();
+    test_short_room();
+    return check_failures();
+}
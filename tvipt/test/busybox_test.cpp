@@ -0,0 +1,459 @@
+// The busybox telnet engine with its sinks going to buffers: negotiation,
+// data both ways, two sessions at once, the console escape menu, the
+// emulation's answers going out through the session, LINEMODE, and flow
+// control.
+
+#include "check.h"
+#include "fake_term.h"
+#include "../busybox.h"
+#include "../ansi.h"
+
+#define IAC     "\xff"
+#define WILL    "\xfb"
+#define WONT    "\xfc"
+#define DO      "\xfd"
+#define DONT    "\xfe"
+#define SB      "\xfa"
+#define SE      "\xf0"
+#define IP      "\xf4"
+#define AO      "\xf5"
+#define DM      "\xf2"
+#define ECHO    "\x01"
+#define SGA     "\x03"
+#define TTYPE   "\x18"
+#define NAWS    "\x1f"
+#define LFLOW   "\x21"
+#define LINEMODE "\x22"
+
+// LINEMODE suboptions and modes
+#define LM_MODE         "\x01"
+#define LM_FORWARDMASK  "\x02"
+#define LM_SLC          "\x03"
+#define MODE_EDIT       "\x01"
+#define MODE_EDIT_ACK   "\x05"
+#define MODE_EDIT_TRAPSIG "\x03"
+
+// What busybox.cpp needs from term.cpp and line.cpp beyond fake_term
+static int _columns_set = 0;
+
+bool term_set_columns(int cols) {
+    _columns_set = cols;
+    char seq[] = {TERM_ESCAPE, cols == SCREEN_COLS ? TERM_80_COLUMNS : TERM_40_COLUMNS, TERM_CLEAR};
+    term_write(seq, sizeof(seq));
+    return true;
+}
+
+void term_discard_output() {
+}
+
+void line_end() {
+}
+
+struct sink_buffer {
+    uint8_t buf[256];
+    size_t len;
+};
+
+static int sink_write(void *ctx, const uint8_t *buf, size_t len) {
+    struct sink_buffer *sink = (struct sink_buffer *) ctx;
+    size_t n = min(len, sizeof(sink->buf) - sink->len);
+    memcpy(sink->buf + sink->len, buf, n);
+    sink->len += n;
+    return (int) len;
+}
+
+struct session {
+    struct busybox *bb;
+    struct sink_buffer net;
+    struct sink_buffer term;
+};
+
+static void open_session(struct session *s) {
+    memset(s, 0, sizeof(*s));
+    struct busybox_sink net = {&s->net, sink_write};
+    struct busybox_sink term = {&s->term, sink_write};
+    s->bb = busybox_open(80, 24, (char *) "vt100", net, term, NULL);
+    CHECK(s->bb != NULL);
+}
+
+static void clear(struct session *s) {
+    s->net.len = 0;
+    s->term.len = 0;
+}
+
+static void server(struct session *s, const char *val, size_t len) {
+    byte buf[64];
+    memcpy(buf, val, len);
+    busybox_handle_net_input(s->bb, buf, (int) len);
+}
+
+static void type(struct session *s, const char *val, size_t len) {
+    byte buf[64];
+    memcpy(buf, val, len);
+    busybox_handle_net_output(s->bb, buf, (int) len);
+}
+
+// sizeof, not strlen, since the sequences have NULs in them
+#define SERVER(s, val) server(s, val, sizeof(val) - 1)
+#define TYPE(s, val) type(s, val, sizeof(val) - 1)
+
+static bool sent(struct sink_buffer *sink, const char *val, size_t len) {
+    for (size_t i = 0; i + len <= sink->len; i++) {
+        if (memcmp(sink->buf + i, val, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#define SENT(sink, val) sent(sink, val, sizeof(val) - 1)
+
+static void test_negotiation() {
+    struct session s;
+    open_session(&s);
+
+    SERVER(&s, IAC DO TTYPE IAC DO NAWS);
+    CHECK(SENT(&s.net, IAC WILL TTYPE));
+    CHECK(SENT(&s.net, IAC WILL NAWS IAC SB NAWS "\0\x50\0\x18" IAC SE));
+
+    clear(&s);
+    SERVER(&s, IAC SB TTYPE "\x01" IAC SE);
+    CHECK(SENT(&s.net, IAC SB TTYPE "\0vt100" IAC SE));
+
+    // The server echoing puts us in character mode
+    CHECK(!busybox_remote_echo(s.bb));
+    clear(&s);
+    SERVER(&s, IAC WILL ECHO IAC WILL SGA);
+    CHECK(SENT(&s.net, IAC DO ECHO));
+    CHECK(SENT(&s.net, IAC DO SGA));
+    CHECK(busybox_remote_echo(s.bb));
+    CHECK(!busybox_local_edit(s.bb));
+
+    // Options we don't know are refused
+    clear(&s);
+    SERVER(&s, IAC DO "\x63" IAC WILL "\x64");
+    CHECK(SENT(&s.net, IAC WONT "\x63"));
+    CHECK(SENT(&s.net, IAC DONT "\x64"));
+
+    busybox_close(s.bb);
+}
+
+static void test_data() {
+    struct session s;
+    open_session(&s);
+
+    // Commands are taken out of what the terminal sees, and IAC IAC is 255
+    SERVER(&s, "a" IAC IAC "b" IAC WONT "\x63" "c");
+    CHECK_EQ(s.term.len, 4);
+    CHECK(memcmp(s.term.buf, "a\xff" "bc", 4) == 0);
+
+    // Typed 255 is doubled, and Enter is CR LF
+    TYPE(&s, "x\xff\r");
+    CHECK_EQ(s.net.len, 5);
+    CHECK(memcmp(s.net.buf, "x" IAC IAC "\r\n", 5) == 0);
+
+    busybox_close(s.bb);
+}
+
+static void test_break() {
+    struct session s;
+    open_session(&s);
+    SERVER(&s, IAC WILL ECHO IAC WILL SGA);
+    clear(&s);
+
+    // ^C is the server's
+    TYPE(&s, "\x03");
+    CHECK_EQ(s.net.len, 1);
+    CHECK(!busybox_discarding(s.bb));
+
+    // Break interrupts, and drops what comes until the server's DM
+    clear(&s);
+    TYPE(&s, "\0");
+    CHECK(SENT(&s.net, IAC IP IAC AO IAC DM));
+    CHECK(busybox_discarding(s.bb));
+    SERVER(&s, "flood");
+    CHECK_EQ(s.term.len, 0);
+    SERVER(&s, "more" IAC DM "$ ");
+    CHECK(!busybox_discarding(s.bb));
+    CHECK_EQ(s.term.len, 2);
+    CHECK(SENT(&s.term, "$ "));
+
+    busybox_close(s.bb);
+}
+
+static void test_sessions() {
+    struct session a;
+    struct session b;
+    open_session(&a);
+    open_session(&b);
+
+    struct session c;
+    struct busybox_sink none = {NULL, sink_write};
+    c.bb = busybox_open(80, 24, (char *) "vt100", none, none, NULL);
+    CHECK(c.bb == NULL);
+
+    // Each is negotiated on its own, and writes only to its own sinks
+    SERVER(&a, IAC WILL ECHO IAC WILL SGA);
+    SERVER(&b, IAC DO TTYPE);
+    CHECK(busybox_remote_echo(a.bb));
+    CHECK(!busybox_remote_echo(b.bb));
+    CHECK(SENT(&a.net, IAC DO ECHO));
+    CHECK(!SENT(&a.net, IAC WILL TTYPE));
+    CHECK(SENT(&b.net, IAC WILL TTYPE));
+    CHECK(!SENT(&b.net, IAC DO ECHO));
+
+    clear(&a);
+    clear(&b);
+    SERVER(&b, "to b");
+    CHECK_EQ(a.term.len, 0);
+    CHECK(SENT(&b.term, "to b"));
+
+    busybox_close(a.bb);
+    busybox_close(b.bb);
+}
+
+static void test_escape() {
+    struct session s;
+    open_session(&s);
+    SERVER(&s, IAC WILL ECHO IAC WILL SGA);
+    clear(&s);
+
+    // What's typed before the escape goes; the menu waits for a key
+    TYPE(&s, "ab\x1d");
+    CHECK_EQ(s.net.len, 2);
+    CHECK(SENT(&s.term, "Console escape"));
+    CHECK(!busybox_exited(s.bb));
+
+    // An unknown answer goes back to the session, and what follows it is
+    // typed as usual
+    clear(&s);
+    TYPE(&s, "xy");
+    CHECK(SENT(&s.term, "continuing"));
+    CHECK_EQ(s.net.len, 1);
+    CHECK(SENT(&s.net, "y"));
+
+    // The answer can come in the same read as the escape
+    clear(&s);
+    _columns_set = 0;
+    TYPE(&s, "\x1dwz");
+    CHECK_EQ(_columns_set, SCREEN_NARROW_COLS);
+    CHECK(SENT(&s.net, "z"));
+
+    TYPE(&s, "\x1d");
+    TYPE(&s, "e");
+    CHECK(busybox_exited(s.bb));
+
+    busybox_close(s.bb);
+}
+
+static struct busybox *_reply_bb;
+
+static int reply_write(void *, const uint8_t *buf, size_t len) {
+    busybox_reply(_reply_bb, buf, len);
+    return (int) len;
+}
+
+static void test_reply() {
+    struct session s;
+    open_session(&s);
+    fake_term_reset();
+    _reply_bb = s.bb;
+    struct busybox_sink reply = {NULL, reply_write};
+    ansi_init(reply);
+
+    struct busybox_stats before;
+    busybox_get_stats(&before);
+
+    // A cursor position report goes to the server as data, through the sink
+    const char *query = "\x1b[3;7H\x1b[6n";
+    ansi_write((const uint8_t *) query, strlen(query));
+    CHECK(SENT(&s.net, "\x1b[3;7R"));
+
+    struct busybox_stats after;
+    busybox_get_stats(&after);
+    CHECK(after.net_writes > before.net_writes);
+
+    busybox_close(s.bb);
+}
+
+// The server asks for LINEMODE with MODE EDIT
+static void open_linemode(struct session *s) {
+    open_session(s);
+    SERVER(s, IAC DO LINEMODE);
+    CHECK(SENT(&s->net, IAC WILL LINEMODE));
+    SERVER(s, IAC SB LINEMODE LM_MODE MODE_EDIT IAC SE);
+    clear(s);
+}
+
+static void test_linemode_mode() {
+    struct session s;
+    open_session(&s);
+
+    SERVER(&s, IAC DO LINEMODE);
+    CHECK(SENT(&s.net, IAC WILL LINEMODE));
+
+    // Without EDIT, keys go as they're typed
+    clear(&s);
+    TYPE(&s, "k");
+    CHECK_EQ(s.net.len, 1);
+
+    // MODE EDIT is acked, and keys wait for the line
+    clear(&s);
+    SERVER(&s, IAC SB LINEMODE LM_MODE MODE_EDIT IAC SE);
+    CHECK(SENT(&s.net, IAC SB LINEMODE LM_MODE MODE_EDIT_ACK IAC SE));
+    CHECK(busybox_local_edit(s.bb));
+
+    // A MODE carrying ACK answers ours and gets no reply
+    clear(&s);
+    SERVER(&s, IAC SB LINEMODE LM_MODE MODE_EDIT_ACK IAC SE);
+    CHECK_EQ(s.net.len, 0);
+    CHECK(busybox_local_edit(s.bb));
+
+    busybox_close(s.bb);
+}
+
+static void test_linemode_slc() {
+    struct session s;
+    open_linemode(&s);
+
+    // 0 SLC_DEFAULT 0 gets our whole table, from SYNCH on
+    SERVER(&s, IAC SB LINEMODE LM_SLC "\0\x03\0" IAC SE);
+    CHECK(SENT(&s.net, IAC SB LINEMODE LM_SLC "\x01\0\0" "\x02\0\0" "\x03\x62\x03"));
+    CHECK(SENT(&s.net, "\x0a\x02\x7f" "\x0b\x02\x15" "\x0c\x02\x17"));
+    CHECK(SENT(&s.net, IAC SE));
+
+    // A value from the server is taken and acked: EL becomes ^X
+    clear(&s);
+    SERVER(&s, IAC SB LINEMODE LM_SLC "\x0b\x02\x18" IAC SE);
+    CHECK(SENT(&s.net, IAC SB LINEMODE LM_SLC "\x0b\x82\x18" IAC SE));
+
+    // One that's acked already is taken without a word: EC becomes ^H
+    clear(&s);
+    SERVER(&s, IAC SB LINEMODE LM_SLC "\x0a\x82\x08" IAC SE);
+    CHECK_EQ(s.net.len, 0);
+
+    TYPE(&s, "gone\x18" "ab\x08" "c\r");
+    CHECK_EQ(s.net.len, 4);
+    CHECK(SENT(&s.net, "ac\r\n"));
+
+    busybox_close(s.bb);
+}
+
+static void test_linemode_forward() {
+    struct session s;
+    open_linemode(&s);
+
+    // ';' (0x3b) is bit 0x10 of the eighth byte
+    SERVER(&s, IAC SB LINEMODE DO LM_FORWARDMASK "\0\0\0\0\0\0\0\x10" IAC SE);
+    CHECK(SENT(&s.net, IAC SB LINEMODE WILL LM_FORWARDMASK IAC SE));
+
+    clear(&s);
+    TYPE(&s, "cd /tmp;");
+    CHECK_EQ(s.net.len, 8);
+    CHECK(SENT(&s.net, "cd /tmp;"));
+    clear(&s);
+    TYPE(&s, "ls");
+    CHECK_EQ(s.net.len, 0);
+
+    busybox_close(s.bb);
+}
+
+// Editing is done here, and only the finished line goes out, in one write
+static void test_linemode_edit() {
+    struct session s;
+    open_linemode(&s);
+
+    struct busybox_stats before;
+    busybox_get_stats(&before);
+    // EL, two ECs and an EW
+    TYPE(&s, "junk\x15" "ecgo\x7f\x7f" "ho hi there\x17" "you");
+    CHECK_EQ(s.net.len, 0);
+    TYPE(&s, "\r");
+
+    struct busybox_stats after;
+    busybox_get_stats(&after);
+    CHECK_EQ(after.net_writes - before.net_writes, 1);
+    CHECK_EQ(after.lines - before.lines, 1);
+    CHECK_EQ(s.net.len, 13);
+    CHECK(memcmp(s.net.buf, "echo hi you\r\n", 13) == 0);
+
+    busybox_close(s.bb);
+}
+
+// With TRAPSIG, ^C is the telnet interrupt
+static void test_linemode_trapsig() {
+    struct session s;
+    open_session(&s);
+    SERVER(&s, IAC DO LINEMODE);
+    SERVER(&s, IAC SB LINEMODE LM_MODE MODE_EDIT_TRAPSIG IAC SE);
+    clear(&s);
+
+    TYPE(&s, "half\x03");
+    CHECK(SENT(&s.net, IAC IP));
+    CHECK(!SENT(&s.net, "half"));
+    CHECK(!SENT(&s.net, "\x03"));
+
+    busybox_close(s.bb);
+}
+
+// RFC 1372: agreed to, and what the server asks for is only recorded
+static void test_flow() {
+    struct session s;
+    open_session(&s);
+
+    SERVER(&s, IAC DO LFLOW);
+    CHECK(SENT(&s.net, IAC WILL LFLOW));
+    struct busybox_stats stats;
+    busybox_get_stats(&stats);
+    CHECK(stats.flow_agreed);
+    CHECK_EQ(stats.flow_mode, 1);
+    uint32_t requests = stats.flow_requests;
+
+    // OFF, RESTART-ANY, RESTART-XON and back ON
+    const char modes[] = {0, 2, 3, 1};
+    for (size_t i = 0; i < sizeof(modes); i++) {
+        clear(&s);
+        char sb[] = IAC SB LFLOW "?" IAC SE;
+        sb[3] = modes[i];
+        SERVER(&s, sb);
+        CHECK_EQ(s.net.len, 0);
+        busybox_get_stats(&stats);
+        CHECK_EQ(stats.flow_mode, modes[i]);
+        CHECK_EQ(stats.flow_requests, requests + i + 1);
+    }
+
+    busybox_close(s.bb);
+}
+
+// A server that asked for NAWS hears of the switch to 40 columns
+static void test_naws_narrow() {
+    struct session s;
+    open_session(&s);
+    // test_escape() left it at 40
+    term_set_columns(SCREEN_COLS);
+    SERVER(&s, IAC WILL ECHO IAC WILL SGA IAC DO NAWS);
+    clear(&s);
+
+    TYPE(&s, "\x1dw");
+    CHECK_EQ(term_columns(), SCREEN_NARROW_COLS);
+    CHECK(SENT(&s.net, IAC SB NAWS "\0\x28\0\x18" IAC SE));
+
+    busybox_close(s.bb);
+}
+
+int main() {
+    test_negotiation();
+    test_data();
+    test_break();
+    test_sessions();
+    test_escape();
+    test_reply();
+    test_linemode_mode();
+    test_linemode_slc();
+    test_linemode_forward();
+    test_linemode_edit();
+    test_linemode_trapsig();
+    test_flow();
+    test_naws_narrow();
+    return check_failures();
+}
@@ -0,0 +1,132 @@
+// Catch-up mode against a terminal that can't keep up: a scrolling log and
+// a full-screen program redrawing, arriving from the server faster than
+// 19200 baud drains.  The hold and release policy is catchup.cpp's, over
+// the real screen model; the UART is a count of queued bytes drained in
+// simulated time.
+
+#include <stdio.h>
+#include "check.h"
+#include "fake_term.h"
+#include "../catchup.h"
+
+#define BAUD                19200
+// What the server sends while the terminal has room, 50 KB/s
+#define NET_BYTES_PER_MS    50
+
+struct run {
+    double queued;
+    uint32_t tx_before;
+};
+
+static uint32_t tx_bytes() {
+    struct term_stats stats;
+    term_get_stats(&stats);
+    return stats.tx_bytes;
+}
+
+// Counts what the fake terminal was sent since the last call as queued
+static void queue_sent(struct run *run) {
+    uint32_t tx = tx_bytes();
+    run->queued += tx - run->tx_before;
+    run->tx_before = tx;
+}
+
+// What term.cpp's tx_queue() does with output
+static void output(struct run *run, const uint8_t *buf, size_t len) {
+    if (catchup_hold((size_t) run->queued)) {
+        catchup_keep(buf, len);
+        return;
+    }
+    term_write(buf, len);
+    queue_sent(run);
+}
+
+// And term_loop()
+static void release(struct run *run) {
+    if (run->queued < TERM_CATCHUP_LOW) {
+        catchup_release((size_t) run->queued);
+        queue_sent(run);
+    }
+}
+
+// Plays stream through, a millisecond at a time; prints the bytes the
+// terminal was sent, how long it took to show the last of them, and the
+// most that was ever queued, which it returns.
+static double play(const char *name, const uint8_t *stream, size_t len, bool catchup) {
+    fake_term_reset();
+    catchup_enable(catchup);
+    struct run run;
+    memset(&run, 0, sizeof(run));
+    run.tx_before = tx_bytes();
+
+    struct screen want;
+    screen_reset(&want);
+    for (size_t i = 0; i < len; i++) {
+        screen_apply(&want, stream[i]);
+    }
+
+    uint32_t sent_before = tx_bytes();
+    size_t done = 0;
+    long ms = 0;
+    double max_queued = 0;
+    while (done < len || catchup_holding() || run.queued > 0) {
+        // Sessions read no more than the ring has room for
+        size_t room = run.queued < TERM_TX_BUFSIZE - 1 ? (size_t) (TERM_TX_BUFSIZE - 1 - run.queued) : 0;
+        size_t n = min(min(len - done, (size_t) NET_BYTES_PER_MS), room);
+        if (n > 0) {
+            output(&run, stream + done, n);
+            done += n;
+        }
+        max_queued = max(max_queued, run.queued);
+        run.queued = max(0.0, run.queued - BAUD / 10.0 / 1000);
+        release(&run);
+        ms++;
+    }
+
+    // A typed key's echo waits behind whatever is queued
+    printf("%-4s %-8s %6u bytes in, %6u sent, %5.1f s to show, echo waits up to %3.0f ms\n", name,
+           catchup ? "catch-up" : "straight", (unsigned) len, (unsigned) (tx_bytes() - sent_before), ms / 1000.0,
+           max_queued * 10000 / BAUD);
+    CHECK(memcmp(fake_glass.cells, want.cells, sizeof(want.cells)) == 0);
+    return max_queued;
+}
+
+static uint8_t _stream[200000];
+
+static size_t append(size_t len, const char *val) {
+    size_t n = strlen(val);
+    memcpy(_stream + len, val, n);
+    return len + n;
+}
+
+int main() {
+    // A log scrolling by
+    size_t len = 0;
+    for (int i = 0; i < 2000; i++) {
+        char line[100];
+        snprintf(line, sizeof(line), "Oct 16 12:%02d:%02d tvipt sshd[%d]: Accepted publickey from 10.0.0.%d\r\n",
+                 i / 60 % 60, i % 60, 1000 + i, i % 250);
+        len = append(len, line);
+    }
+    // A key's echo never waits longer for catching up than it would have
+    CHECK(play("log", _stream, len, true) <= play("log", _stream, len, false));
+
+    // top redrawing its table once a second for a few minutes, in the PT's
+    // own sequences
+    len = 0;
+    for (int frame = 0; frame < 200; frame++) {
+        char line[100];
+        len = append(len, "\x1e");
+        snprintf(line, sizeof(line), "top - 12:%02d:%02d up 3 days, load average: 0.%02d", frame / 60,
+                 frame % 60, frame % 100);
+        len = append(len, line);
+        for (int row = 2; row < SCREEN_ROWS; row++) {
+            snprintf(line, sizeof(line), "\x1b=%c%c%5d user %3d.%d %4d:%02d.%02d process-%d", 0x20 + row, 0x20,
+                     1000 + row, (frame * 7 + row * 13) % 100, frame % 10, frame / 60, frame % 60, row, row);
+            len = append(len, line);
+        }
+    }
+    CHECK(play("top", _stream, len, true) <= play("top", _stream, len, false));
+
+    return check_failures();
+}
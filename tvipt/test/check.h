@@ -0,0 +1,43 @@
+// Checks for the host tests.  A failed check is reported and the test goes
+// on; main() returns check_failures() so run.sh sees it.
+
+#ifndef _CHECK_H
+#define _CHECK_H
+
+#include <stdio.h>
+
+static int _check_failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            _check_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        long _a = (long) (a); \
+        long _b = (long) (b); \
+        if (_a != _b) { \
+            printf("%s:%d: check failed: %s == %s (%ld != %ld)\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+            _check_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_STR(a, b) do { \
+        const char *_a = (a); \
+        const char *_b = (b); \
+        if (strcmp(_a, _b) != 0) { \
+            printf("%s:%d: check failed: %s == %s (\"%s\" != \"%s\")\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+            _check_failures++; \
+        } \
+    } while (0)
+
+static inline int check_failures() {
+    if (_check_failures > 0) {
+        printf("%d failed\n", _check_failures);
+    }
+    return _check_failures > 0 ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,175 @@
+// Coalescing typed bytes into TLS records: a paste arriving at the UART's
+// rate and someone typing a few keys a second, with telnets.cpp's policy
+// (telnets_flush_due()) at several budgets.  Each session pass is a
+// simulated millisecond and reads whatever the terminal has sent since the
+// last.
+
+#include <stdio.h>
+#include <string.h>
+#include "check.h"
+#include "fake_term.h"
+#include "../telnets.h"
+#include "../net.h"
+#include "../sched.h"
+
+#define BAUD            19200
+// Header, explicit nonce and tag of an AES-GCM record
+#define RECORD_OVERHEAD 29
+
+#define QUIET_MS        1000
+
+// What telnets.cpp and the modules it uses need from the firmware beyond
+// fake_term; nothing here opens a session
+int sched_add(const char *, void (*)(), bool (*)(), uint16_t, uint16_t, uint8_t) {
+    return -1;
+}
+
+void sched_remove(int) {
+}
+
+void sched_set_flags(int, uint8_t) {
+}
+
+void term_writeln(const char *val) {
+    term_write(val);
+    term_writeln();
+}
+
+void term_writeln() {
+    term_write("\r\n");
+}
+
+bool term_set_columns(int) {
+    return true;
+}
+
+void term_discard_output() {
+}
+
+int net_watch(Client &) {
+    return NET_NO_WATCH;
+}
+
+void net_unwatch(int) {
+}
+
+int net_available(Client &client) {
+    return client.available();
+}
+
+bool net_pending(int) {
+    return false;
+}
+
+bool net_connected(Client &client, int) {
+    return client.connected();
+}
+
+struct run {
+    unsigned int coalesce_ms;
+    size_t coalesce_max;
+    size_t out_len;
+    unsigned long out_since;
+    unsigned long out_quiet;
+    unsigned long last_key;
+    // When each waiting byte was typed
+    unsigned long typed[TELNETS_BATCH_MAX];
+    uint32_t records;
+    uint32_t payload;
+    unsigned long waited_ms;
+    unsigned long waited_max_ms;
+};
+
+static void flush_out(struct run *run, unsigned long now) {
+    run->records++;
+    run->payload += run->out_len;
+    for (size_t i = 0; i < run->out_len; i++) {
+        unsigned long waited = now - run->typed[i];
+        run->waited_ms += waited;
+        if (waited > run->waited_max_ms) {
+            run->waited_max_ms = waited;
+        }
+    }
+    run->out_len = 0;
+}
+
+// One pass of telnets.cpp's coalesce_out(): take what was typed (no more
+// than the batch has room for) and send the batch if it's due
+static size_t pass(struct run *run, const char *keys, size_t len, unsigned long now) {
+    size_t n = len < run->coalesce_max - run->out_len ? len : run->coalesce_max - run->out_len;
+    if (n > 0) {
+        if (run->out_len == 0) {
+            run->out_since = now;
+            run->out_quiet = now - run->last_key;
+        }
+        run->last_key = now;
+        for (size_t i = 0; i < n; i++) {
+            run->typed[run->out_len + i] = now;
+        }
+        run->out_len += n;
+    }
+    if (run->out_len > 0 && telnets_flush_due((const uint8_t *) keys, n, run->out_len, now - run->out_since,
+                                              run->out_quiet, (uint8_t) run->coalesce_ms, run->coalesce_max)) {
+        flush_out(run, now);
+    }
+    return n;
+}
+
+// Plays keys typed one every gap_us (bytes from the UART are at least a
+// character time apart), prints the records they went out in, and returns
+// the longest a key waited
+static unsigned long play(const char *name, const char *keys, unsigned long gap_us, unsigned int coalesce_ms) {
+    struct run run;
+    memset(&run, 0, sizeof(run));
+    run.coalesce_ms = coalesce_ms;
+    run.coalesce_max = TELNETS_BATCH_MAX;
+
+    size_t len = strlen(keys);
+    size_t done = 0;
+    // A second after the terminal last sent anything
+    unsigned long now = QUIET_MS;
+    while (done < len || run.out_len > 0) {
+        // Typed by the end of this millisecond
+        size_t typed = (now - QUIET_MS) * 1000 / gap_us + 1;
+        if (typed > len) {
+            typed = len;
+        }
+        done += pass(&run, keys + done, typed - done, now);
+        now++;
+    }
+
+    printf("%-5s %2u ms: %5u records, %5.1f bytes/record, %4.0f%% overhead, key waits %4.1f ms mean, %2lu ms max\n",
+           name, coalesce_ms, (unsigned) run.records, run.payload / (double) run.records,
+           100.0 * run.records * RECORD_OVERHEAD / (run.records * RECORD_OVERHEAD + run.payload),
+           run.waited_ms / (double) run.payload, run.waited_max_ms);
+    CHECK(run.payload == len);
+    return run.waited_max_ms;
+}
+
+static char _paste[4096];
+static char _typing[512];
+
+int main() {
+    // A shell script pasted in, at the UART's 10 bits a character
+    size_t len = 0;
+    while (len + 64 < sizeof(_paste)) {
+        len += (size_t) snprintf(_paste + len, sizeof(_paste) - len, "cp -a /srv/www/site-%u /backup/www/\r",
+                                 (unsigned) len % 97);
+    }
+    unsigned int budgets[] = {0, TELNETS_COALESCE_MS, TELNETS_COALESCE_MAX_MS};
+    for (unsigned int ms : budgets) {
+        play("paste", _paste, 10000000UL / BAUD, ms);
+    }
+
+    // Typing a command line at about 8 keys a second
+    len = 0;
+    while (len + 40 < sizeof(_typing)) {
+        len += (size_t) snprintf(_typing + len, sizeof(_typing) - len, "ls -l /var/log\r");
+    }
+    // Typed keys go at once whatever the budget
+    for (unsigned int ms : budgets) {
+        CHECK_EQ(play("typed", _typing, 125000, ms), 0);
+    }
+
+    return check_failures();
+}
@@ -0,0 +1,139 @@
+#include "fake_term.h"
+
+uint8_t fake_term_out[FAKE_TERM_OUT_MAX];
+size_t fake_term_len = 0;
+struct screen fake_glass;
+size_t fake_term_room = 1023;
+unsigned long fake_millis = 0;
+
+unsigned long fake_term_baud = 19200;
+
+static uint32_t _tx_bytes = 0;
+
+class null_print : public Print {
+public:
+    size_t write(uint8_t) {
+        return 1;
+    }
+
+    using Print::write;
+};
+
+static null_print _log;
+Print &Serial = _log;
+
+static uint8_t _keys[256];
+static size_t _keys_len = 0;
+static size_t _keys_read = 0;
+
+unsigned long millis() {
+    return fake_millis;
+}
+
+unsigned long micros() {
+    return fake_millis * 1000;
+}
+
+void fake_term_reset() {
+    screen_reset(&screen_shown);
+    screen_apply(&screen_shown, TERM_CLEAR);
+    fake_glass = screen_shown;
+    fake_term_room = 1023;
+    fake_term_clear_out();
+    _keys_len = 0;
+    _keys_read = 0;
+}
+
+void fake_term_type(const char *keys) {
+    size_t len = min(strlen(keys), sizeof(_keys) - _keys_len);
+    memcpy(_keys + _keys_len, keys, len);
+    _keys_len += len;
+}
+
+size_t term_available() {
+    return _keys_len - _keys_read;
+}
+
+int term_read() {
+    return _keys_read < _keys_len ? _keys[_keys_read++] : -1;
+}
+
+size_t term_read(uint8_t *buf, size_t max) {
+    size_t len = min(max, term_available());
+    memcpy(buf, _keys + _keys_read, len);
+    _keys_read += len;
+    if (_keys_read == _keys_len) {
+        _keys_len = 0;
+        _keys_read = 0;
+    }
+    return len;
+}
+
+void term_unread(const uint8_t *buf, size_t len) {
+    size_t left = _keys_len - _keys_read;
+    len = min(len, sizeof(_keys) - left);
+    memmove(_keys + len, _keys + _keys_read, left);
+    memcpy(_keys, buf, len);
+    _keys_len = len + left;
+    _keys_read = 0;
+}
+
+unsigned long term_baud() {
+    return fake_term_baud;
+}
+
+void fake_term_clear_out() {
+    fake_term_len = 0;
+}
+
+bool fake_term_in_sync() {
+    return memcmp(fake_glass.cells, screen_shown.cells, sizeof(fake_glass.cells)) == 0 &&
+           fake_glass.row == screen_shown.row && fake_glass.col == screen_shown.col;
+}
+
+size_t term_write(const uint8_t *buf, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        screen_apply(&screen_shown, buf[i]);
+        screen_apply(&fake_glass, buf[i]);
+        if (fake_term_len < FAKE_TERM_OUT_MAX) {
+            fake_term_out[fake_term_len++] = buf[i];
+        }
+    }
+    _tx_bytes += size;
+    return size;
+}
+
+size_t term_write(const char c) {
+    return term_write((const uint8_t *) &c, 1);
+}
+
+size_t term_write(const char *buf, size_t size) {
+    return term_write((const uint8_t *) buf, size);
+}
+
+void term_write(const char *val) {
+    term_write(val, strlen(val));
+}
+
+size_t term_write_some(const uint8_t *buf, size_t size) {
+    size_t n = min(size, fake_term_room);
+    fake_term_room -= n;
+    return term_write(buf, n);
+}
+
+size_t term_writable() {
+    return fake_term_room;
+}
+
+void term_clear() {
+    term_write((char) TERM_CLEAR);
+}
+
+byte term_columns() {
+    return screen_cols(&screen_shown);
+}
+
+void term_get_stats(struct term_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->tx_bytes = _tx_bytes;
+}
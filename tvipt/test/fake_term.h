@@ -0,0 +1,38 @@
+// A terminal for host tests: what term.h's writers send is kept in
+// fake_term_out and played on fake_glass, a model of the real glass kept
+// apart from screen_shown, so tests can check what the terminal would show.
+
+#ifndef _FAKE_TERM_H
+#define _FAKE_TERM_H
+
+#include "../term.h"
+#include "../screen.h"
+
+#define FAKE_TERM_OUT_MAX   16384
+
+extern uint8_t fake_term_out[FAKE_TERM_OUT_MAX];
+extern size_t fake_term_len;
+
+extern struct screen fake_glass;
+
+// What term_writable() and term_write_some() say there's room for
+extern size_t fake_term_room;
+
+extern unsigned long fake_millis;
+
+// What term_baud() says
+extern unsigned long fake_term_baud;
+
+// Keys the terminal sends, read back with term_read()
+void fake_term_type(const char *keys);
+
+// A blank, valid screen on both sides and nothing sent
+void fake_term_reset();
+
+// Forgets what was sent so far
+void fake_term_clear_out();
+
+// True if the glass shows what screen_shown says it does
+bool fake_term_in_sync();
+
+#endif
@@ -0,0 +1,95 @@
+// fmt() against the C library's snprintf() where they overlap, and our own
+// conversions on their own.
+
+#include <stdio.h>
+#include <limits.h>
+#include <IPAddress.h>
+#include "check.h"
+#include "../fmt.h"
+
+// Formats with both and checks they agree
+#define SAME(...) do { \
+        char ours[128]; \
+        char libc[128]; \
+        size_t len = fmt(ours, sizeof(ours), __VA_ARGS__); \
+        snprintf(libc, sizeof(libc), __VA_ARGS__); \
+        CHECK_STR(ours, libc); \
+        CHECK_EQ(len, strlen(libc)); \
+    } while (0)
+
+static void test_like_printf() {
+    SAME("plain text");
+    SAME("%d %i %d", 0, -42, INT_MAX);
+    SAME("%d", INT_MIN);
+    SAME("%ld %lu", LONG_MIN, ULONG_MAX);
+    SAME("%lld %llu", LLONG_MIN, ULLONG_MAX);
+    SAME("%u %x %X", 3000000000U, 0xbeefU, 0xbeefU);
+    SAME("[%5d] [%-5d] [%05d]", 42, 42, 42);
+    SAME("[%05d] [%5d]", -42, -42);
+    SAME("[%*d] [%*d]", 6, 7, -6, 7);
+    SAME("[%c] [%3c] [%-3c]", 'a', 'b', 'c');
+    SAME("[%s] [%8s] [%-8s] [%2s]", "str", "str", "str", "longer");
+    SAME("100%%");
+    SAME("%08lx", 0xdeadUL);
+}
+
+static void test_ours() {
+    char buf[64];
+    IPAddress address(192, 168, 1, 20);
+    fmt(buf, sizeof(buf), "[%I] [%16I] [%-16I]", &address, &address, &address);
+    CHECK_STR(buf, "[192.168.1.20] [    192.168.1.20] [192.168.1.20    ]");
+
+    fmt(buf, sizeof(buf), "[%m] [%6m] [%-6m]", "pass", "pass", "pass");
+    CHECK_STR(buf, "[****] [  ****] [****  ]");
+
+    // - wins over 0, as in printf
+    fmt(buf, sizeof(buf), "[%-05d]", 42);
+    CHECK_STR(buf, "[42   ]");
+
+    fmt(buf, sizeof(buf), "%s", (const char *) NULL);
+    CHECK_STR(buf, "");
+
+    // Unknown conversions print as written, and a lone % at the end goes
+    fmt(buf, sizeof(buf), "%q %");
+    CHECK_STR(buf, "%q ");
+}
+
+static void test_truncation() {
+    char buf[8];
+    CHECK_EQ(fmt(buf, sizeof(buf), "%s and more", "text"), 13);
+    CHECK_STR(buf, "text an");
+}
+
+// Output that doesn't fit is flushed a buffer at a time
+static char _flushed[256];
+
+static void flush(struct fmt_out *out) {
+    strncat(_flushed, out->buf, out->len);
+    out->len = 0;
+}
+
+static void fmt_to(struct fmt_out *out, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fmt_vformat(out, format, args);
+    va_end(args);
+}
+
+static void test_flush() {
+    char buf[4];
+    struct fmt_out out;
+    fmt_init(&out, buf, sizeof(buf), flush);
+    _flushed[0] = '\0';
+    fmt_to(&out, "%s=%d;", "answer", 42);
+    flush(&out);
+    CHECK_STR(_flushed, "answer=42;");
+    CHECK_EQ(out.total, 10);
+}
+
+int main() {
+    test_like_printf();
+    test_ours();
+    test_truncation();
+    test_flush();
+    return check_failures();
+}
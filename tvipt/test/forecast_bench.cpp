@@ -0,0 +1,79 @@
+// A weather refresh through print_weather(): the forecast drawn once, then
+// again with one field changed, as the w command does when it's run twice.
+// Prints the bytes each commit sent against a clear-and-redraw of the same
+// frame.
+
+#include <stdio.h>
+#include "check.h"
+#include "fake_term.h"
+#include "../forecast.h"
+
+static const char *_periods[][4] = {
+    {"Tonight", "Low", "52", "Mostly Clear"},
+    {"Tuesday", "High", "71", "Sunny"},
+    {"Tuesday Night", "Low", "54", "Partly Cloudy"},
+    {"Wednesday", "High", "68", "Chance Showers"},
+    {"Wednesday Night", "Low", "50", "Showers Likely"},
+    {"Thursday", "High", "63", "Rain"},
+    {"Thursday Night", "Low", "47", "Chance Rain"},
+    {"Friday", "High", "61", "Mostly Cloudy"},
+    {"Friday Night", "Low", "45", "Partly Cloudy"},
+    {"Saturday", "High", "64", "Mostly Sunny"},
+    {"Saturday Night", "Low", "46", "Mostly Clear"},
+    {"Sunday", "High", "66", "Sunny"},
+};
+
+static void fill(struct weather *w) {
+    memset(w, 0, sizeof(*w));
+    strcpy(w->area, "Portland OR");
+    strcpy(w->timestamp, "Mon, 14 Oct 4:53 pm PDT");
+    strcpy(w->station_id, "KPDX");
+    strcpy(w->station_name, "Portland International Airport");
+    strcpy(w->description, "Partly Cloudy");
+    w->temperature = 64;
+    w->dewpoint = 48;
+    w->relative_humidity = 56;
+    w->wind_speed = 7;
+    w->wind_direction = 290;
+    w->gust = 0;
+    strcpy(w->sea_level_pressure, "30.12");
+    for (size_t i = 0; i < sizeof(_periods) / sizeof(_periods[0]); i++) {
+        struct period_forecast *fc = &w->future[i];
+        strcpy(fc->name, _periods[i][0]);
+        strcpy(fc->temperature_label, _periods[i][1]);
+        strcpy(fc->temperature, _periods[i][2]);
+        strcpy(fc->weather, _periods[i][3]);
+        strcpy(fc->precipitation, i % 3 == 0 ? "20" : "");
+    }
+}
+
+static void print_commit(const char *name) {
+    struct screen_stats stats;
+    screen_get_stats(&stats);
+    printf("%-22s %5u bytes, %5u for a full redraw\n", name, (unsigned) stats.last_bytes,
+           (unsigned) stats.last_full_bytes);
+}
+
+int main() {
+    fake_term_reset();
+    // After the command line, the glass isn't known
+    screen_shown.valid = false;
+
+    struct weather w;
+    fill(&w);
+    print_weather(&w);
+    print_commit("first forecast");
+    CHECK(fake_term_in_sync());
+
+    // The temperature goes up a degree
+    w.temperature++;
+    print_weather(&w);
+    print_commit("one field changed");
+    CHECK(fake_term_in_sync());
+
+    struct screen_stats stats;
+    screen_get_stats(&stats);
+    CHECK(stats.last_bytes > 0);
+    CHECK(stats.last_bytes * 10 < stats.last_full_bytes);
+    return check_failures();
+}
@@ -0,0 +1,60 @@
+// Just enough of the Arduino core for the host tests to compile the
+// modules that don't touch hardware.
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+// The core has these from newlib
+static inline char *ltoa(long val, char *buf, int radix) {
+    char digits[34];
+    unsigned long n = val < 0 && radix == 10 ? 0UL - (unsigned long) val : (unsigned long) val;
+    int len = 0;
+    do {
+        digits[len++] = "0123456789abcdef"[n % (unsigned long) radix];
+        n /= (unsigned long) radix;
+    } while (n > 0);
+    char *p = buf;
+    if (val < 0 && radix == 10) {
+        *p++ = '-';
+    }
+    while (len > 0) {
+        *p++ = digits[--len];
+    }
+    *p = '\0';
+    return buf;
+}
+
+static inline char *utoa(unsigned int val, char *buf, int radix) {
+    return ltoa((long) val, buf, radix);
+}
+
+// A clock the test moves by hand (fake_term.cpp)
+unsigned long millis();
+
+unsigned long micros();
+
+#include "Print.h"
+#include "Stream.h"
+
+// The debug log, which goes nowhere (fake_term.cpp)
+extern Print &Serial;
+
+#endif
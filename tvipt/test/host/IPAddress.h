@@ -0,0 +1,23 @@
+#ifndef IPADDRESS_H
+#define IPADDRESS_H
+
+#include <stdint.h>
+
+class IPAddress {
+public:
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+        _octets[0] = a;
+        _octets[1] = b;
+        _octets[2] = c;
+        _octets[3] = d;
+    }
+
+    uint8_t operator[](int i) const {
+        return _octets[i];
+    }
+
+private:
+    uint8_t _octets[4];
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef PRINT_H
+#define PRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+class Print;
+
+class Printable {
+public:
+    virtual size_t printTo(Print &p) const = 0;
+
+    virtual ~Printable() {}
+};
+
+class Print {
+public:
+    virtual size_t write(uint8_t c) = 0;
+
+    virtual size_t write(const uint8_t *buf, size_t size) {
+        size_t n = 0;
+        while (n < size && write(buf[n]) == 1) {
+            n++;
+        }
+        return n;
+    }
+
+    size_t write(const char *str) {
+        return write((const uint8_t *) str, strlen(str));
+    }
+
+    size_t write(const char *buf, size_t size) {
+        return write((const uint8_t *) buf, size);
+    }
+
+    size_t print(long val, int base = 10) {
+        char buf[8 * sizeof(long) + 2];
+        snprintf(buf, sizeof(buf), base == 16 ? "%lx" : "%ld", val);
+        return write(buf);
+    }
+
+    size_t println(const char *str) {
+        return write(str) + write("\r\n");
+    }
+
+    virtual ~Print() {}
+};
+
+#endif
@@ -0,0 +1,67 @@
+// Just the WiFi101 clients, never connected, for host tests that link a
+// session module without the network.
+
+#ifndef WIFI101_H
+#define WIFI101_H
+
+#include "Client.h"
+
+class WiFiClient : public Client {
+public:
+    int connect(IPAddress, uint16_t) {
+        return 0;
+    }
+
+    int connect(const char *, uint16_t) {
+        return 0;
+    }
+
+    size_t write(uint8_t) {
+        return 0;
+    }
+
+    size_t write(const uint8_t *, size_t) {
+        return 0;
+    }
+
+    int available() {
+        return 0;
+    }
+
+    int read() {
+        return -1;
+    }
+
+    int read(uint8_t *, size_t) {
+        return -1;
+    }
+
+    int peek() {
+        return -1;
+    }
+
+    void flush() {
+    }
+
+    void stop() {
+    }
+
+    uint8_t connected() {
+        return 0;
+    }
+
+    operator bool() {
+        return false;
+    }
+
+    using Print::write;
+};
+
+class WiFiSSLClient : public WiFiClient {
+public:
+    int connectSSL(const char *, uint16_t) {
+        return 0;
+    }
+};
+
+#endif
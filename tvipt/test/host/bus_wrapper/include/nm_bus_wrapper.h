@@ -0,0 +1,18 @@
+// The WiFi101 bus driver's entry point, for net.cpp's SPI count.
+
+#ifndef NM_BUS_WRAPPER_H
+#define NM_BUS_WRAPPER_H
+
+#include <stdint.h>
+
+typedef int8_t sint8;
+typedef uint8_t uint8;
+
+#define NM_BUS_IOCTL_R          0
+#define NM_BUS_IOCTL_W          1
+#define NM_BUS_IOCTL_W_SPECIAL  2
+#define NM_BUS_IOCTL_RW         3
+
+sint8 nm_bus_ioctl(uint8 cmd, void *param);
+
+#endif
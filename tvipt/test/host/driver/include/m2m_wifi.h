@@ -0,0 +1,10 @@
+// What net.cpp uses of the WiFi101 driver; the test defines it.
+
+#ifndef M2M_WIFI_H
+#define M2M_WIFI_H
+
+#include "bus_wrapper/include/nm_bus_wrapper.h"
+
+sint8 m2m_wifi_handle_events(void *arg);
+
+#endif
@@ -0,0 +1,22 @@
+// The WiFi101 socket callback's type and messages, for net.cpp.
+
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include "bus_wrapper/include/nm_bus_wrapper.h"
+
+typedef sint8 SOCKET;
+
+#define SOCKET_MSG_BIND         1
+#define SOCKET_MSG_LISTEN       2
+#define SOCKET_MSG_DNS_RESOLVE  3
+#define SOCKET_MSG_ACCEPT       4
+#define SOCKET_MSG_CONNECT      5
+#define SOCKET_MSG_RECV         6
+#define SOCKET_MSG_SEND         7
+#define SOCKET_MSG_SENDTO       8
+#define SOCKET_MSG_RECVFROM     9
+
+typedef void (*tpfAppSocketCb)(SOCKET sock, uint8 msg, void *data);
+
+#endif
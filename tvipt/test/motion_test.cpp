@@ -0,0 +1,292 @@
+// Cursor motion: planned moves cost what they send, get where they're
+// going, and are never worse than ESC = r c.  And a recorded stream through
+// the ANSI translator, which moves and erases with the same code.
+
+#include "check.h"
+#include "fake_term.h"
+#include "../motion.h"
+#include "../ansi.h"
+
+static void put_cursor(byte row, byte col) {
+    screen_shown.row = row;
+    screen_shown.col = col;
+    fake_glass.row = row;
+    fake_glass.col = col;
+}
+
+static int plan(byte from_row, byte from_col, byte row, byte col, enum motion_start *start) {
+    put_cursor(from_row, from_col);
+    return motion_plan(&screen_shown, row, col, start);
+}
+
+static void test_plans() {
+    fake_term_reset();
+    enum motion_start start;
+
+    CHECK_EQ(plan(5, 10, 5, 12, &start), 2);
+    CHECK_EQ(start, FROM_CURSOR);
+
+    CHECK_EQ(plan(5, 10, 5, 0, &start), 1);
+    CHECK_EQ(start, FROM_LEFT_MARGIN);
+
+    CHECK_EQ(plan(5, 10, 6, 0, &start), 1);
+    CHECK_EQ(start, FROM_NEXT_LINE);
+
+    CHECK_EQ(plan(5, 10, 0, 0, &start), 1);
+    CHECK_EQ(start, FROM_HOME);
+
+    CHECK_EQ(plan(5, 10, 0, 1, &start), 2);
+    CHECK_EQ(start, FROM_HOME);
+
+    // CTRL _ on the last row would scroll the screen
+    plan(SCREEN_ROWS - 1, 10, SCREEN_ROWS - 1, 0, &start);
+    CHECK(start != FROM_NEXT_LINE);
+}
+
+// Every move from everywhere on a small grid, sent through term_move()
+static void test_moves() {
+    fake_term_reset();
+    for (int from = 0; from < SCREEN_ROWS * SCREEN_COLS; from += 7) {
+        for (int to = 0; to < SCREEN_ROWS * SCREEN_COLS; to += 13) {
+            byte from_row = (byte) (from / SCREEN_COLS);
+            byte from_col = (byte) (from % SCREEN_COLS);
+            byte row = (byte) (to / SCREEN_COLS);
+            byte col = (byte) (to % SCREEN_COLS);
+
+            enum motion_start start;
+            int cost = plan(from_row, from_col, row, col, &start);
+            fake_term_clear_out();
+            term_move((byte) (row + 1), (byte) (col + 1));
+
+            CHECK_EQ(fake_glass.row, row);
+            CHECK_EQ(fake_glass.col, col);
+            CHECK((int) fake_term_len <= MOTION_ABSOLUTE_COST);
+            if (cost < MOTION_ABSOLUTE_COST) {
+                CHECK_EQ(fake_term_len, cost);
+            }
+        }
+    }
+}
+
+// A stale model means the cursor could be anywhere
+static void test_stale() {
+    fake_term_reset();
+    put_cursor(3, 3);
+    screen_shown.valid = false;
+    fake_term_clear_out();
+    term_move(4, 5);
+
+    CHECK_EQ(fake_term_len, MOTION_ABSOLUTE_COST);
+    CHECK(fake_term_out[0] == TERM_ESCAPE);
+    CHECK(fake_term_out[1] == TERM_MOVE_TO_POS);
+}
+
+static bool glass_blank(byte row, byte from) {
+    for (byte col = from; col < SCREEN_COLS; col++) {
+        if (fake_glass.cells[row][col] != ' ') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_pad() {
+    fake_term_reset();
+    term_write("name:");
+    fake_term_clear_out();
+    term_pad(10);
+    // Blank already, so moved over
+    CHECK_EQ(fake_term_len, MOTION_ABSOLUTE_COST);
+    CHECK_EQ(fake_glass.col, 15);
+
+    fake_term_reset();
+    term_write("name: 0123456789");
+    put_cursor(0, 5);
+    fake_term_clear_out();
+    term_pad(11);
+    // Erased to the end of the line and moved back, not 11 spaces
+    CHECK(fake_term_len < 11);
+    CHECK(glass_blank(0, 5));
+    CHECK_EQ(fake_glass.col, 16);
+}
+
+static void test_pad_screen() {
+    // A run over the end of the row, with nothing after it on the screen
+    fake_term_reset();
+    term_move(3, 1);
+    term_write("first");
+    term_move(4, 1);
+    term_write("second");
+    term_move(3, 4);
+    fake_term_clear_out();
+    term_pad(SCREEN_COLS + 3);
+    // ESC Y and back down to the end of the run
+    CHECK(fake_term_len < 10);
+    CHECK(fake_term_out[0] == TERM_ESCAPE);
+    CHECK(fake_term_out[1] == TERM_ERASE_TO_EOP);
+    CHECK(glass_blank(2, 3));
+    CHECK(glass_blank(3, 0));
+    CHECK_EQ(fake_glass.row, 3);
+    CHECK_EQ(fake_glass.col, 6);
+    CHECK(fake_term_in_sync());
+
+    // Something further down has to stay
+    fake_term_reset();
+    term_move(3, 1);
+    term_write("first");
+    term_move(4, 1);
+    term_write("second");
+    term_move(10, 1);
+    term_write("below");
+    term_move(3, 4);
+    fake_term_clear_out();
+    term_pad(SCREEN_COLS + 3);
+    CHECK(fake_term_len > SCREEN_COLS);
+    CHECK(glass_blank(2, 3));
+    CHECK(memcmp(fake_glass.cells[9], "below", 5) == 0);
+    CHECK(fake_term_in_sync());
+}
+
+// top from procps, recorded with script(1) at 80x24 and TERM=vt100: its
+// first frame, and the next, which only rewrites what changed
+static const char _top_first[] =
+    "\x1b[?1h\x1b=\x1b[H\x1b[J"
+    "\x1b[m\x0ftop - 07:48:05 up  2:00,  0 user,  load average: 0.19, 0.15, 0.13\x1b[m\x0f\x1b[m\x0f"
+    "\x1b[K\r\n"
+    "Tasks:\x1b[m\x0f\x1b[1m  65 \x1b[m\x0ftotal,\x1b[m\x0f\x1b[1m   2 \x1b[m\x0frunning,\x1b[m\x0f"
+    "\x1b[1m  59 \x1b[m\x0fsleeping,\x1b[m\x0f\x1b[1m   0 \x1b[m\x0fstopped,\x1b[m\x0f\x1b[1m   4 "
+    "\x1b[m\x0fzombie\x1b[m\x0f\x1b[m\x0f\x1b[K\r\n"
+    "%Cpu(s):\x1b[m\x0f\x1b[1m  0.0 \x1b[m\x0fus,\x1b[m\x0f\x1b[1m100.0 \x1b[m\x0fsy,\x1b[m\x0f"
+    "\x1b[1m  0.0 \x1b[m\x0fni,\x1b[m\x0f\x1b[1m  0.0 \x1b[m\x0fid,\x1b[m\x0f\x1b[1m  0.0 "
+    "\x1b[m\x0fwa,\x1b[m\x0f\x1b[1m  0.0 \x1b[m\x0fhi,\x1b[m\x0f\x1b[1m  0.0 \x1b[m\x0fsi,\x1b[m\x0f"
+    "\x1b[1m  0.0 \x1b[m\x0fst\x1b[m\x0f\x1b[m\x0f \x1b[m\x0f\x1b[m\x0f\x1b[K\r\n"
+    "MiB Mem :\x1b[m\x0f\x1b[1m   6013.8 \x1b[m\x0ftotal,\x1b[m\x0f\x1b[1m   4394.1 "
+    "\x1b[m\x0f" "free,\x1b[m\x0f\x1b[1m    513.8 \x1b[m\x0fused,\x1b[m\x0f\x1b[1m   1376.8 "
+    "\x1b[m\x0f" "buff/cache\x1b[m\x0f\x1b[m\x0f \x1b[m\x0f\x1b[m\x0f    \x1b[m\x0f\x1b[m\x0f\x1b[K\r\n"
+    "MiB Swap:\x1b[m\x0f\x1b[1m      0.0 \x1b[m\x0ftotal,\x1b[m\x0f\x1b[1m      0.0 "
+    "\x1b[m\x0f" "free,\x1b[m\x0f\x1b[1m      0.0 \x1b[m\x0fused.\x1b[m\x0f\x1b[1m   5500.0 "
+    "\x1b[m\x0f" "avail Mem \x1b[m\x0f\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[K\r\n"
+    "\x1b[7m  PID USER      PR  NI    VIRT    RES    SHR S  %CPU  %MEM     TIME+ COMMAND    "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f"
+    "\x1b[1m 5104 root      20   0   20180  16680   7192 R  46.7   0.3   0:00.07 conda      "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f    1 root      20   0   23836   9348   6576 S   0.0   0.2   0:17.35 process_a+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f    2 root      20   0       0      0      0 S   0.0   0.0   0:00.00 kthreadd   "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f    3 root      20   0       0      0      0 S   0.0   0.0   0:00.00 pool_work+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f    4 root       0 -20       0      0      0 I   0.0   0.0   0:00.00 kworker/R+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f    5 root       0 -20       0      0      0 I   0.0   0.0   0:00.00 kworker/R+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f    6 root       0 -20       0      0      0 I   0.0   0.0   0:00.00 kworker/R+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f    7 root       0 -20       0      0      0 I   0.0   0.0   0:00.00 kworker/R+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f    8 root       0 -20       0      0      0 I   0.0   0.0   0:00.00 kworker/R+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f    9 root      20   0       0      0      0 I   0.0   0.0   0:00.00 kworker/0+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f   10 root       0 -20       0      0      0 I   0.0   0.0   0:00.00 kworker/0+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f   11 root      20   0       0      0      0 I   0.0   0.0   0:00.87 kworker/0+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f   12 root      20   0       0      0      0 I   0.0   0.0   0:00.14 kworker/u+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f   13 root       0 -20       0      0      0 I   0.0   0.0   0:00.00 kworker/R+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f   14 root      20   0       0      0      0 S   0.0   0.0   0:00.23 ksoftirqd+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f   15 root      20   0       0      0      0 I   0.0   0.0   0:00.63 rcu_preem+ "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\x1b[m\x0f   16 root      20   0       0      0      0 S   0.0   0.0   0:00.00 rcu_exp_p+ "
+    "\x1b[m\x0f\x1b[K";
+
+static const char _top_next[] =
+    "\x1b[H\r\n"
+    "\r\n"
+    "%Cpu(s):\x1b[m\x0f\x1b[1m 87.7 \x1b[m\x0fus,\x1b[m\x0f\x1b[1m 12.3 \x1b[m\x0fsy,\x1b[m\x0f"
+    "\x1b[1m  0.0 \x1b[m\x0fni,\x1b[m\x0f\x1b[1m  0.0 \x1b[m\x0fid,\x1b[m\x0f\x1b[1m  0.0 "
+    "\x1b[m\x0fwa,\x1b[m\x0f\x1b[1m  0.0 \x1b[m\x0fhi,\x1b[m\x0f\x1b[1m  0.0 \x1b[m\x0fsi,\x1b[m\x0f"
+    "\x1b[1m  0.0 \x1b[m\x0fst\x1b[m\x0f\x1b[m\x0f \x1b[m\x0f\x1b[m\x0f\x1b[K\r\n"
+    "\r\n"
+    "\r\n"
+    "\x1b[K\r\n"
+    "\r\n"
+    "\x1b[m\x0f"
+    "\x1b[1m 5104 root      20   0   67660  57440  19284 R  99.9   0.9   0:00.58 conda      "
+    "\x1b[m\x0f\x1b[K\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n"
+    "\r\n";
+
+static bool glass_at(int row, const char *text) {
+    return memcmp(fake_glass.cells[row], text, strlen(text)) == 0;
+}
+
+// Sends a stream as a session would, the UART emptying the ring whenever
+// it's full; returns the bytes sent
+static size_t play(const char *stream) {
+    fake_term_clear_out();
+    size_t len = strlen(stream);
+    size_t done = 0;
+    while (done < len) {
+        done += ansi_write((const uint8_t *) stream + done, len - done);
+        fake_term_room = TERM_TX_BUFSIZE - 1;
+    }
+    return fake_term_len;
+}
+
+static void test_top() {
+    fake_term_reset();
+    struct busybox_sink reply = {NULL, NULL};
+    ansi_init(reply);
+
+    // 2407 bytes of VT100
+    size_t first = play(_top_first);
+    CHECK_EQ(first, 1979);
+    CHECK(glass_at(0, "top - 07:48:05 up  2:00,  0 user,  load average: 0.19, 0.15, 0.13"));
+    CHECK(glass_at(2, "%Cpu(s):  0.0 us,100.0 sy,"));
+    CHECK(glass_at(6, "  PID USER      PR  NI    VIRT    RES    SHR S  %CPU  %MEM     TIME+ COMMAND"));
+    CHECK(glass_at(7, " 5104 root      20   0   20180  16680   7192 R  46.7"));
+    CHECK(glass_at(23, "   16 root      20   0       0      0      0 S   0.0   0.0   0:00.00 rcu_exp_p+"));
+    CHECK(fake_term_in_sync());
+
+    // 342
+    size_t next = play(_top_next);
+    CHECK_EQ(next, 221);
+    CHECK(glass_at(0, "top - 07:48:05"));
+    CHECK(glass_at(2, "%Cpu(s): 87.7 us, 12.3 sy,"));
+    CHECK(glass_at(7, " 5104 root      20   0   67660  57440  19284 R  99.9"));
+    CHECK(glass_at(8, "    1 root"));
+    CHECK(fake_term_in_sync());
+}
+
+int main() {
+    test_plans();
+    test_moves();
+    test_stale();
+    test_pad();
+    test_pad_screen();
+    test_top();
+
+    struct term_stats stats;
+    motion_get_stats(&stats);
+    CHECK(stats.motion_bytes < stats.motion_naive_bytes);
+    return check_failures();
+}
@@ -0,0 +1,278 @@
+// net.cpp in front of a WiFi101 stand-in: clients are only asked after a
+// socket event, including events handled during another client call and a
+// close with data left to read, and its callback goes back in front when
+// the library registers its own again.
+
+#include <deque>
+#include "check.h"
+#include "../net.h"
+
+extern "C" {
+#include "bus_wrapper/include/nm_bus_wrapper.h"
+#include "driver/include/m2m_wifi.h"
+#include "socket/include/socket.h"
+
+volatile tpfAppSocketCb gpfAppSocketCb = NULL;
+
+sint8 __real_nm_bus_ioctl(uint8 cmd, void *param);
+sint8 __wrap_nm_bus_ioctl(uint8 cmd, void *param);
+}
+
+unsigned long millis() {
+    return 0;
+}
+
+static uint32_t _bus_calls = 0;
+
+sint8 __real_nm_bus_ioctl(uint8, void *) {
+    _bus_calls++;
+    return 0;
+}
+
+// The chip's events, waiting for the driver to handle them
+struct chip_event {
+    uint8 msg;
+    int16_t size;
+};
+
+static std::deque<chip_event> _chip;
+
+class FakeClient;
+static FakeClient *_client = NULL;
+
+// Like WiFi101's client: each call first has the driver handle events,
+// and it's connected while data is left after a close.
+class FakeClient : public Client {
+public:
+    size_t buffered;
+    bool open;
+    uint32_t asks;
+
+    FakeClient() : buffered(0), open(true), asks(0) {
+    }
+
+    int connect(IPAddress, uint16_t) override {
+        return 1;
+    }
+
+    int connect(const char *, uint16_t) override {
+        return 1;
+    }
+
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t *, size_t size) override {
+        m2m_wifi_handle_events(NULL);
+        _chip.push_back({SOCKET_MSG_SEND, (int16_t) size});
+        return size;
+    }
+
+    int available() override {
+        asks++;
+        m2m_wifi_handle_events(NULL);
+        return (int) buffered;
+    }
+
+    int read() override {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+
+    int read(uint8_t *, size_t size) override {
+        m2m_wifi_handle_events(NULL);
+        size_t got = min(size, buffered);
+        buffered -= got;
+        return (int) got;
+    }
+
+    int peek() override {
+        return -1;
+    }
+
+    void flush() override {
+    }
+
+    void stop() override {
+    }
+
+    uint8_t connected() override {
+        asks++;
+        m2m_wifi_handle_events(NULL);
+        return buffered > 0 || open;
+    }
+
+    operator bool() override {
+        return open;
+    }
+
+    using Print::write;
+};
+
+// WiFi101's own callback, which fills the client's buffer
+static void library_event(SOCKET, uint8 msg, void *data) {
+    if (msg != SOCKET_MSG_RECV) {
+        return;
+    }
+    int16_t size = *(int16_t *) data;
+    if (size > 0) {
+        _client->buffered += size;
+    } else {
+        _client->open = false;
+    }
+}
+
+sint8 m2m_wifi_handle_events(void *) {
+    while (!_chip.empty()) {
+        chip_event ev = _chip.front();
+        _chip.pop_front();
+        gpfAppSocketCb(0, ev.msg, &ev.size);
+    }
+    return 0;
+}
+
+static void arrive(int16_t size) {
+    _chip.push_back({SOCKET_MSG_RECV, size});
+}
+
+// A session's pass: asks only when net.cpp says there may be news
+static void pass(FakeClient &client, int watch) {
+    net_loop();
+    if (net_pending(watch) && net_connected(client, watch)) {
+        uint8_t buf[64];
+        if (net_available(client) > 0) {
+            client.read(buf, sizeof(buf));
+        }
+    }
+}
+
+static void test_unhooked() {
+    FakeClient client;
+    _client = &client;
+    net_init();
+    int watch = net_watch(client);
+
+    // Until WiFi101 has registered a callback, every pass asks
+    CHECK(net_pending(watch));
+    uint32_t before = client.asks;
+    net_available(client);
+    CHECK(net_pending(watch));
+    CHECK(client.asks > before);
+    net_unwatch(watch);
+}
+
+static void test_quiet() {
+    FakeClient client;
+    _client = &client;
+    gpfAppSocketCb = library_event;
+    net_loop();
+    int watch = net_watch(client);
+
+    // Asked once, then not again until there's an event
+    pass(client, watch);
+    CHECK(!net_pending(watch));
+    uint32_t before = client.asks;
+    for (int i = 0; i < 100; i++) {
+        pass(client, watch);
+    }
+    CHECK_EQ(client.asks, before);
+    CHECK_EQ(net_available(client), 0);
+    CHECK(net_connected(client, watch));
+    CHECK_EQ(client.asks, before);
+
+    // Sends complete without making it pending
+    client.write((const uint8_t *) "ls\r", 3);
+    net_loop();
+    CHECK(!net_pending(watch));
+
+    arrive(10);
+    net_loop();
+    CHECK(net_pending(watch));
+    pass(client, watch);
+    CHECK_EQ(client.buffered, 0);
+    // Asked once more to find it empty
+    pass(client, watch);
+    CHECK(!net_pending(watch));
+    net_unwatch(watch);
+}
+
+static void test_event_during_call() {
+    FakeClient client;
+    _client = &client;
+    gpfAppSocketCb = library_event;
+    int watch = net_watch(client);
+    pass(client, watch);
+    CHECK(!net_pending(watch));
+
+    // Data handled while a key is written, not by the loop
+    arrive(5);
+    client.write('x');
+    CHECK_EQ(client.buffered, 5);
+    CHECK(net_pending(watch));
+    pass(client, watch);
+    CHECK_EQ(client.buffered, 0);
+    net_unwatch(watch);
+}
+
+static void test_close_with_data() {
+    FakeClient client;
+    _client = &client;
+    gpfAppSocketCb = library_event;
+    int watch = net_watch(client);
+    pass(client, watch);
+
+    // More than a read takes, then the close
+    arrive(100);
+    arrive(0);
+    net_loop();
+    CHECK(net_connected(client, watch));
+    for (int i = 0; i < 5; i++) {
+        pass(client, watch);
+    }
+    CHECK_EQ(client.buffered, 0);
+    CHECK(!net_connected(client, watch));
+    net_unwatch(watch);
+}
+
+static void test_rehook() {
+    FakeClient client;
+    _client = &client;
+    gpfAppSocketCb = library_event;
+    int watch = net_watch(client);
+    pass(client, watch);
+    CHECK(!net_pending(watch));
+
+    // WiFi101 initialized again registers its own callback
+    gpfAppSocketCb = library_event;
+    CHECK(net_pending(watch));
+    arrive(3);
+    pass(client, watch);
+    CHECK_EQ(client.buffered, 0);
+    CHECK(gpfAppSocketCb != library_event);
+    pass(client, watch);
+    CHECK(!net_pending(watch));
+    net_unwatch(watch);
+}
+
+static void test_spi() {
+    struct net_stats before;
+    net_get_stats(&before);
+    __wrap_nm_bus_ioctl(NM_BUS_IOCTL_RW, NULL);
+    __wrap_nm_bus_ioctl(NM_BUS_IOCTL_RW, NULL);
+    __wrap_nm_bus_ioctl(NM_BUS_IOCTL_R, NULL);
+    struct net_stats after;
+    net_get_stats(&after);
+    CHECK_EQ(after.spi - before.spi, 2);
+    CHECK_EQ(_bus_calls, 3);
+}
+
+int main() {
+    test_unhooked();
+    test_quiet();
+    test_event_during_call();
+    test_close_with_data();
+    test_rehook();
+    test_spi();
+    return check_failures();
+}
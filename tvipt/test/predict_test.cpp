@@ -0,0 +1,121 @@
+// Predictive local echo against a server that echoes, one that doesn't
+// (a password prompt), and one that answers with something else.
+
+#include "check.h"
+#include "fake_term.h"
+#include "../ansi.h"
+#include "../predict.h"
+
+static void start() {
+    fake_term_reset();
+    fake_millis = 0;
+    struct busybox_sink reply = {NULL, NULL};
+    ansi_init(reply);
+    predict_set_mode(PREDICT_ON);
+    term_write("$ ");
+}
+
+static void type(const char *keys) {
+    predict_keys((const uint8_t *) keys, strlen(keys));
+}
+
+// The server's output, drawn as telnets would after predict_echo()
+static size_t server(const char *val) {
+    uint8_t buf[64];
+    size_t len = strlen(val);
+    memcpy(buf, val, len);
+    len = predict_echo(buf, len);
+    term_write(buf, len);
+    return len;
+}
+
+static bool glass_at(int row, int col, const char *text) {
+    return memcmp(&fake_glass.cells[row][col], text, strlen(text)) == 0;
+}
+
+static void test_trust() {
+    start();
+    // Nothing is shown until the server has echoed a key itself
+    type("l");
+    CHECK(glass_at(0, 2, " "));
+    CHECK_EQ(server("l"), 1);
+    CHECK(glass_at(0, 2, "l"));
+
+    type("s");
+    CHECK(glass_at(0, 3, "s"));
+    CHECK_EQ(fake_glass.col, 4);
+    // The echo is already on the glass
+    CHECK_EQ(server("s"), 0);
+    CHECK_EQ(fake_glass.col, 4);
+    CHECK(fake_term_in_sync());
+}
+
+static void test_wrong_guess() {
+    start();
+    type("l");
+    server("l");
+    type("x");
+    CHECK(glass_at(0, 3, "x"));
+    // Something else came first: the guess is taken back before it's drawn
+    CHECK_EQ(server("\r\nfoo"), 5);
+    CHECK(glass_at(0, 0, "$ l "));
+    CHECK(glass_at(1, 0, "foo"));
+    CHECK(fake_term_in_sync());
+
+    // And trust has to be earned again
+    type("y");
+    CHECK(glass_at(1, 3, " "));
+}
+
+static void test_password() {
+    start();
+    type("l");
+    server("l");
+    type("s");
+    server("s");
+    type("\r");
+    server("\r\nPassword: ");
+    // Enter ended trust, so a prompt that stops echoing shows nothing
+    type("secret");
+    CHECK(glass_at(1, 10, "      "));
+    fake_millis += PREDICT_TIMEOUT_MS + 1;
+    predict_loop();
+    CHECK(glass_at(1, 10, "      "));
+    CHECK(fake_term_in_sync());
+}
+
+static void test_timeout() {
+    start();
+    type("l");
+    server("l");
+    type("s");
+    CHECK(glass_at(0, 3, "s"));
+    fake_millis += PREDICT_TIMEOUT_MS;
+    predict_loop();
+    CHECK(glass_at(0, 3, "s"));
+    // No echo in time: the key is erased
+    fake_millis++;
+    predict_loop();
+    CHECK(glass_at(0, 3, " "));
+    CHECK_EQ(fake_glass.col, 3);
+    CHECK(fake_term_in_sync());
+}
+
+static void test_edge() {
+    start();
+    type("l");
+    server("l");
+    // Not in the last column, where a key would wrap
+    term_move(1, (byte) screen_cols(&screen_shown));
+    type("z");
+    CHECK(glass_at(0, screen_cols(&screen_shown) - 1, " "));
+}
+
+int main() {
+    test_trust();
+    test_wrong_guess();
+    test_password();
+    test_timeout();
+    test_edge();
+    return check_failures();
+}
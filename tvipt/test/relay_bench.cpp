@@ -0,0 +1,248 @@
+// The relay against the per-byte copy it replaced (util.h's stream_copy
+// and stream_copy_breakable): a 64 KB download arriving faster than 19200
+// baud drains, then the same connection idle.  Counts the calls each makes
+// on the client and the terminal per KB moved and per idle pass, and how
+// long a key typed during the download waits to be read and for its echo.
+// A pass of the session loop is a simulated millisecond, and the UART
+// drains the fake terminal's room at the baud rate.
+
+#include <stdio.h>
+#include <Client.h>
+#include "check.h"
+#include "fake_term.h"
+#include "../relay.h"
+
+#define DOWNLOAD_BYTES      65536
+// What the server sends, 50 KB/s
+#define NET_BYTES_PER_MS    50
+// What the server has in flight before it waits for us to read, two
+// segments
+#define NET_WINDOW          2920
+#define IDLE_PASSES         1000
+// A key typed during the download this often
+#define KEY_EVERY_MS        100
+#define KEYS_MAX            (DOWNLOAD_BYTES / 2 / KEY_EVERY_MS)
+// What tcp.cpp moves in a turn
+#define COPY_LIMIT          512
+
+// When each key was typed, and where in the download its echo comes
+static unsigned long _typed_ms[KEYS_MAX];
+static size_t _echo_at[KEYS_MAX];
+static size_t _keys_typed;
+static size_t _keys_sent;
+static size_t _keys_shown;
+static unsigned long _key_wait_max_ms;
+static unsigned long _echo_wait_max_ms;
+
+// A client with a download arriving at NET_BYTES_PER_MS, counting calls.
+// Keys written to it are echoed after what the server has sent so far.
+class BenchClient : public Client {
+public:
+    uint32_t calls;
+    size_t sent;
+    size_t taken;
+
+    BenchClient() : calls(0), sent(0), taken(0) {
+    }
+
+    void arrive() {
+        sent = min(min(sent + NET_BYTES_PER_MS, taken + NET_WINDOW), (size_t) DOWNLOAD_BYTES);
+    }
+
+    int connect(IPAddress, uint16_t) override {
+        return 1;
+    }
+
+    int connect(const char *, uint16_t) override {
+        return 1;
+    }
+
+    void key_sent() {
+        if (_keys_sent < _keys_typed) {
+            _key_wait_max_ms = max(_key_wait_max_ms, fake_millis - _typed_ms[_keys_sent]);
+            _echo_at[_keys_sent++] = sent;
+        }
+    }
+
+    size_t write(uint8_t) override {
+        calls++;
+        key_sent();
+        return 1;
+    }
+
+    size_t write(const uint8_t *, size_t size) override {
+        calls++;
+        for (size_t i = 0; i < size; i++) {
+            key_sent();
+        }
+        return size;
+    }
+
+    int available() override {
+        calls++;
+        return (int) (sent - taken);
+    }
+
+    int read() override {
+        calls++;
+        return taken < sent ? (int) (taken++ & 0xff) : -1;
+    }
+
+    int read(uint8_t *buf, size_t size) override {
+        calls++;
+        size_t len = min(size, sent - taken);
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = (uint8_t) (taken++ & 0xff);
+        }
+        return (int) len;
+    }
+
+    int peek() override {
+        calls++;
+        return taken < sent ? (int) (taken & 0xff) : -1;
+    }
+
+    void flush() override {
+    }
+
+    void stop() override {
+    }
+
+    uint8_t connected() override {
+        calls++;
+        return 1;
+    }
+
+    operator bool() override {
+        return true;
+    }
+};
+
+static uint32_t _term_calls;
+static uint32_t _term_writes;
+static double _draining;
+static size_t _shown;
+static uint32_t _blocked_ms;
+
+// What relay.cpp needs from the session manager and net.cpp: one session
+// in front
+void session_output(struct session *, const uint8_t *buf, size_t len) {
+    _term_writes++;
+    term_write_some(buf, len);
+}
+
+bool session_behind(struct session *) {
+    return false;
+}
+
+void session_hot_key() {
+}
+
+int net_available(Client &client) {
+    return client.available();
+}
+
+// A simulated millisecond: the UART frees room for what it sent, and
+// echoes it reached are shown
+static void tick(BenchClient &client) {
+    fake_millis++;
+    client.arrive();
+    _draining += fake_term_baud / 10.0 / 1000;
+    size_t drained = min((size_t) _draining, TERM_TX_BUFSIZE - 1 - fake_term_room);
+    _draining -= (size_t) _draining;
+    fake_term_room += drained;
+    _shown += drained;
+    while (_keys_shown < _keys_sent && _echo_at[_keys_shown] < _shown) {
+        _echo_wait_max_ms = max(_echo_wait_max_ms, fake_millis - _typed_ms[_keys_shown++]);
+    }
+
+    if (client.taken < DOWNLOAD_BYTES && fake_millis % KEY_EVERY_MS == 0 && _keys_typed < KEYS_MAX) {
+        fake_term_type("x");
+        _typed_ms[_keys_typed++] = fake_millis;
+    }
+}
+
+// Serial1.write() of a byte, which waits for room
+static void term_put(BenchClient &client, uint8_t c) {
+    while (fake_term_room == 0) {
+        tick(client);
+        _blocked_ms++;
+    }
+    fake_term_room--;
+    _term_writes++;
+    term_write(&c, 1);
+}
+
+// The upstream tcp pass: stream_copy_breakable() from the terminal, then
+// stream_copy() to it, each looking max_bytes times
+static void per_byte_pass(BenchClient &client) {
+    for (int i = 0; i < COPY_LIMIT; i++) {
+        _term_calls++;
+        if (term_available()) {
+            _term_calls++;
+            client.write((uint8_t) term_read());
+        }
+    }
+    for (int i = 0; i < COPY_LIMIT; i++) {
+        if (client.available()) {
+            term_put(client, (uint8_t) client.read());
+        }
+    }
+}
+
+static void relay_pass(BenchClient &client) {
+    uint8_t buf[RELAY_BUFSIZE];
+    // relay_read_term() asks term_available() once, and reads once if
+    // there's anything
+    _term_calls++;
+    int len = relay_read_term(buf, sizeof(buf), -1);
+    if (len > 0) {
+        _term_calls++;
+        client.write(buf, (size_t) len);
+    }
+    relay_net_to_term(client, COPY_LIMIT, NULL);
+}
+
+static void run(const char *name, void (*pass)(BenchClient &)) {
+    fake_term_reset();
+    fake_millis = 0;
+    _term_calls = 0;
+    _term_writes = 0;
+    _draining = 0;
+    _shown = 0;
+    _blocked_ms = 0;
+    _keys_typed = 0;
+    _keys_sent = 0;
+    _keys_shown = 0;
+    _key_wait_max_ms = 0;
+    _echo_wait_max_ms = 0;
+    relay_begin();
+
+    BenchClient client;
+    while (client.taken < DOWNLOAD_BYTES) {
+        pass(client);
+        tick(client);
+    }
+    double kb = DOWNLOAD_BYTES / 1024.0;
+    printf("%-8s download: %7.0f client calls/KB, %6.0f terminal calls/KB, %5.0f terminal writes/KB, "
+           "%5.1f s, %5.1f s blocked in writes\n", name, client.calls / kb, _term_calls / kb, _term_writes / kb,
+           fake_millis / 1000.0, _blocked_ms / 1000.0);
+    printf("%-8s keys:     read after up to %3lu ms, echoed after up to %4lu ms\n", name, _key_wait_max_ms,
+           _echo_wait_max_ms);
+
+    client.calls = 0;
+    _term_calls = 0;
+    for (int i = 0; i < IDLE_PASSES; i++) {
+        pass(client);
+        tick(client);
+    }
+    printf("%-8s idle:     %7.1f client calls/pass, %4.1f terminal calls/pass\n", name,
+           client.calls / (double) IDLE_PASSES, _term_calls / (double) IDLE_PASSES);
+    CHECK(client.taken == DOWNLOAD_BYTES);
+}
+
+int main() {
+    run("per-byte", per_byte_pass);
+    run("relay", relay_pass);
+    return check_failures();
+}
@@ -0,0 +1,45 @@
+#!/bin/sh -e
+#
+# Builds and runs the host tests: the modules that don't touch hardware,
+# compiled for this machine with the stubs in host/ and fake_term.cpp.
+# "run.sh bench" runs the benchmarks instead, which print what they
+# measure in simulated time.
+
+BASE="$(realpath $(dirname ${0}))"
+SRC="$(dirname ${BASE})"
+BUILD_PATH="${BASE}/build"
+CXX="${CXX:-g++}"
+CXXFLAGS="-std=gnu++11 -g -O2 -Wall -Wextra -I${BASE}/host -I${SRC}"
+
+mkdir -p "${BUILD_PATH}"
+
+run() {
+  name="${1}"
+  shift
+  ${CXX} ${CXXFLAGS} -o "${BUILD_PATH}/${name}" "${BASE}/${name}.cpp" $@
+  echo "${name}"
+  "${BUILD_PATH}/${name}"
+}
+
+FAKE_TERM="${BASE}/fake_term.cpp ${SRC}/screen.cpp ${SRC}/motion.cpp ${SRC}/fmt.cpp"
+
+if [ "${1}" = "bench" ]; then
+  run catchup_bench ${FAKE_TERM} "${SRC}/catchup.cpp"
+  run relay_bench ${FAKE_TERM} "${SRC}/relay.cpp"
+  run coalesce_bench ${FAKE_TERM} "${SRC}/telnets.cpp" "${SRC}/busybox.cpp" "${SRC}/ansi.cpp" \
+    "${SRC}/predict.cpp" "${SRC}/line.cpp" "${SRC}/relay.cpp" "${SRC}/session.cpp"
+  run forecast_bench ${FAKE_TERM} "${SRC}/forecast.cpp"
+  exit 0
+fi
+
+run screen_test ${FAKE_TERM}
+run motion_test ${FAKE_TERM} "${SRC}/ansi.cpp"
+run ansi_test ${FAKE_TERM} "${SRC}/ansi.cpp"
+run predict_test ${FAKE_TERM} "${SRC}/ansi.cpp" "${SRC}/predict.cpp"
+run busybox_test ${FAKE_TERM} "${SRC}/busybox.cpp" "${SRC}/ansi.cpp" "${SRC}/predict.cpp"
+run session_test ${FAKE_TERM} "${SRC}/session.cpp" "${SRC}/relay.cpp"
+run fmt_test "${SRC}/fmt.cpp"
+# The stand-in for WiFi101 in net_test is of the version net.cpp is for
+run net_test "${SRC}/net.cpp" -DWIFI101_VERSION=1500
+
+echo "all passed"
@@ -0,0 +1,181 @@
+// The frame renderer: whatever was on the glass, a commit leaves it showing
+// the frame, for fewer bytes than clearing and drawing it all.
+
+#include "check.h"
+#include "fake_term.h"
+
+// Draws rows of text as one frame, the cursor left at (row, col), 1-based
+static size_t commit(const char *const *rows, int count, byte row, byte col) {
+    screen_begin();
+    for (int i = 0; i < count; i++) {
+        screen_print((byte) (i + 1), 1, rows[i]);
+    }
+    screen_move(row, col);
+    fake_term_clear_out();
+    return screen_commit();
+}
+
+static bool glass_shows(int row, const char *text) {
+    size_t len = strlen(text);
+    if (memcmp(fake_glass.cells[row], text, len) != 0) {
+        return false;
+    }
+    for (size_t col = len; col < SCREEN_COLS; col++) {
+        if (fake_glass.cells[row][col] != ' ') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool sent(char escape) {
+    for (size_t i = 0; i + 1 < fake_term_len; i++) {
+        if (fake_term_out[i] == TERM_ESCAPE && fake_term_out[i + 1] == escape) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void test_first_frame() {
+    fake_term_reset();
+    screen_shown.valid = false;
+    const char *rows[] = {"Weather", "", "Sunny, 21C"};
+    commit(rows, 3, 5, 10);
+
+    CHECK(fake_term_out[0] == TERM_CLEAR);
+    CHECK(glass_shows(0, "Weather"));
+    CHECK(glass_shows(1, ""));
+    CHECK(glass_shows(2, "Sunny, 21C"));
+    CHECK_EQ(fake_glass.row, 4);
+    CHECK_EQ(fake_glass.col, 9);
+    CHECK(fake_term_in_sync());
+}
+
+static void test_same_frame() {
+    fake_term_reset();
+    const char *rows[] = {"Weather", "Sunny, 21C"};
+    commit(rows, 2, 3, 1);
+    CHECK_EQ(commit(rows, 2, 3, 1), 0);
+}
+
+static void test_one_cell() {
+    fake_term_reset();
+    const char *before[] = {"Weather", "Sunny, 21C"};
+    const char *after[] = {"Weather", "Sunny, 22C"};
+    commit(before, 2, 3, 1);
+    size_t sent_bytes = commit(after, 2, 3, 1);
+
+    CHECK(glass_shows(1, "Sunny, 22C"));
+    // There and back, and the digit
+    CHECK(sent_bytes > 0);
+    CHECK(sent_bytes <= 9);
+    struct screen_stats stats;
+    screen_get_stats(&stats);
+    CHECK(stats.last_bytes < stats.last_full_bytes);
+}
+
+static void test_stale_tail() {
+    fake_term_reset();
+    const char *before[] = {"Weather for the afternoon", "Humidity 45% and rising fast"};
+    const char *after[] = {"Weather for the afternoon", "Humidity 45%"};
+    commit(before, 2, 3, 1);
+    commit(after, 2, 3, 1);
+
+    CHECK(sent(TERM_ERASE_TO_EOL));
+    CHECK(glass_shows(1, "Humidity 45%"));
+    CHECK(fake_term_in_sync());
+}
+
+static void test_stale_rows() {
+    fake_term_reset();
+    const char *before[] = {"Weather for the afternoon", "one", "two", "three"};
+    const char *after[] = {"Weather for the afternoon"};
+    commit(before, 4, 1, 1);
+    commit(after, 1, 1, 1);
+
+    CHECK(sent(TERM_ERASE_TO_EOP));
+    for (int row = 1; row < 4; row++) {
+        CHECK(glass_shows(row, ""));
+    }
+}
+
+// Writing the bottom-right cell would scroll the PT
+static void test_last_cell() {
+    fake_term_reset();
+    char last[SCREEN_COLS + 1];
+    memset(last, 'x', SCREEN_COLS);
+    last[SCREEN_COLS] = '\0';
+    screen_begin();
+    screen_print(SCREEN_ROWS, 1, last);
+    screen_move(1, 1);
+    screen_commit();
+
+    CHECK(fake_glass.cells[0][0] == ' ');
+    CHECK(fake_glass.cells[SCREEN_ROWS - 1][SCREEN_COLS - 2] == 'x');
+    CHECK(fake_glass.cells[SCREEN_ROWS - 1][SCREEN_COLS - 1] == ' ');
+}
+
+// Output held by catch-up mode is sent as the difference
+static void test_release() {
+    fake_term_reset();
+    term_write("prompt> ");
+    screen_hold();
+    for (int i = 0; i < 30; i++) {
+        const char *line = "a line scrolling by\r\n";
+        for (const char *p = line; *p != '\0'; p++) {
+            screen_apply(&screen_shown, (uint8_t) *p);
+        }
+    }
+    CHECK(!fake_term_in_sync());
+
+    // A row at a time, then the rest
+    fake_term_clear_out();
+    CHECK(!screen_release(1));
+    CHECK(fake_term_len > 0);
+    CHECK(!fake_term_in_sync());
+    CHECK(screen_release(TERM_TX_BUFSIZE));
+    CHECK(fake_term_in_sync());
+}
+
+// Random frames over random frames
+static void test_random_frames() {
+    fake_term_reset();
+    srand(1);
+    for (int frame = 0; frame < 500; frame++) {
+        screen_begin();
+        for (int n = rand() % 30; n > 0; n--) {
+            char text[30];
+            int len = rand() % (int) (sizeof(text) - 1);
+            for (int i = 0; i < len; i++) {
+                text[i] = rand() % 3 == 0 ? ' ' : (char) ('a' + rand() % 26);
+            }
+            text[len] = '\0';
+            screen_print((byte) (1 + rand() % SCREEN_ROWS), (byte) (1 + rand() % SCREEN_COLS), text);
+        }
+        byte row = (byte) (1 + rand() % SCREEN_ROWS);
+        byte col = (byte) (1 + rand() % SCREEN_COLS);
+        screen_move(row, col);
+        if (rand() % 4 == 0) {
+            // Something else wrote on the terminal between frames
+            term_write("\r\nhello\r\n> ");
+        }
+        screen_commit();
+
+        CHECK(fake_term_in_sync());
+        CHECK_EQ(fake_glass.row, row - 1);
+        CHECK_EQ(fake_glass.col, col - 1);
+    }
+}
+
+int main() {
+    test_first_frame();
+    test_same_frame();
+    test_one_cell();
+    test_stale_tail();
+    test_stale_rows();
+    test_last_cell();
+    test_release();
+    test_random_frames();
+    return check_failures();
+}
@@ -0,0 +1,168 @@
+// The session manager with two sessions that keep what they're typed: the
+// hot key switching between them with keys typed after it, and a backlog
+// that has wrapped drawn again from a whole line, on coming back or when the
+// session in front falls that far behind.
+
+#include "check.h"
+#include "fake_term.h"
+#include "../session.h"
+#include "../relay.h"
+
+// What session.cpp needs from sched.cpp and term.cpp beyond fake_term:
+// the sessions task, run by hand
+static void (*_sessions_loop)() = NULL;
+
+int sched_add(const char *, void (*poll)(), bool (*)(), uint16_t, uint16_t, uint8_t) {
+    _sessions_loop = poll;
+    return 0;
+}
+
+void sched_remove(int) {
+    _sessions_loop = NULL;
+}
+
+void sched_set_flags(int, uint8_t) {
+}
+
+void term_writeln(const char *val) {
+    term_write(val);
+    term_writeln();
+}
+
+void term_writeln() {
+    term_write("\r\n");
+}
+
+extern "C" char *sbrk(int) {
+    static char heap;
+    return &heap;
+}
+
+// And relay.cpp from net.cpp
+int net_available(Client &client) {
+    return client.available();
+}
+
+struct typist {
+    char typed[32];
+    size_t len;
+};
+
+static bool typist_poll(void *ctx, bool keys) {
+    struct typist *t = (struct typist *) ctx;
+    if (keys) {
+        uint8_t buf[16];
+        size_t len = relay_hot_key(buf, term_read(buf, sizeof(buf)));
+        memcpy(t->typed + t->len, buf, len);
+        t->len += len;
+    }
+    return true;
+}
+
+static size_t typist_render(const uint8_t *buf, size_t len) {
+    return term_write_some(buf, len);
+}
+
+static int _focused = 0;
+
+static void typist_focus(void *, bool front) {
+    if (front) {
+        _focused++;
+    }
+}
+
+static void typist_close(void *) {
+}
+
+static const struct session_ops _ops = {sizeof(struct typist), typist_poll, NULL, typist_render, typist_focus,
+                                        typist_close};
+
+static struct typist _one;
+static struct typist _two;
+static struct session *_session_one;
+
+static void test_hot_key() {
+    fake_term_reset();
+    _session_one = session_open("a", &_ops, &_one);
+    session_open("b", &_ops, &_two);
+    CHECK(_sessions_loop != NULL);
+
+    // Typed to b in one read: what follows the command goes to a
+    fake_term_type("xy\x1c" "1zw");
+    _sessions_loop();
+    CHECK_EQ(_two.len, 2);
+    CHECK(memcmp(_two.typed, "xy", 2) == 0);
+    _sessions_loop();
+    CHECK_EQ(_one.len, 2);
+    CHECK(memcmp(_one.typed, "zw", 2) == 0);
+    CHECK_EQ(_two.len, 2);
+
+    // The command can come in a later read, and keys after it still count
+    fake_term_type("q\x1c");
+    _sessions_loop();
+    fake_term_type("2r");
+    _sessions_loop();
+    CHECK_EQ(_one.len, 3);
+    CHECK_EQ(_two.len, 3);
+    CHECK(memcmp(_two.typed, "xyr", 3) == 0);
+}
+
+// 100 bytes with an escape sequence in the middle, starting with first
+static void fill_line(char *line, char first) {
+    memset(line, 'x', 75);
+    memcpy(line + 75, "\x1b[7m", 4);
+    memset(line + 79, 'y', 15);
+    memcpy(line + 94, "\x1b[0m\r\n", 7);
+    line[0] = first;
+}
+
+static void test_replay() {
+    // a is in the back; eleven lines of 100 bytes, each with an escape
+    // sequence, leave the oldest kept byte in the middle of one
+    char line[101];
+    for (int i = 0; i < 11; i++) {
+        fill_line(line, (char) ('a' + i));
+        session_output(_session_one, (const uint8_t *) line, 100);
+    }
+
+    fake_term_clear_out();
+    CHECK(session_resume(1));
+    // The screen is cleared, then the ten whole lines are drawn
+    CHECK_EQ(fake_term_len, 1 + 1000);
+    CHECK_EQ(fake_term_out[0], TERM_CLEAR);
+    CHECK_EQ(fake_term_out[1], 'b');
+}
+
+static void test_behind() {
+    // a is in front, and the terminal takes nothing until eleven lines have
+    // come, more than the backlog keeps
+    fake_term_clear_out();
+    fake_term_room = 0;
+    int focused = _focused;
+    char line[101];
+    for (int i = 0; i < 11; i++) {
+        fill_line(line, (char) ('k' + i));
+        session_output(_session_one, (const uint8_t *) line, 100);
+    }
+    // Rather than go on from the middle of the oldest line kept, it starts
+    // over: render is told, the screen is cleared, and the ten whole lines
+    // are drawn once there's room
+    CHECK_EQ(_focused, focused + 1);
+    CHECK_EQ(fake_term_len, 1);
+    CHECK_EQ(fake_term_out[0], TERM_CLEAR);
+    fake_term_room = 1023;
+    _sessions_loop();
+    CHECK_EQ(fake_term_len, 1 + 1000);
+    CHECK_EQ(fake_term_out[1], 'l');
+
+    struct session_stats stats;
+    session_get_stats(&stats);
+    CHECK_EQ(stats.restarts, 1);
+}
+
+int main() {
+    test_hot_key();
+    test_replay();
+    test_behind();
+    return check_failures();
+}
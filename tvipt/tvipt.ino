@@ -1,18 +1,26 @@
 #include "term.h"
 #include "wifi.h"
 #include "cli.h"
+#include "sched.h"
+#include "net.h"
 
 #include "config.h"
 
 void setup() {
     term_init();
     wifi_init();
+    net_init();
     cli_init();
 
+    sched_add("term", term_loop, term_ready, 0, 500);
+    // The chip's events are only handled here
+    sched_add("net", net_loop, NULL, 0, 500);
+    sched_add("wifi", wifi_loop, NULL, 100, 500);
+    // Commands block until they're done
+    sched_add("cli", cli_loop, NULL, 0, 0);
+
     // Drain any queued keys (noise?) so we don't put garbage in the command buffer.
-    while (term_serial.available()) {
-        term_serial.read();
-    }
+    term_discard_input();
 
     term_writeln("tvipt/1 (TeleVideo Personal Terminal) Operating System");
     term_writeln("");
@@ -22,6 +30,5 @@ void setup() {
 }
 
 void loop() {
-    wifi_loop();
-    cli_loop();
+    sched_loop();
 }
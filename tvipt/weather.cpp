@@ -1,10 +1,10 @@
 #include "weather.h"
+#include "forecast.h"
 #include "http.h"
 #include "term.h"
+#include "screen.h"
 #include "util.h"
 
-#define FUTURE_PERIODS 14
-
 struct get_mapclick_url_ctx {
     char *url;
     size_t url_size;
@@ -21,34 +21,28 @@ struct get_mapclick_data_ctx {
     size_t data_bytes_read;
 };
 
-struct period_forecast {
-    char name[24];
-    char weather[42];
-    char temperature_label[5];
-    char temperature[4];
-    char precipitation[4];
-};
 
-struct weather {
-    char timestamp[32];
-    char area[32];
-
-    // Current conditions
-    char station_id[24];
-    char station_name[64];
-    char description[24];
-    short temperature;
-    short dewpoint;
-    short relative_humidity;
-    short wind_speed;
-    short wind_direction;
-    short gust;
-    char sea_level_pressure[6];
-
-    // Future
-    struct period_forecast future[FUTURE_PERIODS];
+// Everything a forecast needs across waits.  It's too big to keep around,
+// so it's only allocated while the command runs.
+struct weather_job {
+    struct pt http_pt;
+    struct http_request req;
+
+    // "/zipcity.php?inputstring=" and the zip
+    char path_and_query[32];
+    struct get_mapclick_url_ctx url_ctx;
+    char mapclick_url[200];
+
+    struct url_parts parts;
+    char json_path_and_query[256];
+    struct get_mapclick_data_ctx data_ctx;
+    char mapclick_json[6000];
+
+    struct weather weather;
 };
 
+static struct weather_job *_job = NULL;
+
 void get_mapclick_url_header_cb(struct http_request *req, const char *header, const char *value) {
     struct get_mapclick_url_ctx *ctx = (struct get_mapclick_url_ctx *) req->caller_ctx;
 
@@ -57,37 +51,39 @@ void get_mapclick_url_header_cb(struct http_request *req, const char *header, co
     }
 }
 
-boolean get_mapclick_url(const char *zip, char *mapclick_url, size_t mapclick_url_size) {
+// Sets up the request for the MapClick URL, which comes as a redirect
+void get_mapclick_url_begin(const char *zip) {
     const char base_path_and_query[] = "/zipcity.php?inputstring=";
 
     // Append the zip to the query string; 5 extra bytes for the zip
-    char path_and_query[sizeof(base_path_and_query) + 5];
+    char *path_and_query = _job->path_and_query;
     scopy(path_and_query, base_path_and_query, sizeof(base_path_and_query));
     // strlen doesn't include the terminator; copy 6 from zip to copy its terminator
     scopy(path_and_query + strlen(path_and_query), zip, 6);
 
-    struct get_mapclick_url_ctx ctx;
-    ctx.url = mapclick_url;
-    ctx.url_size = mapclick_url_size;
+    struct get_mapclick_url_ctx *ctx = &_job->url_ctx;
+    ctx->url = _job->mapclick_url;
+    ctx->url_size = sizeof(_job->mapclick_url);
 
-    struct http_request req;
-    http_request_init(&req);
-    req.host = "forecast.weather.gov";
-    req.path_and_query = path_and_query;
-    req.header_cb = get_mapclick_url_header_cb;
-    req.body_cb = NULL;
-    req.caller_ctx = &ctx;
+    struct http_request *req = &_job->req;
+    http_request_init(req);
+    req->host = "forecast.weather.gov";
+    req->path_and_query = path_and_query;
+    req->header_cb = get_mapclick_url_header_cb;
+    req->body_cb = NULL;
+    req->caller_ctx = ctx;
 
-    memset(mapclick_url, '\0', mapclick_url_size);
-    http_get(&req);
+    memset(_job->mapclick_url, '\0', sizeof(_job->mapclick_url));
+}
 
-    if (req.status != 302) {
+boolean get_mapclick_url_end() {
+    if (_job->req.status != 302) {
         term_write("HTTP error getting MapClick URL: ");
-        term_println(req.status, DEC);
+        term_println(_job->req.status, DEC);
         return false;
     }
 
-    if (strlen(mapclick_url) == 0) {
+    if (strlen(_job->mapclick_url) == 0) {
         term_writeln("Got an empty MapClick URL from the redirect.");
         return false;
     }
@@ -95,62 +91,66 @@ boolean get_mapclick_url(const char *zip, char *mapclick_url, size_t mapclick_ur
     return true;
 }
 
-void get_mapclick_data_body_cb(struct http_request *req) {
+bool get_mapclick_data_body_cb(struct http_request *req) {
     struct get_mapclick_data_ctx *ctx = (struct get_mapclick_data_ctx *) req->caller_ctx;
 
-    // Read until the request is over or until we reach the penultimate byte
-    while (req->client->connected() && ctx->data_i < ctx->data_last) {
-        int c = req->client->read();
-        if (c != -1) {
-            *ctx->data_i++ = c;
-            ctx->data_bytes_read++;
-        }
+    // Take what's there, up to the penultimate byte
+    size_t room = (size_t) (ctx->data_last - ctx->data_i);
+    int got = req->client->read((uint8_t *) ctx->data_i, min((size_t) req->client->available(), room));
+    if (got > 0) {
+        ctx->data_i += got;
+        ctx->data_bytes_read += got;
     }
+    return ctx->data_i < ctx->data_last;
 }
 
-bool get_mapclick_json(const char *mapclick_url, char *mapclick_json, size_t mapclick_json_size) {
+// Sets up the request for the forecast JSON from the MapClick URL
+bool get_mapclick_json_begin() {
     // Parse the mapclick URL so we can add a query param and query it
-    struct url_parts parts;
-    if (!parse_url(&parts, mapclick_url)) {
+    struct url_parts *parts = &_job->parts;
+    if (!parse_url(parts, _job->mapclick_url)) {
         term_writeln("Could not parse the MapClick URL that was returned: ");
-        term_writeln(mapclick_url);
+        term_writeln(_job->mapclick_url);
         return false;
     }
 
     // There are already some query args, so add one more
-    char json_path_and_query[256];
-    scopy(json_path_and_query, parts.path_and_query, sizeof(json_path_and_query));
+    char *json_path_and_query = _job->json_path_and_query;
+    size_t json_path_and_query_size = sizeof(_job->json_path_and_query);
+    scopy(json_path_and_query, parts->path_and_query, json_path_and_query_size);
     scopy(json_path_and_query + strlen(json_path_and_query), "&FcstType=json",
-          sizeof(json_path_and_query) - strlen(parts.path_and_query));
-
-    struct get_mapclick_data_ctx ctx;
-    ctx.data = mapclick_json;
-    ctx.data_size = mapclick_json_size;
-    ctx.data_i = ctx.data;
-    ctx.data_last = ctx.data + ctx.data_size - 1;
-    ctx.data_bytes_read = 0;
-
-    struct http_request req;
-    http_request_init(&req);
-    req.host = parts.host;
-    if (parts.port != 0) {
-        req.port = parts.port;
-    }
-    req.path_and_query = json_path_and_query;
-    req.header_cb = NULL;
-    req.body_cb = get_mapclick_data_body_cb;
-    req.caller_ctx = &ctx;
-
-    memset(mapclick_json, '\0', mapclick_json_size);
-    http_get(&req);
+          json_path_and_query_size - strlen(parts->path_and_query));
+
+    struct get_mapclick_data_ctx *ctx = &_job->data_ctx;
+    ctx->data = _job->mapclick_json;
+    ctx->data_size = sizeof(_job->mapclick_json);
+    ctx->data_i = ctx->data;
+    ctx->data_last = ctx->data + ctx->data_size - 1;
+    ctx->data_bytes_read = 0;
+
+    struct http_request *req = &_job->req;
+    http_request_init(req);
+    req->host = parts->host;
+    if (parts->port != 0) {
+        req->port = parts->port;
+    }
+    req->path_and_query = json_path_and_query;
+    req->header_cb = NULL;
+    req->body_cb = get_mapclick_data_body_cb;
+    req->caller_ctx = ctx;
+
+    memset(_job->mapclick_json, '\0', sizeof(_job->mapclick_json));
+    return true;
+}
 
-    if (req.status != 200) {
+bool get_mapclick_json_end() {
+    if (_job->req.status != 200) {
         term_write("HTTP error getting MapClick data: ");
-        term_println(req.status, DEC);
+        term_println(_job->req.status, DEC);
         return false;
     }
 
-    if (strlen(mapclick_json) == 0) {
+    if (strlen(_job->mapclick_json) == 0) {
         term_writeln("Got no MapClick data.");
         return false;
     }
@@ -380,111 +380,36 @@ bool parse_mapclick_json(const char *mapclick_json, struct weather *weather) {
     return true;
 }
 
-const char *wind_direction(int angle) {
-    if (angle == 999) {
-        return "?";
-    }
-
-    const char *dirs[] = {"N", "NE", "E", "SE", "S", "SW", "W", "NW", "N"};
-    const short angles[] = {0, 45, 90, 135, 180, 225, 270, 315, 360};
-
-    short min_diff = 360;
-    const char *dir_for_min_diff = NULL;
-
-    // Quick and dirty "find closest direction"
-    for (short i = 0; i < sizeof(dirs); i++) {
-        short diff = (short) abs(angle - angles[i]);
-        if (diff < min_diff) {
-            min_diff = diff;
-            dir_for_min_diff = dirs[i];
-        }
-    }
-
-    return dir_for_min_diff;
-}
-
-void print_weather(struct weather *weather) {
-    term_clear();
-
-    term_write(weather->area);
-    term_write(" (");
-    term_write(weather->timestamp);
-    term_writeln(")");
-
-    term_write(" Station:      ");
-    term_write(weather->station_id);
-    term_write(" (");
-    term_write(weather->station_name);
-    term_writeln(")");
-
-    term_write(" Weather:      ");
-    term_writeln(weather->description);
-
-    term_write(" Temperature:  ");
-    term_print(weather->temperature, DEC);
-    term_writeln(" F");
-
-    term_write(" Humidity:     ");
-    term_print(weather->relative_humidity, DEC);
-    term_writeln(" %");
-
-    term_write(" Dewpoint:     ");
-    term_print(weather->dewpoint, DEC);
-    term_writeln(" F");
-
-    term_write(" Pressure:     ");
-    term_write(weather->sea_level_pressure);
-    term_writeln(" in/Hg");
-
-    term_write(" Wind:         ");
-    term_print(weather->wind_speed, DEC);
-    term_write(" mph (gusts ");
-    term_print(weather->gust, DEC);
-    term_write(" mph) from the ");
-    term_writeln(wind_direction(weather->wind_direction));
-
-    term_writeln("");
-
-    for (int i = 0; i < 12; i++) {
-        int row = 10 + i;
-        struct period_forecast fc = weather->future[i];
-
-        term_print(row, 1, fc.name);
-        term_print(row, 18, fc.temperature_label);
-        term_print(row, 24, fc.temperature);
-        term_print(row, 28, fc.precipitation);
-        if (strlen(fc.precipitation) > 0) {
-            term_write("%");
-        }
-        term_print(row, 33, fc.weather, 80 - 43);
+PT_THREAD(weather(struct pt *pt, const char *zip)) {
+    PT_BEGIN(pt);
+    // Zeroed, which the parser counts on
+    _job = new weather_job();
+    if (_job == NULL) {
+        term_writeln("Not enough memory to get the forecast.");
+        PT_EXIT(pt);
     }
 
-    term_writeln("");
-    term_writeln("");
-}
+    get_mapclick_url_begin(zip);
+    PT_SPAWN(pt, &_job->http_pt, http_get(&_job->http_pt, &_job->req));
 
-void weather(const char *zip) {
-    char mapclick_url[200];
-    if (!get_mapclick_url(zip, mapclick_url, sizeof(mapclick_url))) {
+    if (!get_mapclick_url_end()) {
         term_writeln("Could not resolve city and state to a location.");
         term_writeln("Was that a valid ZIP code?");
-        return;
-    }
-
-    char mapclick_json[6000];
-    if (!get_mapclick_json(mapclick_url, mapclick_json, sizeof(mapclick_json))) {
+    } else if (!get_mapclick_json_begin()) {
         term_writeln("Could not read the forecast data.  This might be a temporary problem.");
-        return;
-    }
-
-    struct weather weather;
-    memset(&weather, 0, sizeof(weather));
-
-    if (!parse_mapclick_json(mapclick_json, &weather)) {
-        term_writeln("Could not parse the forecast JSON.");
-        return;
+    } else {
+        PT_SPAWN(pt, &_job->http_pt, http_get(&_job->http_pt, &_job->req));
+
+        if (!get_mapclick_json_end()) {
+            term_writeln("Could not read the forecast data.  This might be a temporary problem.");
+        } else if (!parse_mapclick_json(_job->mapclick_json, &_job->weather)) {
+            term_writeln("Could not parse the forecast JSON.");
+        } else {
+            print_weather(&_job->weather);
+        }
     }
 
-    print_weather(&weather);
+    delete _job;
+    _job = NULL;
+    PT_END(pt);
 }
-
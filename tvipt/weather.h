@@ -1,6 +1,10 @@
 #ifndef _WEATHER_H
 #define _WEATHER_H
 
-void weather(const char *zip);
+#include "pt.h"
+
+// Fetches and shows the forecast for zip, waiting on the network without
+// holding up the loop.
+PT_THREAD(weather(struct pt *pt, const char *zip));
 
 #endif
@@ -1,13 +1,39 @@
 #include <WiFi101.h>
 
 #include "wifi.h"
+#include "wifi_shim.h"
 #include "term.h"
 #include "util.h"
+#include "pt.h"
+
+/*
+ * WiFi.begin() asks the chip to connect and then handles events until
+ * it's connected or a minute has gone by, which stops everything else for
+ * as long as a join takes.  wifi_join() does the asking through
+ * wifi_shim.cpp, which leaves WiFi101 as begin() would, so its callback
+ * still sees the connection and DHCP through, but returns at once;
+ * wifi_loop() watches WiFi.status() for the outcome and gives up at the
+ * deadline.
+ *
+ * Once joined, wifi_loop() keeps watching.  If the network goes away it
+ * joins again with the same SSID and password, backing off from
+ * WIFI_REJOIN_MIN_MS to WIFI_REJOIN_MAX_MS between tries, while sessions
+ * and the command line carry on.  A join that never worked isn't retried.
+ */
 
 static char _ssid[40];
 static char _pass[40];
 
-static void (*_loop_cb)();
+static enum wifi_join_state _join = WIFI_JOIN_IDLE;
+static unsigned long _join_deadline;
+
+// Set once joined: losing the network starts rejoins
+static bool _rejoin = false;
+static unsigned long _rejoin_ms;
+static unsigned long _rejoin_at;
+
+static uint32_t _drops = 0;
+static uint32_t _rejoins = 0;
 
 void wifi_init() {
     WiFi.setPins(8, 7, 4, 2);
@@ -15,22 +41,90 @@ void wifi_init() {
     _pass[0] = '\0';
 }
 
-void wifi_loop() {
-    if (_loop_cb != NULL) {
-        _loop_cb();
+// Asks the chip to join _ssid
+static bool join_begin(unsigned long timeout_ms) {
+    if (!wifi_shim_begin(_ssid, _pass)) {
+        _join = WIFI_JOIN_FAILED;
+        return false;
     }
+    _join = WIFI_JOIN_WAITING;
+    _join_deadline = millis() + timeout_ms;
+    return true;
 }
 
-void wifi_connect(const char *ssid, const char *pass) {
+// Tries again after the backoff, which doubles for the next time
+static void rejoin_later() {
+    _join = WIFI_JOIN_LOST;
+    _rejoin_at = millis() + _rejoin_ms;
+    _rejoin_ms = min(_rejoin_ms * 2, (unsigned long) WIFI_REJOIN_MAX_MS);
+}
+
+bool wifi_join(const char *ssid, const char *pass, unsigned long timeout_ms) {
     scopy(_ssid, ssid, sizeof(_ssid));
     scopy(_pass, pass, sizeof(_pass));
-    if (0 && strlen(_pass) == 0) {
-      WiFi.begin(_ssid);
-    } else {
-      WiFi.begin(_ssid, _pass);
+    _rejoin = false;
+    return join_begin(timeout_ms);
+}
+
+static void join_loop() {
+    switch (WiFi.status()) {
+        case WL_CONNECTED:
+            _join = WIFI_JOIN_JOINED;
+            _rejoin = true;
+            _rejoin_ms = WIFI_REJOIN_MIN_MS;
+            return;
+        case WL_DISCONNECTED:
+        case WL_CONNECT_FAILED:
+        case WL_NO_SSID_AVAIL:
+            _join = WIFI_JOIN_FAILED;
+            wifi_shim_give_up(false);
+            break;
+        default:
+            if (!PT_PASSED(_join_deadline)) {
+                return;
+            }
+            _join = WIFI_JOIN_TIMED_OUT;
+            wifi_shim_give_up(true);
+            break;
+    }
+    if (_rejoin) {
+        rejoin_later();
     }
 }
 
+void wifi_loop() {
+    switch (_join) {
+        case WIFI_JOIN_WAITING:
+            join_loop();
+            break;
+        case WIFI_JOIN_JOINED:
+            if (WiFi.status() != WL_CONNECTED) {
+                dbg_serial.println("wifi: lost the network");
+                _drops++;
+                rejoin_later();
+            }
+            break;
+        case WIFI_JOIN_LOST:
+            if (PT_PASSED(_rejoin_at)) {
+                _rejoins++;
+                if (!join_begin(WIFI_JOIN_TIMEOUT_MS)) {
+                    rejoin_later();
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+enum wifi_join_state wifi_get_join_state() {
+    return _join;
+}
+
+bool wifi_joining() {
+    return _join == WIFI_JOIN_WAITING;
+}
+
 bool wifi_is_connected() {
     return WiFi.status() == WL_CONNECTED;
 }
@@ -85,6 +179,8 @@ void wifi_get_info(struct wifi_info *info) {
     info->gateway = WiFi.gatewayIP();
     info->time = WiFi.getTime();
     info->firmware_version = WiFi.firmwareVersion();
+    info->drops = _drops;
+    info->rejoins = _rejoins;
 }
 
 int wifi_scan(void (&scan_cb)(struct wifi_network)) {
@@ -102,11 +198,3 @@ int wifi_scan(void (&scan_cb)(struct wifi_network)) {
     }
 }
 
-void wifi_set_loop_callback(void (*loop_cb)()) {
-    _loop_cb = loop_cb;
-}
-
-bool wifi_has_loop_callback() {
-    return _loop_cb != NULL;
-}
-
@@ -5,6 +5,27 @@
 
 #include <WiFi101.h>
 
+// How long j waits for a network
+#define WIFI_JOIN_TIMEOUT_MS    20000
+
+// After a network that was joined is lost, rejoins are tried this long
+// apart, doubling each time up to the max
+#define WIFI_REJOIN_MIN_MS      1000
+#define WIFI_REJOIN_MAX_MS      64000
+
+enum wifi_join_state {
+    // Not asked to join
+    WIFI_JOIN_IDLE,
+    WIFI_JOIN_WAITING,
+    // Associated, with an address
+    WIFI_JOIN_JOINED,
+    // Turned down, or no such network
+    WIFI_JOIN_FAILED,
+    WIFI_JOIN_TIMED_OUT,
+    // Was joined and lost it; rejoining in the background
+    WIFI_JOIN_LOST,
+};
+
 struct wifi_info {
     int status;
     const char *status_description;
@@ -15,6 +36,9 @@ struct wifi_info {
     IPAddress gateway;
     uint32_t time;
     const char *firmware_version;
+    // Times the joined network was lost, and rejoins tried since
+    uint32_t drops;
+    uint32_t rejoins;
 };
 
 struct wifi_network {
@@ -25,9 +49,19 @@ struct wifi_network {
 
 void wifi_init();
 
+// Starts joining a WPA network and returns at once; wifi_loop() follows
+// the join from there.  False if the chip wouldn't start it.
+bool wifi_join(const char *ssid, const char *pass, unsigned long timeout_ms);
+
+// Polled as a task while the loop runs: follows joins, and rejoins the
+// network if it's lost.
 void wifi_loop();
 
-void wifi_connect(const char *ssid, const char *pass);
+enum wifi_join_state wifi_get_join_state();
+
+// True from wifi_join() until it's joined, failed or timed out, and while
+// a rejoin is being waited for
+bool wifi_joining();
 
 bool wifi_is_connected();
 
@@ -37,9 +71,5 @@ int wifi_scan(void (&scan_cb)(struct wifi_network));
 
 WiFiClient &wifi_get_client();
 
-void wifi_set_loop_callback(void (*loop_cb)(void));
-
-bool wifi_has_loop_callback();
-
 #endif
 
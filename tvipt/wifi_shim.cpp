@@ -0,0 +1,54 @@
+#include <WiFi101.h>
+
+extern "C" {
+#include "driver/include/m2m_wifi.h"
+}
+
+#include "wifi_shim.h"
+
+/*
+ * WiFi101 0.15.0's startConnect(), which begin() calls, is:
+ *
+ *   if (!_init) init();
+ *   if (_dhcp) { _localip = 0; _submask = 0; _gateway = 0; }
+ *   if (m2m_wifi_connect(...) < 0) { _status = WL_CONNECT_FAILED; return; }
+ *   _status = WL_IDLE_STATUS;
+ *   _mode = WL_STA_MODE;
+ *   ... handle events until connected, disconnected or a minute ...
+ *   memset(_ssid, 0, M2M_MAX_SSID_LEN); memcpy(_ssid, ssid, strlen(ssid));
+ *   if (!(_status & WL_CONNECTED)) _mode = WL_RESET_MODE;
+ *
+ * These are the same steps without the wait.  The members are public in
+ * that version.  After config() has set a static address _dhcp is 0, so
+ * the address is kept, and the event handler reports WL_CONNECTED on
+ * association without waiting for DHCP.
+ */
+
+bool wifi_shim_begin(const char *ssid, const char *pass) {
+    // status() does the init() begin() would
+    WiFi.status();
+    if (WiFi._dhcp) {
+        WiFi._localip = 0;
+        WiFi._submask = 0;
+        WiFi._gateway = 0;
+    }
+    size_t len = strlen(ssid);
+    if (m2m_wifi_connect((char *) ssid, (uint8) len, M2M_WIFI_SEC_WPA_PSK, (void *) pass, M2M_WIFI_CH_ALL) < 0) {
+        WiFi._status = WL_CONNECT_FAILED;
+        return false;
+    }
+    WiFi._status = WL_IDLE_STATUS;
+    WiFi._mode = WL_STA_MODE;
+
+    // begin() copies it once the wait is over; WiFi.SSID() reads it
+    memset(WiFi._ssid, 0, M2M_MAX_SSID_LEN);
+    memcpy(WiFi._ssid, ssid, min(len, (size_t) M2M_MAX_SSID_LEN - 1));
+    return true;
+}
+
+void wifi_shim_give_up(bool stop) {
+    if (stop) {
+        m2m_wifi_disconnect();
+    }
+    WiFi._mode = WL_RESET_MODE;
+}
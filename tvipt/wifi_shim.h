@@ -0,0 +1,27 @@
+// WiFi.begin() split in two, for wifi.cpp: start a join and return, and
+// later tidy up one that didn't happen.  Written against the internals of
+// WiFi101 0.15.0 (the version deps.sh installs); check it against
+// WiFiClass::begin() and startConnect() before moving to another.
+
+#ifndef _WIFI_SHIM_H
+#define _WIFI_SHIM_H
+
+// The WiFi101 version this and net.cpp's socket callback are written for,
+// and the one build.sh found (major * 10000 + minor * 100 + patch)
+#define WIFI_SHIM_WIFI101_VERSION   1500
+
+#if !defined(WIFI101_VERSION) || WIFI101_VERSION != WIFI_SHIM_WIFI101_VERSION
+#error "WiFi101 0.15.0 is needed (see deps.sh), and build.sh to say which is installed"
+#endif
+
+// What begin(ssid, pass) does before it waits: asks the chip to join a
+// WPA network, leaving WiFi in the state its event handler expects, so
+// WiFi.status() goes to WL_CONNECTED as usual.  False (and WiFi.status()
+// WL_CONNECT_FAILED) if the chip wouldn't start it.
+bool wifi_shim_begin(const char *ssid, const char *pass);
+
+// What begin() does when the wait ends without a connection.  With stop,
+// a join still under way is called off first.
+void wifi_shim_give_up(bool stop);
+
+#endif